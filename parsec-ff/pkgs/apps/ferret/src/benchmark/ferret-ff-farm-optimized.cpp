@@ -53,6 +53,7 @@ nornir::Instrumenter* instr;
 #define ENABLE_FF_ONDEMAND
 #include <ff/farm.hpp>
 #include <ff/pipeline.hpp>
+#include <ff/taskpool.hpp>
 #include <iostream>
 
 #ifdef ENABLE_PARSEC_HOOKS
@@ -119,6 +120,13 @@ struct rank_data
 	cass_result_t result;
 };
 
+/* file names sent by the emitter to the workers, recycled through a pool */
+struct path_task
+{
+	char path[BUFSIZ];
+};
+ff::ff_taskpool<path_task> *pathpool;
+
 /* ------- The Helper Functions ------- */
 int cnt_enqueue;
 int cnt_dequeue;
@@ -187,8 +195,8 @@ int Load::scan_dir (const char *dir, char *head)
 			return -1;
 		}
 	if (S_ISREG(st.st_mode)){
-		char* pathtask = new char[BUFSIZ];
-		pathtask = strdup(path);
+		path_task* pathtask = pathpool->get();
+		strcpy(pathtask->path, path);
 		ff_send_out((void*) pathtask);
 		cnt_enqueue++;
 	} 
@@ -218,9 +226,8 @@ struct load_data* file_helper (const char *file)
 	return data;
 }
 
-struct seg_data* segment(char* filename){
+struct seg_data* segment(const char* filename){
 	struct load_data * load = file_helper(filename);
-	delete[] filename;
 	assert(load != NULL);
     struct seg_data *seg = (struct seg_data *)calloc(1, sizeof(struct seg_data));
 
@@ -356,7 +363,10 @@ public:
 class CollapsedPipeline: public ff::ff_node{
 public:
 	void* svc(void* task){
-        return rank(vec(extract(segment((char*) task))));
+        path_task* pathtask = (path_task*) task;
+        struct seg_data* seg = segment(pathtask->path);
+        pathpool->put(pathtask, get_my_id()); // one return channel per worker
+        return rank(vec(extract(seg)));
 	}
 };
 
@@ -440,6 +450,9 @@ int main (int argc, char *argv[])
 #ifdef ENABLE_PARSEC_HOOKS
 	__parsec_roi_begin();
 #endif
+	/* enough file names for the tasks queued to and run by the workers,
+	   the emitter waits if they are all in flight */
+	pathpool = new ff::ff_taskpool<path_task>(4*nthreads, nthreads);
 	std::vector<ff::ff_node*> workers;
 	for(size_t i = 0; i < nthreads; i++){
 		workers.push_back(new CollapsedPipeline());
@@ -451,6 +464,7 @@ int main (int argc, char *argv[])
 #endif
 	farm.run_and_wait_end();
 	assert(cnt_enqueue == cnt_dequeue);
+	delete pathpool;
 #ifdef ENABLE_PARSEC_HOOKS
 	__parsec_roi_end();
 #endif
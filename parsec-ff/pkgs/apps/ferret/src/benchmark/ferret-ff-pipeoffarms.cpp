@@ -341,7 +341,8 @@ public:
 	}
 };
 
-class Out: public ff::ff_node{
+// last stage, it gathers the results directly from the rank workers
+class Out: public ff::ff_minode{
 private:
 	struct rank_data *rank;
 public:
@@ -474,7 +475,8 @@ int main (int argc, char *argv[])
 	vecFarm.setMultiInput();
 	vecFarm.remove_collector();
 	rankFarm.setMultiInput();
-	rankFarm.add_collector(new Out());
+	rankFarm.remove_collector();
+	Out out;
 
 #ifdef ENABLE_FF_ONDEMAND
 	segFarm.set_scheduling_ondemand();
@@ -486,6 +488,7 @@ int main (int argc, char *argv[])
 	p.add_stage(&extFarm);
 	p.add_stage(&vecFarm);
 	p.add_stage(&rankFarm);
+	p.add_stage(&out);
 
 	p.run_and_wait_end();
 
@@ -71,6 +71,23 @@ int ZDIVS = 1;  // number of partitions in Z
 #define MUTEXES_PER_CELL 128
 #define CELL_MUTEX_ID 0
 
+//With ENABLE_MCS_LOCKS (set in the FastFlow build configuration) the cell
+//locks are MCS queue locks, otherwise they are mutexes
+#ifdef ENABLE_MCS_LOCKS
+#include <ff/mcs-lock.h>
+typedef ff_mcs_lock_t cell_lock_t;
+#define CELL_LOCK_INIT(l) ff_mcs_init(l)
+#define CELL_LOCK_DESTROY(l) ff_mcs_destroy(l)
+#define CELL_LOCK(l) ff_mcs_lock(l)
+#define CELL_UNLOCK(l) ff_mcs_unlock(l)
+#else
+typedef pthread_mutex_t cell_lock_t;
+#define CELL_LOCK_INIT(l) pthread_mutex_init(l, NULL)
+#define CELL_LOCK_DESTROY(l) pthread_mutex_destroy(l)
+#define CELL_LOCK(l) pthread_mutex_lock(l)
+#define CELL_UNLOCK(l) pthread_mutex_unlock(l)
+#endif //ENABLE_MCS_LOCKS
+
 struct Grid
 {
   union {
@@ -82,7 +99,7 @@ struct Grid
   };
 } *grids;
 bool  *border;
-pthread_mutex_t **mutex;  // used to lock cells in RebuildGrid and also particles in other functions
+cell_lock_t **mutex;  // used to lock cells in RebuildGrid and also particles in other functions
 
 ff::ParallelFor* ffpf;
 int frames;
@@ -262,14 +279,14 @@ void InitSim(char const *fileName, unsigned int threadnum)
            } // for(int dk = -1; dk <= 1; ++dk)
         }
 
-  mutex = new pthread_mutex_t *[numCells];
+  mutex = new cell_lock_t *[numCells];
   for(int i = 0; i < numCells; ++i)
   {
     assert(CELL_MUTEX_ID < MUTEXES_PER_CELL);
     int n = (border[i] ? MUTEXES_PER_CELL : CELL_MUTEX_ID+1);
-    mutex[i] = new pthread_mutex_t[n];
+    mutex[i] = new cell_lock_t[n];
     for(int j = 0; j < n; ++j)
-      pthread_mutex_init(&mutex[i][j], NULL);
+      CELL_LOCK_INIT(&mutex[i][j]);
   }
   //make sure Cell structure is multiple of estiamted cache line size
   assert(sizeof(Cell) % CACHELINE_SIZE == 0);
@@ -486,7 +503,7 @@ void CleanUpSim()
     assert(CELL_MUTEX_ID < MUTEXES_PER_CELL);
     int n = (border[i] ? MUTEXES_PER_CELL : CELL_MUTEX_ID+1);
     for(int j = 0; j < n; ++j)
-      pthread_mutex_destroy(&mutex[i][j]);
+      CELL_LOCK_DESTROY(&mutex[i][j]);
     delete[] mutex[i];
   }
   delete[] mutex;
@@ -594,7 +611,7 @@ void RebuildGridMT()
           int index = (ck*ny + cj)*nx + ci;
           // this assumes that particles cannot travel more than one grid cell per time step
           if(border[index])
-            pthread_mutex_lock(&mutex[index][CELL_MUTEX_ID]);
+            CELL_LOCK(&mutex[index][CELL_MUTEX_ID]);
           Cell *cell = last_cells[index];
           int np = cnumPars[index];
 
@@ -606,7 +623,7 @@ void RebuildGridMT()
           }
           ++cnumPars[index];
           if(border[index])
-            pthread_mutex_unlock(&mutex[index][CELL_MUTEX_ID]);
+            CELL_UNLOCK(&mutex[index][CELL_MUTEX_ID]);
 
           //copy source to destination particle
           
@@ -726,18 +743,18 @@ void ComputeDensitiesMT()
 
                   if(border[index])
                   {
-                    pthread_mutex_lock(&mutex[index][ipar % MUTEXES_PER_CELL]);
+                    CELL_LOCK(&mutex[index][ipar % MUTEXES_PER_CELL]);
                     cell->density[ipar % PARTICLES_PER_CELL] += tc;
-                    pthread_mutex_unlock(&mutex[index][ipar % MUTEXES_PER_CELL]);
+                    CELL_UNLOCK(&mutex[index][ipar % MUTEXES_PER_CELL]);
                   }
                   else
                     cell->density[ipar % PARTICLES_PER_CELL] += tc;
 
                   if(border[indexNeigh])
                   {
-                    pthread_mutex_lock(&mutex[indexNeigh][iparNeigh % MUTEXES_PER_CELL]);
+                    CELL_LOCK(&mutex[indexNeigh][iparNeigh % MUTEXES_PER_CELL]);
                     neigh->density[iparNeigh % PARTICLES_PER_CELL] += tc;
-                    pthread_mutex_unlock(&mutex[indexNeigh][iparNeigh % MUTEXES_PER_CELL]);
+                    CELL_UNLOCK(&mutex[indexNeigh][iparNeigh % MUTEXES_PER_CELL]);
                   }
                   else
                     neigh->density[iparNeigh % PARTICLES_PER_CELL] += tc;
@@ -832,18 +849,18 @@ void ComputeForcesMT()
 
                   if( border[index])
                   {
-                    pthread_mutex_lock(&mutex[index][ipar % MUTEXES_PER_CELL]);
+                    CELL_LOCK(&mutex[index][ipar % MUTEXES_PER_CELL]);
                     cell->a[ipar % PARTICLES_PER_CELL] += acc;
-                    pthread_mutex_unlock(&mutex[index][ipar % MUTEXES_PER_CELL]);
+                    CELL_UNLOCK(&mutex[index][ipar % MUTEXES_PER_CELL]);
                   }
                   else
                     cell->a[ipar % PARTICLES_PER_CELL] += acc;
 
                   if( border[indexNeigh])
                   {
-                    pthread_mutex_lock(&mutex[indexNeigh][iparNeigh % MUTEXES_PER_CELL]);
+                    CELL_LOCK(&mutex[indexNeigh][iparNeigh % MUTEXES_PER_CELL]);
                     neigh->a[iparNeigh % PARTICLES_PER_CELL] -= acc;
-                    pthread_mutex_unlock(&mutex[indexNeigh][iparNeigh % MUTEXES_PER_CELL]);
+                    CELL_UNLOCK(&mutex[indexNeigh][iparNeigh % MUTEXES_PER_CELL]);
                   }
                   else
                     neigh->a[iparNeigh % PARTICLES_PER_CELL] -= acc;
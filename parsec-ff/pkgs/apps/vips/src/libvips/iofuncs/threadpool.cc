@@ -872,20 +872,9 @@ vips_threadpool_create_threads( VipsThreadpool *pool )
 #include <ff/farm.hpp>
 
 /**
- * This emitter is used because FastFlow's farm always require an emitter to
- * be present. In this specific application is not actually needed so it just
- * start, starts all the workers and then die.
+ * The farm has no emitter (see ff_farm::remove_emitter): the main thread
+ * offloads one GO_ON per worker into the farm's input channel, then the EOS.
  **/
-class Emitter: public ff::ff_node{
-public:
-    ff::ff_loadbalancer* _lb;
-
-    void* svc(void*){
-        _lb->broadcast_task(GO_ON);
-        return EOS;
-    }
-};
-
 class Worker: public ff::ff_node{
 private:
     VipsThreadpool *_pool; 
@@ -901,7 +890,7 @@ public:
             // Any valid pointer is ok, we just use a random global variable.
             ff_send_out((void*) &im__concurrency);
 	    }while(!_pool->stop && !_pool->error);
-        return EOS;
+        return GO_ON;
     }
 };
 
@@ -918,7 +907,7 @@ public:
 		if(_progress && _progress(_pool->a)){
 		    _pool->error = TRUE;
         }
-        return t;
+        return GO_ON;
     }
 };
 
@@ -964,9 +953,14 @@ vips_threadpool_run( VipsImage *im,
     for(size_t i = 0; i < im_concurrency_get(); i++){
         workers.push_back(new Worker(pool));
     }
-    ff::ff_farm<> farm(workers, new Emitter(), new Collector(pool, progress));
-    ((Emitter*) farm.getEmitter())->_lb = farm.getlb();
-    farm.run_and_wait_end();
+    ff::ff_farm<> farm(workers, NULL, new Collector(pool, progress), true);
+    farm.remove_emitter();
+    farm.run();
+    for(size_t i = 0; i < workers.size(); i++){
+        farm.offload(GO_ON);
+    }
+    farm.offload(EOS);
+    farm.wait();
 	/* Return 0 for success.
 	 */
 	result = pool->error ? -1 : 0;
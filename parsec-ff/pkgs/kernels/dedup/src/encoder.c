@@ -498,8 +498,8 @@ static int sub_Deduplicate(chunk_t *chunk) {
 
   //Query database to determine whether we've seen the data chunk before
 #ifdef ENABLE_PTHREADS
-  pthread_mutex_t *ht_lock = hashtable_getlock(cache, (void *)(chunk->sha1));
-  pthread_mutex_lock(ht_lock);
+  ht_lock_t *ht_lock = hashtable_getlock(cache, (void *)(chunk->sha1));
+  HT_LOCK(ht_lock);
 #endif
   entry = (chunk_t *)hashtable_search(cache, (void *)(chunk->sha1));
   isDuplicate = (entry != NULL);
@@ -520,7 +520,7 @@ static int sub_Deduplicate(chunk_t *chunk) {
     mbuffer_free(&chunk->uncompressed_data);
   }
 #ifdef ENABLE_PTHREADS
-  pthread_mutex_unlock(ht_lock);
+  HT_UNLOCK(ht_lock);
 #endif
 
   return isDuplicate;
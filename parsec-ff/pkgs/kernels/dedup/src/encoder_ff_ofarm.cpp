@@ -469,8 +469,8 @@ static int sub_Deduplicate(chunk_t *chunk) {
   SHA1_Digest(chunk->uncompressed_data.ptr, chunk->uncompressed_data.n, (unsigned char *)(chunk->sha1));
 
   //Query database to determine whether we've seen the data chunk before
-  pthread_mutex_t *ht_lock = hashtable_getlock(cache, (void *)(chunk->sha1));
-  pthread_mutex_lock(ht_lock);
+  ht_lock_t *ht_lock = hashtable_getlock(cache, (void *)(chunk->sha1));
+  HT_LOCK(ht_lock);
   entry = (chunk_t *)hashtable_search(cache, (void *)(chunk->sha1));
   isDuplicate = (entry != NULL);
   chunk->header.isDuplicate = isDuplicate;
@@ -487,7 +487,7 @@ static int sub_Deduplicate(chunk_t *chunk) {
     chunk->compressed_data_ref = entry;
     mbuffer_free(&chunk->uncompressed_data);
   }
-  pthread_mutex_unlock(ht_lock);
+  HT_UNLOCK(ht_lock);
 
   return isDuplicate;
 }
@@ -1006,12 +1006,14 @@ public:
 
 static void runSingleFarm(config_t * conf, struct thread_args* data_process_args,
         stats_t **threads_anchor_rv, stats_t **threads_chunk_rv, stats_t **threads_compress_rv){
-    ff::ff_ofarm ofarm;
+    // Ordering by sequence numbers: the chunks can be scheduled on-demand
+    ff::ff_seqfarm ofarm;
     std::vector<ff::ff_node*> workers;
     for(size_t i = 0; i < conf->nthreads; i++){workers.push_back(new CollapsedPipeline());}
     ofarm.setEmitterF(new Fragment(data_process_args, conf->nthreads));
     ofarm.add_workers(workers);
     ofarm.setCollectorF(new Reorder());
+    ofarm.set_scheduling_ondemand();
     //ofarm.cleanup_all();
     ofarm.run_and_wait_end();
 #ifdef ENABLE_STATISTICS
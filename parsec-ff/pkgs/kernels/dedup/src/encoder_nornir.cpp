@@ -464,8 +464,8 @@ static int sub_Deduplicate(chunk_t *chunk) {
   SHA1_Digest(chunk->uncompressed_data.ptr, chunk->uncompressed_data.n, (unsigned char *)(chunk->sha1));
 
   //Query database to determine whether we've seen the data chunk before
-  pthread_mutex_t *ht_lock = hashtable_getlock(cache, (void *)(chunk->sha1));
-  pthread_mutex_lock(ht_lock);
+  ht_lock_t *ht_lock = hashtable_getlock(cache, (void *)(chunk->sha1));
+  HT_LOCK(ht_lock);
   entry = (chunk_t *)hashtable_search(cache, (void *)(chunk->sha1));
   isDuplicate = (entry != NULL);
   chunk->header.isDuplicate = isDuplicate;
@@ -482,7 +482,7 @@ static int sub_Deduplicate(chunk_t *chunk) {
     chunk->compressed_data_ref = entry;
     mbuffer_free(&chunk->uncompressed_data);
   }
-  pthread_mutex_unlock(ht_lock);
+  HT_UNLOCK(ht_lock);
 
   return isDuplicate;
 }
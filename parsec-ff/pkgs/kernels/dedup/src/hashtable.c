@@ -87,10 +87,10 @@ struct hashtable * hashtable_create(unsigned int minsize,
   h->tablelength  = size;
 #if defined(ENABLE_PTHREADS) || defined(ENABLE_FF) || defined(ENABLE_NORNIR_NATIVE)
   //allocate and initialize array with locks
-  h->locks = (pthread_mutex_t *)malloc(sizeof(pthread_mutex_t) * size);
+  h->locks = (ht_lock_t *)malloc(sizeof(ht_lock_t) * size);
   if(NULL == h->locks) {free(h->table); free(h); return NULL;} /*oom*/
   for(pindex=0; pindex<size; pindex++) {
-    pthread_mutex_init(&(h->locks[pindex]), NULL);
+    HT_LOCK_INIT(&(h->locks[pindex]));
   }
 #endif
 #ifdef ENABLE_DYNAMIC_EXPANSION
@@ -118,7 +118,7 @@ unsigned int hash(struct hashtable *h, void *k) {
 
 #if defined(ENABLE_PTHREADS) || defined(ENABLE_FF) || defined(ENABLE_NORNIR_NATIVE)
 /*****************************************************************************/
-pthread_mutex_t * hashtable_getlock(struct hashtable *h, void *k) {
+ht_lock_t * hashtable_getlock(struct hashtable *h, void *k) {
   unsigned int hashvalue, index;
 
   hashvalue = hash(h,k);
@@ -303,7 +303,7 @@ void hashtable_destroy(struct hashtable *h, int free_values) {
   }
 #if defined(ENABLE_PTHREADS) || defined(ENABLE_FF) || defined(ENABLE_NORNIR_NATIVE)
   for(i=0; i<h->tablelength; i++) {
-    pthread_mutex_destroy(&(h->locks[i]));
+    HT_LOCK_DESTROY(&(h->locks[i]));
   }
   free(h->locks);
 #endif
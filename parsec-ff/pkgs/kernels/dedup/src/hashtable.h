@@ -40,6 +40,27 @@
 #include <pthread.h>
 #include "config.h"
 
+//Lock type used for the fine-granular locks of the hashtable. With
+//ENABLE_MCS_LOCKS (set in the FastFlow build configuration) MCS queue locks
+//are used instead of mutexes: threads waiting for a hot bucket spin on
+//their own cache line and acquire the lock in FIFO order
+#if defined(ENABLE_PTHREADS) || defined(ENABLE_FF) || defined(ENABLE_NORNIR_NATIVE)
+#ifdef ENABLE_MCS_LOCKS
+#include <ff/mcs-lock.h>
+typedef ff_mcs_lock_t ht_lock_t;
+#define HT_LOCK_INIT(l) ff_mcs_init(l)
+#define HT_LOCK_DESTROY(l) ff_mcs_destroy(l)
+#define HT_LOCK(l) ff_mcs_lock(l)
+#define HT_UNLOCK(l) ff_mcs_unlock(l)
+#else
+typedef pthread_mutex_t ht_lock_t;
+#define HT_LOCK_INIT(l) pthread_mutex_init(l, NULL)
+#define HT_LOCK_DESTROY(l) pthread_mutex_destroy(l)
+#define HT_LOCK(l) pthread_mutex_lock(l)
+#define HT_UNLOCK(l) pthread_mutex_unlock(l)
+#endif //ENABLE_MCS_LOCKS
+#endif
+
 //WARNING: Dynamic expansion is not thread-safe
 //#define ENABLE_DYNAMIC_EXPANSION
 
@@ -141,7 +162,7 @@ struct hashtable * hashtable_create(
  * accesses to the hash table with this key are thread-safe.
  */
 #if defined(ENABLE_PTHREADS) || defined(ENABLE_FF) || defined(ENABLE_NORNIR_NATIVE)
-pthread_mutex_t * hashtable_getlock(struct hashtable *h, void *k);
+ht_lock_t * hashtable_getlock(struct hashtable *h, void *k);
 #endif
 
 /*****************************************************************************
@@ -30,7 +30,7 @@ struct hashtable {
     struct hash_entry **table;
 #if defined(ENABLE_PTHREADS) || defined(ENABLE_FF) || defined(ENABLE_NORNIR_NATIVE)
     //Each entry in table array is protected with its own lock
-    pthread_mutex_t *locks;
+    ht_lock_t *locks;
 #endif
 #ifdef ENABLE_DYNAMIC_EXPANSION
     unsigned int entrycount;
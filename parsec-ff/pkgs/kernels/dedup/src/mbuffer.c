@@ -23,7 +23,15 @@
 //Use spin locks instead of mutexes (this file only)
 #define ENABLE_SPIN_LOCKS
 
-#ifdef ENABLE_SPIN_LOCKS
+#ifdef ENABLE_MCS_LOCKS
+//MCS queue locks (set in the FastFlow build configuration)
+#include <ff/mcs-lock.h>
+typedef ff_mcs_lock_t pthread_lock_t;
+#define PTHREAD_LOCK_INIT(l) ff_mcs_init(l)
+#define PTHREAD_LOCK_DESTROY(l) ff_mcs_destroy(l)
+#define PTHREAD_LOCK(l) ff_mcs_lock(l)
+#define PTHREAD_UNLOCK(l) ff_mcs_unlock(l)
+#elif defined(ENABLE_SPIN_LOCKS)
 typedef pthread_spinlock_t pthread_lock_t;
 #define PTHREAD_LOCK_INIT(l) pthread_spin_init(l, PTHREAD_PROCESS_PRIVATE)
 #define PTHREAD_LOCK_DESTROY(l) pthread_spin_destroy(l)
@@ -67,7 +67,7 @@ using namespace std;
 /* higher ITER also scales the running time almost linearly */
 #define ITER 3 // iterate ITER* k log k times; ITER >= 1
 
-#define CACHE_LINE 32 // cache line in byte
+#define CACHE_LINE 64 // cache line in byte
 
 /* this structure represents a point */
 /* these will be passed around to avoid copying coordinates */
@@ -94,8 +94,9 @@ static int nproc; //# of threads
 #ifdef FF_VERSION
 //support data structure for FF
 
+// pf and pfr are the same object: one pool of threads for all the loops
 typedef struct{
-	ff::ParallelFor *pf;
+	ff::ParallelForReduce<double> *pf;
 	ff::ParallelForReduce<double> *pfr;
 }ff_support;
 
@@ -922,97 +923,30 @@ float pspeedy(Points *points, float z, long *kcenter, int pid, pthread_barrier_t
 #if defined(FF_VERSION)
 double pgain(long x, Points *points, double z, long int *numcenters)
 {
-
-  /*
-   * To maintain a schema similar to the one of the pthreads implementation,
-   * the "parallel for"  are used to iterate over the available threads, each of which
-   * will execute work over a different portion of the data
-   */
-  int i;
-
-  double *work_mem;
   double gl_cost_of_opening_x = 0;
   int gl_number_of_centers_to_close = 0;
 
-  //each thread takes a block of working_mem.
-  int stride = *numcenters+2;
-  //make stride a multiple of CACHE_LINE
-  int cl = CACHE_LINE/sizeof(double);
-  if( stride % cl != 0 ) {
-	stride = cl * ( stride / cl + 1);
-  }
-  int K = stride -2 ; // K==*numcenters
-
-  //we must have a cost_of_opening_x local for each thread
-  double *cost_of_opening_x;
-
-
-  work_mem = (double*) malloc(stride*(nproc+1)*sizeof(double));
-  cost_of_opening_x = (double *)calloc(nproc,sizeof(double));
-
-  /*For each center, we have a *lower* field that indicates
-	how much we will save by closing the center.
-	Each thread has its own copy of the *lower* fields as an array.
-	We first build a table to index the positions of the *lower* fields.
+  /* For each center, we have a *lower* field that indicates
+	 how much we will save by closing the center.
+	 We first build a table to index the positions of the *lower* fields.
   */
-
-  long bsize = points->num/nproc;
-  for( int p = 0; p < nproc; p++ ) {
-	  long k1 = bsize*p;
-	  long k2 = k1 + bsize;
-	  if(p == nproc-1) {
-		  k2 = points->num;
-	  }
-	  int count = 0;
-	  for(int i = k1; i < k2; i++ ) {
-		  if( is_center[i] ) {
-			  center_table[i] = count++;
-		  }
+  int K = 0; // n. of centers
+  for( long i = 0; i < points->num; i++ ) {
+	  if( is_center[i] ) {
+		  center_table[i] = K++;
 	  }
-	  work_mem[p*stride] = count;
-  }
-
-
-  int accum = 0;
-  for( int p = 0; p < nproc; p++ ) {
-	  int tmp = (int)work_mem[p*stride];
-	  work_mem[p*stride] = accum;
-	  accum += tmp;
   }
-
-  for( int p = 0; p < nproc; p++ ) {
-	  long k1 = bsize*p;
-	  long k2 = k1 + bsize;
-	  if(p == nproc-1) {
-		k2 = points->num;
-	  }
-	  for( int i = k1; i < k2; i++ ) {
-		  if( is_center[i] ) {
-			  center_table[i] += (int)work_mem[p*stride];
-		  }
-	  }
-  }
-
-
-
-
-  //now we finish building the table. clear the working memory.
   memset(switch_membership , 0, points->num*sizeof(bool));
-  memset(work_mem, 0, stride*(nproc+1)*sizeof(double));
-
-
-
-  //global *lower* fields
-  double* gl_lower = &work_mem[nproc*stride];
 
-  fastflowsup.pf->parallel_for(0,nproc,[&](const long idx){
-	  long k1 = bsize*idx;
-	  long k2 = k1 + bsize;
-	  if (idx == nproc-1) k2 = points->num;
+  /* global *lower* fields: gl_lower[0..K-1], the cost of opening x is
+	 kept in gl_lower[K]. Each worker thread accumulates in its own
+	 (cache-aligned) copy of the array, then the copies are summed to z.
+  */
+  static std::vector<double> gl_lower;
+  gl_lower.assign(K+1, z);
 
-	  //my *lower* fields
-	  double* lower = &work_mem[idx*stride];
-	  for (int i = k1; i < k2; i++ ) {
+  fastflowsup.pfr->parallel_reduce_array(gl_lower.data(), K+1, 0.0, 0, points->num,
+	 [&](const long i, double *lower) {
 		  float x_cost = dist(points->p[i], points->p[x], points->dim)
 			* points->p[i].weight;
 		  float current_cost = points->p[i].cost;
@@ -1024,7 +958,7 @@ double pgain(long x, Points *points, double z, long int *numcenters)
 			// or else dist(p[i], p[x]) would be 0)
 
 			switch_membership[i] = 1;
-			cost_of_opening_x[idx] += x_cost - current_cost;
+			lower[K] += x_cost - current_cost;
 
 		  } else {
 
@@ -1038,84 +972,44 @@ double pgain(long x, Points *points, double z, long int *numcenters)
 			int assign = points->p[i].assign;
 			lower[center_table[assign]] += current_cost - x_cost;
 		  }
-	  }
+	 }, [](double &a, const double b) { a += b; }, nproc);
 
-  },nproc);
-
-
-  fastflowsup.pf->parallel_for(0,nproc,[&](const long idx){
-	 int number_of_centers_to_close = 0;
-
-	  long k1 = bsize*idx;
-	  long k2 = k1 + bsize;
-	  if (idx == nproc-1) k2 = points->num;
-	  // at this time, we can calculate the cost of opening a center
-	  // at x; if it is negative, we'll go through with opening it
-
-	  for ( int i = k1; i < k2; i++ ) {
-		  if( is_center[i] ) {
-			  double low = z;
-			  //aggregate from all threads
-			  for( int p = 0; p < nproc; p++ ) {
-				  low += work_mem[center_table[i]+p*stride];
-			  }
-			  gl_lower[center_table[i]] = low; //ok, questa non e'
-			  if ( low > 0 ) {
-				  // i is a median, and
-				  // if we were to open x (which we still may not) we'd close i
-
-				  // note, we'll ignore the following quantity unless we do open x
-				  ++number_of_centers_to_close;
-				  cost_of_opening_x[idx] -= low;
-			  }
+  // at this time, we can calculate the cost of opening a center
+  // at x; if it is negative, we'll go through with opening it
+  gl_cost_of_opening_x = gl_lower[K];
+  for( long i = 0; i < points->num; i++ ) {
+	  if( is_center[i] ) {
+		  double low = gl_lower[center_table[i]];
+		  if ( low > 0 ) {
+			  // i is a median, and
+			  // if we were to open x (which we still may not) we'd close i
+
+			  // note, we'll ignore the following quantity unless we do open x
+			  ++gl_number_of_centers_to_close;
+			  gl_cost_of_opening_x -= low;
 		  }
 	  }
-	  //use the rest of working memory to store the following
-	  work_mem[idx*stride + K] = number_of_centers_to_close;
-	  work_mem[idx*stride + K+1] = cost_of_opening_x[idx];
-  },nproc);
-
-
-  gl_cost_of_opening_x = z;
-  //aggregate
-  for( int p = 0; p < nproc; p++ ) {
-	  gl_number_of_centers_to_close += (int)work_mem[p*stride + K];
-	  gl_cost_of_opening_x += work_mem[p*stride+K+1];
   }
 
-
   // Now, check whether opening x would save cost; if so, do it, and
   // otherwise do nothing
 
   if ( gl_cost_of_opening_x < 0 ) {
 	  //  we'd save money by opening x; we'll do it
-	  fastflowsup.pf->parallel_for(0,nproc,[&](const long idx){
-
-		  long k1 = bsize*idx;
-		  long k2 = k1 + bsize;
-		  if (idx == nproc-1) k2 = points->num;
-		  for ( int i = k1; i < k2; i++ ) {
-			  bool close_center = gl_lower[center_table[points->p[i].assign]] > 0 ;
-			  if ( switch_membership[i] || close_center ) {
-				  // Either i's median (which may be i itself) is closing,
-				  // or i is closer to x than to its current median
-				  points->p[i].cost = points->p[i].weight *
-						  dist(points->p[i], points->p[x], points->dim);
-				  points->p[i].assign = x;
-			  }
+	  fastflowsup.pf->parallel_for(0,points->num,[&](const long i){
+		  bool close_center = gl_lower[center_table[points->p[i].assign]] > 0 ;
+		  if ( switch_membership[i] || close_center ) {
+			  // Either i's median (which may be i itself) is closing,
+			  // or i is closer to x than to its current median
+			  points->p[i].cost = points->p[i].weight *
+					  dist(points->p[i], points->p[x], points->dim);
+			  points->p[i].assign = x;
 		  }
-		  for( int i = k1; i < k2; i++ ) {
-			  if( is_center[i] && gl_lower[center_table[i]] > 0 ) {
-				  is_center[i] = false;
-			  }
-		  }
-		  if( x >= k1 && x < k2 ) {
-			  is_center[x] = true;
+		  if( is_center[i] && gl_lower[center_table[i]] > 0 ) {
+			  is_center[i] = false;
 		  }
 	  },nproc);
-
-
-
+	  is_center[x] = true;
 
 	  *numcenters = *numcenters + 1 - gl_number_of_centers_to_close;
   }
@@ -1123,12 +1017,6 @@ double pgain(long x, Points *points, double z, long int *numcenters)
 	  gl_cost_of_opening_x = 0;  // the value we'll return
   }
 
-  free(work_mem);
-  //    free(is_center);
-  //    free(switch_membership);
-  //    free(proc_cost_of_opening_x);
-  //    free(proc_number_of_centers_to_close);
-
   return -gl_cost_of_opening_x;
 }
 
@@ -2487,10 +2375,9 @@ int main(int argc, char **argv)
 #ifdef FF_VERSION
   //ParFor creation
 
-  ff::ParallelFor pf(nproc);
   ff::ParallelForReduce<double> pfr(nproc);
 
-  fastflowsup.pf=&pf;
+  fastflowsup.pf=&pfr;
   fastflowsup.pfr=&pfr;
 #endif
 
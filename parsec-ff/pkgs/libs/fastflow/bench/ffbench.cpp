@@ -0,0 +1,323 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/*
+ *  Microbenchmarks of the FastFlow run-time:
+ *
+ *   queue    throughput (producer(s) -> consumer(s)) and latency (ping-pong
+ *            between two threads, half round trip) of SWSR_Ptr_Buffer,
+ *            uSWSR_Ptr_Buffer, MPMC_Ptr_Queue, MSqueue and multiSWSR;
+ *   farm     dispatch overhead per task of a farm whose workers do nothing,
+ *            round-robin and on-demand scheduling, for 1..maxthreads workers;
+ *   pfor     ParallelFor overhead of an empty loop for several grains, per
+ *            loop and per iteration;
+ *   barrier  latency of Barrier and spinBarrier for 1..maxthreads threads.
+ *
+ *  The results are printed on stdout as CSV records (lines starting with '#'
+ *  are comments):
+ *
+ *     bench,impl,threads,param,metric,value,unit
+ *
+ *  so that the output of two versions of the run-time can be compared
+ *  (e.g. with join(1) on the first 5 fields). The configurations in which
+ *  the busy-waiting threads (spinBarrier, the CLH locks of multiSWSR, the
+ *  farm threads when BLOCKING_MODE is not defined) exceed the cores are
+ *  skipped, since their results would measure the OS scheduler.
+ *
+ *  compile: make (or g++ -std=c++11 -O3 -DBLOCKING_MODE -I.. ffbench.cpp -o ffbench -pthread)
+ *  usage:   ./ffbench [all|queue|farm|pfor|barrier] [maxthreads=ncores] [scale=1]
+ *           scale multiplies the n. of operations of each benchmark.
+ */
+
+/* ***************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License version 3 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ *  License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <type_traits>
+#include <ff/utils.hpp>
+#include <ff/mapping_utils.hpp>
+#include <ff/buffer.hpp>
+#include <ff/ubuffer.hpp>
+#include <ff/mpmc/MPMCqueues.hpp>
+#include <ff/barrier.hpp>
+#include <ff/farm.hpp>
+#include <ff/parallel_for.hpp>
+
+using namespace ff;
+
+static long scale = 1;
+static long ncores = 1;
+
+static inline double secs(ff_time_t t0) { return (ff_gettime()-t0)/1e9; }
+
+static void record(const char *bench, const char *impl, long threads, long param,
+                   const char *metric, double value, const char *unit) {
+    printf("%s,%s,%ld,%ld,%s,%.4f,%s\n", bench, impl, threads, param, metric, value, unit);
+    fflush(stdout);
+}
+
+// true (and a comment is printed) if nthreads busy-waiting threads exceed the cores
+static bool skip(const char *bench, const char *impl, long nthreads) {
+    if (nthreads <= ncores) return false;
+    printf("# skipped %s,%s,%ld: more busy-waiting threads than cores\n", bench, impl, nthreads);
+    return true;
+}
+
+// waiting loop of the benchmarks: threads may outnumber the cores
+static inline void backoff(unsigned &n) {
+    if (++n < 64) PAUSE(); else { n = 0; std::this_thread::yield(); }
+}
+
+/* -------------------------------- queues --------------------------------- */
+
+// common interface: init, push(data,tid), pop(&data,tid)
+enum { QSIZE=1024 };
+
+struct swsr_q {
+    static const char *name() { return "SWSR_Ptr_Buffer"; }
+    static const bool  mpmc = false, spin = false;
+    SWSR_Ptr_Buffer q;
+    swsr_q():q(QSIZE) {}
+    bool init()                          { return q.init(); }
+    inline bool push(void *p, int)       { return q.push(p); }
+    inline bool pop(void **p, int)       { return q.pop(p); }
+};
+struct uswsr_q {
+    static const char *name() { return "uSWSR_Ptr_Buffer"; }
+    static const bool  mpmc = false, spin = false;
+    uSWSR_Ptr_Buffer q;
+    uswsr_q():q(QSIZE) {}
+    bool init()                          { return q.init(); }
+    inline bool push(void *p, int)       { return q.push(p); }
+    inline bool pop(void **p, int)       { return q.pop(p); }
+};
+struct mpmc_q {
+    static const char *name() { return "MPMC_Ptr_Queue"; }
+    static const bool  mpmc = true, spin = false;
+    MPMC_Ptr_Queue q;
+    bool init()                          { return q.init(QSIZE); }
+    inline bool push(void *p, int)       { return q.push(p); }
+    inline bool pop(void **p, int)       { return q.pop(p); }
+};
+struct ms_q {
+    static const char *name() { return "MSqueue"; }
+    static const bool  mpmc = true, spin = false;
+    MSqueue q;
+    bool init()                          { return q.init() > 0; }
+    inline bool push(void *p, int)       { return q.push(p); }
+    inline bool pop(void **p, int)       { return q.pop(p); }
+};
+struct multiswsr_q {
+    static const char *name() { return "multiSWSR"; }
+    static const bool  mpmc = true, spin = true;   // CLH locks
+    multiSWSR q;
+    bool init()                          { return q.init(); }
+    inline bool push(void *p, int tid)   { return q.push(p, tid); }
+    inline bool pop(void **p, int tid)   { return q.pop(p, tid); }
+};
+
+// nt producers and nt consumers, n items in total
+template<typename Q>
+static int queue_throughput(long nt, long n) {
+    Q q;
+    if (!q.init()) { error("%s: init failed\n", Q::name()); return -1; }
+    std::atomic<long> consumed(0), sum(0);
+    std::vector<std::thread> th;
+    const ff_time_t t0 = ff_gettime();
+    for(long p=0;p<nt;++p)
+        th.push_back(std::thread([&,p]() {
+            unsigned b=0;
+            for(long i=p;i<n;i+=nt)
+                while(!q.push((void*)(i+1), (int)p)) backoff(b);
+        }));
+    for(long c=0;c<nt;++c)
+        th.push_back(std::thread([&,c]() {
+            unsigned b=0; long s=0; void *d;
+            while(consumed.load(std::memory_order_relaxed) < n) {
+                if (q.pop(&d, (int)(nt+c))) {
+                    s += (long)d;
+                    consumed.fetch_add(1, std::memory_order_relaxed);
+                } else backoff(b);
+            }
+            sum.fetch_add(s);
+        }));
+    for(auto &t: th) t.join();
+    const double s = secs(t0);
+    if (sum.load() != n*(n+1)/2) {
+        error("%s: wrong result\n", Q::name());
+        return -1;
+    }
+    record("queue", Q::name(), 2*nt, n, "throughput", n/s/1e6, "Mops/s");
+    return 0;
+}
+
+// ping-pong between two threads on two queues
+template<typename Q>
+static int queue_latency(long n) {
+    Q q1, q2;
+    if (!q1.init() || !q2.init()) { error("%s: init failed\n", Q::name()); return -1; }
+    std::thread echo([&]() {
+        unsigned b=0; void *d;
+        for(long i=0;i<n;++i) {
+            while(!q1.pop(&d, 1)) backoff(b);
+            while(!q2.push(d, 1)) backoff(b);
+        }
+    });
+    unsigned b=0; void *d;
+    const ff_time_t t0 = ff_gettime();
+    for(long i=0;i<n;++i) {
+        while(!q1.push((void*)(i+1), 0)) backoff(b);
+        while(!q2.pop(&d, 0)) backoff(b);
+    }
+    const double s = secs(t0);
+    echo.join();
+    record("queue", Q::name(), 2, n, "latency", s*1e9/(2.0*n), "ns");
+    return 0;
+}
+
+template<typename Q>
+static int queue_bench(long maxthreads) {
+    int r = queue_latency<Q>(100000*scale);
+    r |= queue_throughput<Q>(1, 2000000*scale);
+    if (Q::mpmc)
+        for(long nt=2; 2*nt<=maxthreads; nt*=2)
+            if (!(Q::spin && skip("queue", Q::name(), 2*nt)))
+                r |= queue_throughput<Q>(nt, 2000000*scale);
+    return r;
+}
+
+/* --------------------------------- farm ---------------------------------- */
+
+struct farm_emitter: ff_node {
+    farm_emitter(long n):n(n) {}
+    void *svc(void *) {
+        for(long i=0;i<n;++i) ff_send_out((void*)(i+1));
+        return EOS;
+    }
+    const long n;
+};
+struct farm_worker: ff_node {
+    void *svc(void *) { return GO_ON; }
+};
+
+static int farm_bench(long maxthreads) {
+    const long n = 1000000*scale;
+    for(int ondemand=0; ondemand<2; ++ondemand)
+        for(long nw=1; nw<=maxthreads; nw*=2) {
+#if !defined(BLOCKING_MODE)
+            if (skip("farm", ondemand ? "ondemand" : "roundrobin", nw+1)) continue;
+#endif
+            ff_farm<> farm;
+            std::vector<ff_node*> w;
+            for(long i=0;i<nw;++i) w.push_back(new farm_worker);
+            farm.add_workers(w);
+            farm.add_emitter(new farm_emitter(n));
+            farm.cleanup_all();
+            if (ondemand) farm.set_scheduling_ondemand();
+            const ff_time_t t0 = ff_gettime();
+            if (farm.run_and_wait_end()<0) {
+                error("farm: running farm\n");
+                return -1;
+            }
+            const double s = secs(t0);
+            record("farm", ondemand ? "ondemand" : "roundrobin", nw, n,
+                   "dispatch", s*1e9/n, "ns/task");
+        }
+    return 0;
+}
+
+/* --------------------------------- pfor ---------------------------------- */
+
+static int pfor_bench(long maxthreads) {
+    const long n = 100000, reps = 200*scale;
+    const long grains[] = { 0, 1, 16, 256, 4096 };
+    for(long nw=1; nw<=maxthreads; nw*=2) {
+        ParallelFor pf(nw);
+        pf.parallel_for(0, n, 1, 0, [](const long) {}, nw); // warm-up
+        for(size_t g=0; g<sizeof(grains)/sizeof(grains[0]); ++g) {
+            const ff_time_t t0 = ff_gettime();
+            for(long r=0;r<reps;++r)
+                pf.parallel_for(0, n, 1, grains[g], [](const long) {}, nw);
+            const double s = secs(t0);
+            record("pfor", "ParallelFor", nw, grains[g], "loop", s*1e6/reps, "us");
+            record("pfor", "ParallelFor", nw, grains[g], "iteration", s*1e9/(reps*n), "ns");
+        }
+    }
+    return 0;
+}
+
+/* -------------------------------- barrier -------------------------------- */
+
+template<typename B>
+static void barrier_run(const char *name, long nt, long n) {
+    B bar(nt);
+    bar.barrierSetup(nt);
+    std::vector<std::thread> th;
+    const ff_time_t t0 = ff_gettime();
+    for(long t=0;t<nt;++t)
+        th.push_back(std::thread([&,t]() {
+            for(long i=0;i<n;++i) bar.doBarrier(t);
+        }));
+    for(auto &x: th) x.join();
+    record("barrier", name, nt, n, "latency", secs(t0)*1e9/n, "ns");
+}
+
+static int barrier_bench(long maxthreads) {
+    for(long nt=1; nt<=maxthreads; nt*=2) {
+        barrier_run<Barrier>("Barrier", nt, 20000*scale);
+        if (!skip("barrier", "spinBarrier", nt))
+            barrier_run<spinBarrier>("spinBarrier", nt, 20000*scale);
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *which = (argc>1) ? argv[1] : "all";
+    long maxthreads   = (argc>2) ? atol(argv[2]) : (long)ff_numCores();
+    if (argc>3) scale = atol(argv[3]);
+    ncores = (long)ff_numCores();
+    if (maxthreads<1 || scale<1) {
+        printf("use: %s [all|queue|farm|pfor|barrier] [maxthreads] [scale]\n", argv[0]);
+        return -1;
+    }
+    const bool all = !strcmp(which, "all");
+#if defined(BLOCKING_MODE)
+    const int blocking = 1;
+#else
+    const int blocking = 0;
+#endif
+    printf("# cores=%ld maxthreads=%ld scale=%ld blocking=%d\n", ncores, maxthreads, scale, blocking);
+    printf("bench,impl,threads,param,metric,value,unit\n");
+    int r = 0;
+    if (all || !strcmp(which, "queue")) {
+        r |= queue_bench<swsr_q>(maxthreads);
+        r |= queue_bench<uswsr_q>(maxthreads);
+        r |= queue_bench<mpmc_q>(maxthreads);
+        r |= queue_bench<ms_q>(maxthreads);
+        r |= queue_bench<multiswsr_q>(maxthreads);
+    }
+    if (all || !strcmp(which, "farm"))    r |= farm_bench(maxthreads);
+    if (all || !strcmp(which, "pfor"))    r |= pfor_bench(maxthreads);
+    if (all || !strcmp(which, "barrier")) r |= barrier_bench(maxthreads);
+    return r ? 1 : 0;
+}
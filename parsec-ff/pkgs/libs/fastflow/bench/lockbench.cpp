@@ -0,0 +1,149 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/*
+ *  Lock microbenchmark: pthread mutex, pthread spin-lock, FastFlow
+ *  test-and-set spin-lock and MCS queue lock.
+ *
+ *  Each thread performs <iters> critical sections on a lock chosen at
+ *  random among <nlocks> locks (nlocks=1: maximum contention, as for a
+ *  hot hash bucket); a critical section updates the counter protected by
+ *  the lock and executes <cs> iterations of dummy work, between two
+ *  critical sections a thread executes <out> iterations of dummy work.
+ *  The throughput (millions of critical sections per second) is printed
+ *  for 1, 2, 4, ... up to <maxthreads> threads, then the counters are
+ *  checked.
+ *
+ *  compile: make (or g++ -std=c++11 -O3 -I.. lockbench.cpp -o lockbench -pthread)
+ *  usage:   ./lockbench [maxthreads=2*ncores] [nlocks=1] [iters=200000] [cs=20] [out=100]
+ */
+
+/* ***************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License version 3 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ *  License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ ****************************************************************************
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <vector>
+#include <thread>
+#include <ff/utils.hpp>
+#include <ff/mapping_utils.hpp>
+#include <ff/spin-lock.hpp>
+
+using namespace ff;
+
+struct mutex_lock {
+    pthread_mutex_t m;
+    mutex_lock()       { pthread_mutex_init(&m, NULL); }
+    void lock()        { pthread_mutex_lock(&m); }
+    void unlock()      { pthread_mutex_unlock(&m); }
+    static const char *name() { return "pthread_mutex"; }
+};
+struct pspin_lock {
+    pthread_spinlock_t s;
+    pspin_lock()       { pthread_spin_init(&s, PTHREAD_PROCESS_PRIVATE); }
+    void lock()        { pthread_spin_lock(&s); }
+    void unlock()      { pthread_spin_unlock(&s); }
+    static const char *name() { return "pthread_spin"; }
+};
+struct tas_lock {
+    lock_t l;
+    tas_lock()         { init_unlocked(l); }
+    void lock()        { spin_lock(l); }
+    void unlock()      { spin_unlock(l); }
+    static const char *name() { return "ff_spinlock"; }
+};
+struct mcs_lock {
+    mcs_lock_t l;
+    mcs_lock()         { init_unlocked(l); }
+    void lock()        { spin_lock(l); }
+    void unlock()      { spin_unlock(l); }
+    static const char *name() { return "ff_mcs"; }
+};
+
+static long nlocks = 1, iters = 200000, cswork = 20, outwork = 100;
+
+static inline void work(long n) {
+    for(volatile long i=0;i<n;++i) ;
+}
+
+template<typename L>
+static double run(L *locks, long *counters, int nthreads) {
+    std::vector<std::thread> th;
+    const ff_time_t t0 = ff_gettime();
+    for(int t=0;t<nthreads;++t)
+        th.push_back(std::thread([=]() {
+            unsigned long seed = 0x9e3779b97f4a7c15UL * (t+1);
+            for(long i=0;i<iters;++i) {
+                seed = seed*6364136223846793005UL + 1442695040888963407UL;
+                const long k = (long)((seed>>33) % (unsigned long)nlocks);
+                locks[k].lock();
+                ++counters[k*8];
+                work(cswork);
+                locks[k].unlock();
+                work(outwork);
+            }
+        }));
+    for(auto &x: th) x.join();
+    const double s = (ff_gettime()-t0)/1e9;
+    return (nthreads*(double)iters)/s/1e6;
+}
+
+template<typename L>
+static int bench(int maxthreads) {
+    std::vector<L> locks(nlocks);
+    std::vector<long> counters(nlocks*8);   // one cache line each
+    long expected = 0;
+    printf("%-14s", L::name());
+    for(int nt=1; nt<=maxthreads; nt*=2) {
+        printf(" %9.3f", run(locks.data(), counters.data(), nt));
+        fflush(stdout);
+        expected += nt*iters;
+    }
+    printf("\n");
+    long total = 0;
+    for(long k=0;k<nlocks;++k) total += counters[k*8];
+    if (total != expected) {
+        error("%s: wrong result %ld (expected %ld)\n", L::name(), total, expected);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    int maxthreads = 2*(int)ff_numCores();
+    if (argc>1) maxthreads = atoi(argv[1]);
+    if (argc>2) nlocks     = atol(argv[2]);
+    if (argc>3) iters      = atol(argv[3]);
+    if (argc>4) cswork     = atol(argv[4]);
+    if (argc>5) outwork    = atol(argv[5]);
+    if (maxthreads<1 || nlocks<1 || iters<1) {
+        printf("use: %s [maxthreads] [nlocks] [iters] [cs] [out]\n", argv[0]);
+        return -1;
+    }
+    printf("cores=%ld locks=%ld iters/thread=%ld cs=%ld out=%ld, Mlocks/s\n",
+           (long)ff_numCores(), nlocks, iters, cswork, outwork);
+    printf("%-14s", "threads");
+    for(int nt=1; nt<=maxthreads; nt*=2) printf(" %9d", nt);
+    printf("\n");
+    int r = 0;
+    r |= bench<mutex_lock>(maxthreads);
+    r |= bench<pspin_lock>(maxthreads);
+    r |= bench<tas_lock>(maxthreads);
+    r |= bench<mcs_lock>(maxthreads);
+    return r ? 1 : 0;
+}
@@ -88,6 +88,9 @@
  *  - June  2012  - performance improvement in getfrom_fb
  *                - statistics cleanup
  *  - Sept  2015 Marco Aldinucci: porting to c++11
+ *  - remote frees: per-thread magazines and lock-free remote-free list,
+ *                  per-allocator statistics
+ *  - magazines of idle or terminated threads taken back by the allocator
  *
  */
 
@@ -107,10 +110,7 @@
 // #include <ff/atomic/atomic.h>
 // #endif
 #include <atomic>
-
-#if defined(ALLOCATOR_STATS)
 #include <iostream>
-#endif
 
 
 //#include <pthread.h>
@@ -149,6 +149,53 @@ namespace ff {
     static const int nslabs_default[N_SLABBUFFER] =
         { 512,512,512,512,128,  64,  32,  16,   8 };
 
+    // number of buffers a thread other than the allocator collects (for each
+    // SlabCache) before giving them back to the allocator all at once
+#if !defined(FF_ALLOC_MAGAZINE)
+#define FF_ALLOC_MAGAZINE 64
+#endif
+
+    /*!
+     * \struct ff_allocator_stats
+     *
+     * \brief Statistics of an allocator (see ff_allocator::getstats)
+     *
+     * They are always collected, the counters are updated by the allocator
+     * thread, except \p remote_frees and \p flushes which are updated once per
+     * magazine by the freeing threads.
+     */
+    struct ff_allocator_stats {
+        size_t nmalloc;       /// allocations served by the slab caches
+        size_t hits;          /// ... using a buffer previously freed
+        size_t misses;        /// ... that required a new segment
+        size_t local_frees;   /// frees performed by the allocator thread
+        size_t remote_frees;  /// frees performed by the other threads
+        size_t flushes;       /// magazines given back by the other threads
+        size_t segments;      /// segments allocated (segment growth)
+        size_t memory;        /// memory currently allocated for the segments
+
+        ff_allocator_stats():nmalloc(0),hits(0),misses(0),local_frees(0),
+                             remote_frees(0),flushes(0),segments(0),memory(0) {}
+
+        ff_allocator_stats &operator+=(const ff_allocator_stats &s) {
+            nmalloc += s.nmalloc; hits += s.hits; misses += s.misses;
+            local_frees += s.local_frees; remote_frees += s.remote_frees;
+            flushes += s.flushes; segments += s.segments; memory += s.memory;
+            return *this;
+        }
+
+        void print(std::ostream & out = std::cout) const {
+            out << "\n--- ff_allocator stats ---\n"
+                << "malloc        = " << nmalloc << "\n"
+                << "  hit         = " << hits << "\n"
+                << "  miss        = " << misses << "\n"
+                << "local free    = " << local_frees << "\n"
+                << "remote free   = " << remote_frees << " (magazines= " << flushes << ")\n"
+                << "segments      = " << segments << "\n"
+                << "mem. allocated= " << memory << "\n\n";
+        }
+    };
+
 #if defined(ALLOCATOR_STATS)
     
     struct all_stats {
@@ -234,7 +281,7 @@ namespace ff {
 
     class SegmentAllocator {
     public:
-        SegmentAllocator():memory_allocated(0) { }
+        SegmentAllocator():memory_allocated(0),numa(-1) { }
         ~SegmentAllocator() {}
     
         /*
@@ -259,6 +306,7 @@ namespace ff {
             ptr = getAlignedMemory(4096,segment_size); // To be fixed for MSC
 #endif
             if (!ptr) return NULL;
+            if (numa>=0) ff_numa_move(ptr, segment_size, numa);
 
             memory_allocated += segment_size; // updt quantity of allocated memory
 
@@ -295,9 +343,16 @@ namespace ff {
          * \return Returns the amount of allocated memory
          */
         size_t getallocated() const { return memory_allocated; }
+
+        /*
+         * Sets the NUMA node where the segments allocated from now on are
+         * placed (-1 means no placement).
+         */
+        void set_numa_node(int node) { numa = node; }
     
     private:
         size_t       memory_allocated;
+        int          numa;
     };
 
     // forward declarations
@@ -357,8 +412,11 @@ namespace ff {
     struct xThreadData {
         enum { LEAK_CHUNK=4096 };
     
-        xThreadData(const bool allocator, size_t nslabs, const pthread_t key)
-            : leak(0), key(key) {
+        xThreadData(const bool allocator, size_t nslabs, const pthread_t key, SlabCache * c)
+            : leak(0), key(key), mag_tail(0), mag_cnt(0) {
+            mag_head.store(NULL);
+            cache.store(c);
+            refs.store(1);
             //leak = (uSWSR_Ptr_Buffer*)::malloc(sizeof(uSWSR_Ptr_Buffer));
             leak = (uSWSR_Ptr_Buffer*)getAlignedMemory(128,sizeof(uSWSR_Ptr_Buffer));
             if (!leak) abort();
@@ -372,7 +430,22 @@ namespace ff {
     
         uSWSR_Ptr_Buffer * leak;   //
         const pthread_t    key;    // used to identify a thread (threadID)
-        long padding[longxCacheLine-((sizeof(const pthread_t)+sizeof(uSWSR_Ptr_Buffer*))/sizeof(long))]; //
+
+        // magazine: buffers freed by the thread not yet given back. The
+        // thread pushes them with a CAS on mag_head, so that the allocator
+        // can take the whole magazine at any time; mag_tail and mag_cnt are
+        // used by the thread only and are reset when it finds mag_head empty
+        std::atomic<Buf_ctl*> mag_head;
+        Buf_ctl             * mag_tail;
+        size_t                mag_cnt;
+        std::atomic<SlabCache*> cache;  // NULL when the SlabCache has been destroyed
+        std::atomic_long      refs;     // the SlabCache and the thread (see exit_hook)
+        long padding[longxCacheLine-((sizeof(const pthread_t)+sizeof(uSWSR_Ptr_Buffer*)+
+                                      3*sizeof(Buf_ctl*)+sizeof(size_t)+sizeof(long))/sizeof(long))]; //
+
+        static inline void unref(xThreadData * x) {
+            if (x->refs.fetch_sub(1) == 1) { x->~xThreadData(); ::free(x); }
+        }
     };
 
     /* 
@@ -434,11 +507,122 @@ namespace ff {
         enum {TICKS_TO_WAIT=500,TICKS_CNT=3};
         enum {BUFFER_OVERHEAD=sizeof(Buf_ctl)};
         enum {MIN_FB_CAPACITY=32};
+        enum {TLS_ENTRIES=16};
     
         inline Seg_ctl * getsegctl(Buf_ctl * buf) {
             return *((Seg_ctl **)buf);
         }
 
+        /*
+         * Free buffers are linked through the first word of their data area
+         * (the Buf_ctl, i.e. the back-pointer to the segment, is left intact).
+         */
+        static inline Buf_ctl *& nextbuf(Buf_ctl * buf) {
+            return *(Buf_ctl **)((char *)buf + BUFFER_OVERHEAD);
+        }
+
+        // unique id of each SlabCache, used to tag the thread-local cache
+        static inline unsigned long newid() {
+            static std::atomic<unsigned long> ids(0);
+            return ++ids;
+        }
+
+        /*
+         * Returns the xThreadData of the calling thread, registering it if
+         * needed. The last ones used are kept in a small thread-local table so
+         * that the list of registered threads is scanned only the first time.
+         */
+        inline xThreadData * getxtd() {
+            struct tls_entry { unsigned long id; xThreadData * xtd; };
+            static thread_local tls_entry tls[TLS_ENTRIES];
+            tls_entry & t = tls[cid % TLS_ENTRIES];
+            if (t.id == cid) return t.xtd;
+            int entry = searchfb(pthread_self());
+            xThreadData * xtd = (entry<0) ? register4free() : fb[entry];
+            if (xtd) { t.id = cid; t.xtd = xtd; }
+            return xtd;
+        }
+
+        /*
+         * Gives the magazine of the calling thread back to the allocator, by
+         * pushing it on the remote-free list with a single CAS.
+         */
+        inline void flush(xThreadData * xtd) {
+            if (!xtd->mag_cnt) return;
+            Buf_ctl * const head = xtd->mag_head.exchange(NULL, std::memory_order_acquire);
+            Buf_ctl * const tail = xtd->mag_tail;
+            const size_t    n    = xtd->mag_cnt;
+            xtd->mag_tail = NULL;
+            xtd->mag_cnt  = 0;
+            if (!head) return;  // already taken by the allocator
+            Buf_ctl * old = remote.load(std::memory_order_relaxed);
+            do {
+                nextbuf(tail) = old;
+            } while(!remote.compare_exchange_weak(old, head,
+                                                  std::memory_order_release,
+                                                  std::memory_order_relaxed));
+            remote_frees.fetch_add(n, std::memory_order_relaxed);
+            flushes.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        /*
+         * Takes the magazines of all the threads (also of the ones that are 
+         * idle or have terminated), so that the buffers they hold can be 
+         * reused or reclaimed. Returns the list of the buffers taken.
+         */
+        inline Buf_ctl * takemagazines() {
+            Buf_ctl * l = NULL;
+            size_t    n = 0;
+            spin_lock(lock);    // fb may be reallocated by register4free
+            for(unsigned i=0;i<fb_size;++i) {
+                Buf_ctl * const head = fb[i]->mag_head.exchange(NULL, std::memory_order_acquire);
+                if (!head) continue;
+                Buf_ctl * tail = head;
+                for(++n; nextbuf(tail); ++n) tail = nextbuf(tail);
+                nextbuf(tail) = l;
+                l = head;
+            }
+            spin_unlock(lock);
+            if (n) {
+                remote_frees.fetch_add(n, std::memory_order_relaxed);
+                flushes.fetch_add(1, std::memory_order_relaxed);
+            }
+            return l;
+        }
+
+        /*
+         * The magazines of a thread are given back when it terminates (the 
+         * SlabCaches it has freed buffers to are recorded at registration).
+         */
+        struct exit_hook {
+            svector<xThreadData *> l;
+            ~exit_hook() {
+                for(size_t i=0;i<l.size();++i) {
+                    SlabCache * c = l[i]->cache.load();
+                    if (c) c->flush(l[i]);
+                    xThreadData::unref(l[i]);
+                }
+            }
+        };
+        static inline exit_hook & exithook() {
+            static thread_local exit_hook h;
+            return h;
+        }
+
+        /*
+         * Reclaims all the buffers in the list \p l (used after the allocator
+         * has been deregistered)
+         */
+        inline bool reclaimlist(Buf_ctl * l) {
+            bool r=false;
+            while(l) {
+                Buf_ctl * n = nextbuf(l);
+                r |= checkReclaim(getsegctl(l));
+                l = n;
+            }
+            return r;
+        }
+
         /*
          * This method creates a new slab, that is, it allocates a new segment of
          * large and possibly aligned memory.
@@ -463,6 +647,7 @@ namespace ff {
              * and all its embedded data are reset.
              */
             if (ptr) {
+                ++segments;
                 Seg_ctl * seg      = (Seg_ctl *)ptr; // Segment controller
                 DBG(seg->refcount  = 0);             // number of buffers in use
                 seg->cacheentry    = this;           // owner of the segment
@@ -601,8 +786,13 @@ namespace ff {
         SlabCache( ff_allocator * const mainalloc, const int delayedReclaim,
                    SegmentAllocator * const alloc, size_t sz, int ns )
             : size(sz), nslabs(ns), fb(0), fb_capacity(0), fb_size(0),
-              buffptr(0), availbuffers(0), alloc(alloc),
-              mainalloc(mainalloc), delayedReclaim(delayedReclaim),lastqueue(0) { }
+              buffptr(0), availbuffers(0), local(0), owner(), hasowner(false),
+              cid(newid()), nmalloc(0), hits(0), misses(0), local_frees(0), segments(0),
+              alloc(alloc), mainalloc(mainalloc), delayedReclaim(delayedReclaim),lastqueue(0) {
+            remote.store(NULL);
+            remote_frees.store(0);
+            flushes.store(0);
+        }
     
         /**
          * Destructor
@@ -618,8 +808,8 @@ namespace ff {
             if (fb) {
                 for(unsigned i=0;i<fb_size;++i)
                     if (fb[i]) {
-                        fb[i]->~xThreadData();
-                        ::free(fb[i]);
+                        fb[i]->cache.store(NULL);
+                        xThreadData::unref(fb[i]);
                     }
                 ::free(fb);
             }
@@ -672,12 +862,17 @@ namespace ff {
             DBG(assert(nslabs>0));
         
             pthread_t key= pthread_self();  // obtain ID of the calling thread
+            if (allocator) { owner = key; hasowner = true; }
             int entry = searchfb(key);      // search for threadID in leak queue
             if (entry<0) {                  // if threadID not found
                 // allocate a new buffer for thread 'key'
                 xThreadData * xtd = (xThreadData*)::malloc(sizeof(xThreadData));
                 if (!xtd) return NULL;
-                new (xtd) xThreadData(allocator, nslabs, key);
+                new (xtd) xThreadData(allocator, nslabs, key, this);
+                if (!delayedReclaim) {
+                    ++xtd->refs;
+                    exithook().l.push_back(xtd);
+                }
 
                 /*
                  * REW
@@ -726,6 +921,13 @@ namespace ff {
                     }
                 }
             }
+            if (reclaim) {
+                Buf_ctl * l = local;
+                local = NULL;
+                reclaimlist(l);
+                reclaimlist(remote.exchange(NULL, std::memory_order_acquire));
+                reclaimlist(takemagazines());
+            }
         }
 
         /*
@@ -736,6 +938,21 @@ namespace ff {
         inline void * getitem() {
             DBG(assert(nslabs>0));
             void * item = 0;
+            ++nmalloc;
+
+            /* 
+             * try to reuse a buffer freed by the allocator thread or,
+             * if there are none, take all the ones freed by the other threads
+             */
+            if (!local && remote.load(std::memory_order_relaxed))
+                local = remote.exchange(NULL, std::memory_order_acquire);
+            if (local) {
+                Buf_ctl * buf = local;
+                local = nextbuf(buf);
+                ++hits;
+                ALLSTATS(all_stats::instance()->hit.fetch_add(1));
+                return ((char *)buf + BUFFER_OVERHEAD);
+            }
 
             /* try to get one item from the available ones */
             if (availbuffers) {
@@ -760,15 +977,26 @@ namespace ff {
                 return item;
             }
 
-            // else, try to get a free item from cache
-            item = delayedReclaim ? getfrom_fb_delayed() : getfrom_fb();
+            // else, try to get a free item from the leak queues (delayed reclaim)
+            item = delayedReclaim ? getfrom_fb_delayed() : NULL;
 
             if (item) {
+                ++hits;
                 ALLSTATS(all_stats::instance()->hit.fetch_add(1));
                 DBG(if ((getsegctl((Buf_ctl *)item))->allocator == NULL) abort());
                 return ((char *)item + BUFFER_OVERHEAD);
             }
 
+            /* before growing, take back the buffers held in the magazines */
+            if ((local = takemagazines())) {
+                Buf_ctl * buf = local;
+                local = nextbuf(buf);
+                ++hits;
+                ALLSTATS(all_stats::instance()->hit.fetch_add(1));
+                return ((char *)buf + BUFFER_OVERHEAD);
+            }
+
+            ++misses;
             ALLSTATS(all_stats::instance()->miss.fetch_add(1));
 
             /* if there are not available items try to allocate a new slab */
@@ -796,21 +1024,90 @@ namespace ff {
                 DBG(assert(delayedReclaim==0));
 
                 Seg_ctl  * seg = *(Seg_ctl **)buf;
-                return checkReclaim(seg);   // true if some memory can be reclaimed
+                bool r = checkReclaim(seg);   // true if some memory can be reclaimed
+
+                // buffers still in the magazines of the threads (this one
+                // included) or given back while the allocator was being 
+                // deregistered
+                r |= reclaimlist(takemagazines());
+                if (remote.load(std::memory_order_relaxed))
+                    r |= reclaimlist(remote.exchange(NULL, std::memory_order_acquire));
+                return r;
             }
 
             /*
              * If nomorealloc is 0,
              */
-            int entry = searchfb(pthread_self());   // look for calling thread
-            xThreadData * xtd = NULL;
-            if (entry<0) xtd = register4free();     // if not present, register it
-            else xtd = fb[entry];                   // else, point to its position
+            if (delayedReclaim) {
+                int entry = searchfb(pthread_self());   // look for calling thread
+                xThreadData * xtd = NULL;
+                if (entry<0) xtd = register4free();     // if not present, register it
+                else xtd = fb[entry];                   // else, point to its position
+                DBG(if (!xtd) abort());
+                xtd->leak->push((void *)buf);           // push the item in the buffer
+                return false;
+            }
+
+            // the allocator thread puts the buffer directly in its free list
+            if (hasowner && pthread_equal(owner, pthread_self())) {
+                nextbuf(buf) = local;
+                local = buf;
+                ++local_frees;
+                return false;
+            }
+
+            /*
+             * Other threads put the buffer in their magazine. The magazine is
+             * given back when it is full or as soon as the allocator has taken
+             * all the buffers previously given back (i.e. it may need them).
+             */
+            xThreadData * xtd = getxtd();
             DBG(if (!xtd) abort());
-            xtd->leak->push((void *)buf);           // push the item in the buffer
+            Buf_ctl * old = xtd->mag_head.load(std::memory_order_relaxed);
+            do {
+                nextbuf(buf) = old;
+            } while(!xtd->mag_head.compare_exchange_weak(old, buf,
+                                                         std::memory_order_release,
+                                                         std::memory_order_relaxed));
+            if (!old) { xtd->mag_tail = buf; xtd->mag_cnt = 0; } // empty (or taken)
+            if ((++xtd->mag_cnt >= FF_ALLOC_MAGAZINE) || 
+                (remote.load(std::memory_order_relaxed) == NULL))
+                flush(xtd);
             return false;
         }
 
+        /*
+         * Gives back the magazine of the calling thread (if any)
+         */
+        inline void flush() {
+            if (!nslabs || delayedReclaim) return;
+            int entry = searchfb(pthread_self());
+            if (entry>=0) flush(fb[entry]);
+        }
+
+        /*
+         * Adds the statistics of this SlabCache to \p s
+         */
+        inline void getstats(ff_allocator_stats & s) const {
+            s.nmalloc      += nmalloc;
+            s.hits         += hits;
+            s.misses       += misses;
+            s.local_frees  += local_frees;
+            s.remote_frees += remote_frees.load(std::memory_order_relaxed);
+            s.flushes      += flushes.load(std::memory_order_relaxed);
+            s.segments     += segments;
+        }
+
+        /*
+         * Moves the segments allocated so far on the NUMA node \p node.
+         * It must be called by the allocator thread.
+         */
+        inline void numa_place(int node) {
+            const size_t segsize = size*nslabs + sizeof(Seg_ctl) + nslabs * BUFFER_OVERHEAD;
+            for(size_t i=0;i<seglist.size();++i) 
+                ff_numa_move(seglist[i], segsize, node);
+        }
+
         /// Get the size of the SlabCache
         inline size_t getsize() const { return size; }
         /// Get the number of slabs in the cache
@@ -831,6 +1128,22 @@ namespace ff {
         Buf_ctl *             buffptr;
         size_t                availbuffers;
 
+        // free lists: 'local' is private to the allocator thread, 'remote'
+        // is where the other threads push their magazines (lock-free stack,
+        // the allocator takes the whole list at once so there is no ABA)
+        Buf_ctl *             local;
+        ALIGN_TO_PRE(CACHE_LINE_SIZE)
+        std::atomic<Buf_ctl*> remote;
+        ALIGN_TO_POST(CACHE_LINE_SIZE)
+        pthread_t             owner;           /* the allocator thread */
+        bool                  hasowner;
+        const unsigned long   cid;
+
+        // statistics
+        size_t                nmalloc, hits, misses, local_frees, segments;
+        std::atomic<size_t>   remote_frees;
+        std::atomic<size_t>   flushes;
+
     private:
         std::atomic_long            nomoremalloc;
 
@@ -1054,9 +1367,29 @@ namespace ff {
                 if ((*b)->getnslabs())
                     if ((*b)->register4free(true)==0) return -1;
             }
+#if defined(FF_NUMA_LOCAL)
+            const int node = ff_numa_my_node();
+            if (node>=0) set_numa_node(node);
+#endif
             return 0;
         }
 
+        /**
+         * \brief places the memory segments on a NUMA node
+         *
+         * The segments allocated so far are moved on the NUMA node \p node, 
+         * the ones allocated later are placed there as soon as they are
+         * allocated. It must be called by the thread that registered the
+         * allocator (it is called by \p registerAllocator if \p FF_NUMA_LOCAL
+         * is defined, with the node of the calling thread).
+         */
+        inline void set_numa_node(int node) {
+            alloc->set_numa_node(node);
+            svector<SlabCache *>::iterator b(slabcache.begin()), e(slabcache.end());
+            for(;b!=e;++b) 
+                if ((*b)->getnslabs()) (*b)->numa_place(node);
+        }
+
         /**
          * \brief de-register the ff_allocator (release ownership)
          *
@@ -1312,6 +1645,39 @@ namespace ff {
             return this->malloc(newsize);
         }
 
+        /**
+         * \brief gives back the buffers freed by the calling thread
+         *
+         * The buffers freed by a thread different from the allocator are
+         * given back in groups of at most \p FF_ALLOC_MAGAZINE buffers. A
+         * thread which is not going to free any more memory allocated by this
+         * allocator should call this method.
+         */
+        inline void flush() {
+            svector<SlabCache *>::iterator b(slabcache.begin()), e(slabcache.end());
+            for(;b!=e;++b) {
+                if ((*b) && (*b)->getnslabs())
+                    (*b)->flush();
+            }
+        }
+
+        /**
+         * \brief returns the statistics of the allocator
+         *
+         * The counters are read without any synchronisation, so they may be
+         * slightly out of date if the allocator is being used.
+         */
+        inline ff_allocator_stats getstats() {
+            ff_allocator_stats s;
+            svector<SlabCache *>::iterator b(slabcache.begin()), e(slabcache.end());
+            for(;b!=e;++b) {
+                if ((*b) && (*b)->getnslabs())
+                    (*b)->getstats(s);
+            }
+            s.memory = allocatedsize();
+            return s;
+        }
+
         ALLSTATS( void printstats(std::ostream & out) {
                 all_stats::instance()->print(out); }
             )
@@ -1753,6 +2119,27 @@ namespace ff {
             return this->malloc(newsize);
         }
 
+        /**
+         * \brief gives back the buffers freed by the calling thread to all
+         * the allocators (see ff_allocator::flush)
+         */
+        inline void flush() {
+            spin_lock(lock);
+            for(size_t i=0;i<A_size;++i) A[i]->f->flush();
+            spin_unlock(lock);
+        }
+
+        /**
+         * \brief returns the sum of the statistics of all the allocators
+         */
+        inline ff_allocator_stats getstats() {
+            ff_allocator_stats s;
+            spin_lock(lock);
+            for(size_t i=0;i<A_size;++i) s += A[i]->f->getstats();
+            spin_unlock(lock);
+            return s;
+        }
+
         ALLSTATS(void printstats(std::ostream & out) {
                 all_stats::instance()->print(out);
             })
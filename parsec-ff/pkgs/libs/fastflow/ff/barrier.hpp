@@ -30,9 +30,12 @@
  */
 
 #include <stdlib.h>
+#include <new>
+#include <atomic>
 #include <ff/platforms/platform.h>
 #include <ff/utils.hpp>
 #include <ff/config.hpp>
+#include <ff/sysdep.h>
 
 // 
 // Inside FastFlow barriers are used only for:
@@ -174,17 +177,140 @@ private:
 
 #endif 
 
+// fan-in of the nodes of the treeBarrier
+#if !defined(FF_BARRIER_ARITY)
+#define FF_BARRIER_ARITY 4
+#endif
+// the spinBarrier uses the treeBarrier starting from this n. of threads
+#if !defined(FF_TREEBARRIER_THRESHOLD)
+#define FF_TREEBARRIER_THRESHOLD 16
+#endif
+// n. of spins between two ff_relax(0) calls while waiting in the treeBarrier
+#if !defined(FF_BARRIER_SPINS)
+#define FF_BARRIER_SPINS 4096
+#endif
+
+/**
+ *  \class treeBarrier
+ *  \ingroup building_blocks
+ *
+ *  \brief Non-blocking combining-tree barrier
+ *
+ *  Threads arrive on the leaves of a tree of counters having fan-in 
+ *  FF_BARRIER_ARITY (thread tid on leaf tid/FF_BARRIER_ARITY). The last 
+ *  thread arriving on a node resets it and goes up, the last one arriving 
+ *  on the root flips the global sense, which releases everybody. 
+ *  Each counter is on its own cache line and it is updated by at most 
+ *  FF_BARRIER_ARITY threads, thus the barrier scales with the n. of threads,
+ *  whereas the single counter of the spinBarrier becomes a bottleneck.
+ *  Threads with close ids share the lower levels of the tree: with the
+ *  default mapping they run on close cores, so that most of the updates
+ *  stay inside a core or a socket.
+ *
+ *  This class is defined in \ref barrier.hpp
+ */
+class treeBarrier: public ffBarrier {
+    struct node_t {
+        std::atomic<long> count;
+        long              n;        // n. of children
+        node_t           *parent;
+        char              padding[CACHE_LINE_SIZE-2*sizeof(long)-sizeof(void*)];
+    };
+    struct sense_t {
+        bool sense;
+        char padding[CACHE_LINE_SIZE-sizeof(bool)];
+    };
+public:
+    treeBarrier(const size_t _maxNThreads=MAX_NUM_THREADS):
+        maxNThreads(_maxNThreads),_barrier(0),nnodes(0),nodes(NULL),senses(NULL) {
+        gsense.store(false);
+        senses = (sense_t*)getAlignedMemory(CACHE_LINE_SIZE, maxNThreads*sizeof(sense_t));
+        if (!senses) {
+            error("FATAL ERROR: treeBarrier: unable to allocate memory\n");
+            abort();
+        }
+        // the tree with the max n. of threads has the max n. of nodes
+        size_t l = maxNThreads, n = 0;
+        do { l = (l+FF_BARRIER_ARITY-1)/FF_BARRIER_ARITY; n += l; } while(l>1);
+        nodes = (node_t*)getAlignedMemory(CACHE_LINE_SIZE, n*sizeof(node_t));
+        if (!nodes) {
+            error("FATAL ERROR: treeBarrier: unable to allocate memory\n");
+            abort();
+        }
+        for(size_t i=0;i<n;++i) new (&nodes[i]) node_t();
+    }
+    ~treeBarrier() {
+        if (nodes)  freeAlignedMemory(nodes);
+        if (senses) freeAlignedMemory(senses);
+    }
+
+    /**
+     *  Builds the tree for init threads. It must not be called while any 
+     *  thread is in the barrier.
+     */
+    inline int barrierSetup(size_t init) {
+        assert(init>0 && init<=maxNThreads);
+        if (init == _barrier) return -1;
+        size_t first = 0, nchildren = init;
+        nnodes = 0;
+        do {
+            const size_t l = (nchildren+FF_BARRIER_ARITY-1)/FF_BARRIER_ARITY;
+            for(size_t i=0;i<l;++i) {
+                node_t &nd = nodes[first+i];
+                nd.count.store(0);
+                nd.n = (long)((i<l-1) ? FF_BARRIER_ARITY : nchildren-i*FF_BARRIER_ARITY);
+                nd.parent = (l>1) ? &nodes[first+l+i/FF_BARRIER_ARITY] : NULL;
+            }
+            first += l, nnodes += l, nchildren = l;
+        } while(nchildren>1);
+        for(size_t i=0;i<init;++i) senses[i].sense = false;
+        gsense.store(false);
+        _barrier = init;
+        return 0;
+    }
+
+    inline void doBarrier(size_t tid) {
+        assert(tid<_barrier);
+        const bool s = (senses[tid].sense ^= true);
+        node_t *nd = &nodes[tid/FF_BARRIER_ARITY];
+        while(nd->count.fetch_add(1)+1 == nd->n) {
+            nd->count.store(0, std::memory_order_relaxed);
+            nd = nd->parent;
+            if (nd == NULL) {   // last thread on the root
+                gsense.store(s, std::memory_order_release);
+                return;
+            }
+        }
+        // spin-wait
+        for(size_t i=1; gsense.load(std::memory_order_acquire) != s; ++i) {
+            PAUSE();
+            if ((i % FF_BARRIER_SPINS) == 0) ff_relax(0);
+        }
+    }
+
+private:
+    const size_t      maxNThreads;
+    size_t            _barrier;
+    size_t            nnodes;
+    node_t           *nodes;    // the leaves first, the root is the last one
+    sense_t          *senses;   // per-thread sense
+    char              padding1[CACHE_LINE_SIZE];
+    std::atomic<bool> gsense;   // global sense, written once per barrier
+    char              padding2[CACHE_LINE_SIZE];
+};
+
 /**
  *  \class spinBarrier
  *  \ingroup building_blocks
  *
  *  \brief Non-blocking barrier 
  *
+ *  With FF_TREEBARRIER_THRESHOLD or more threads the treeBarrier is used.
  */
 class spinBarrier: public ffBarrier {
 public:
    
-    spinBarrier(const size_t _maxNThreads=MAX_NUM_THREADS):maxNThreads(_maxNThreads), _barrier(0),threadCounter(0) {
+    spinBarrier(const size_t _maxNThreads=MAX_NUM_THREADS):maxNThreads(_maxNThreads), _barrier(0),threadCounter(0),tree(NULL) {
         barArray=new bool[maxNThreads];
         assert(barArray!=NULL);
     }
@@ -192,11 +318,18 @@ public:
     ~spinBarrier() {
         if (barArray != NULL) delete [] barArray;
         barArray=NULL;
+        if (tree) delete tree;
     }
     
     inline int barrierSetup(size_t init) {
         assert(init>0);
         if (init == _barrier) return -1;
+        if (init >= FF_TREEBARRIER_THRESHOLD) {
+            if (!tree) tree = new treeBarrier(maxNThreads);
+            tree->barrierSetup(init);
+            _barrier = init;
+            return 0;
+        }
         for(size_t i=0; i<init; ++i) barArray[i]=false;
         B[0]=0; B[1]=0;
         _barrier = init; 
@@ -205,6 +338,7 @@ public:
 
     inline void doBarrier(size_t tid) {
         assert(tid<maxNThreads);
+        if (_barrier >= FF_TREEBARRIER_THRESHOLD) return tree->doBarrier(tid);
         const int whichBar = (barArray[tid] ^= true); // computes % 2
         long c = ++B[whichBar];
         if ((size_t)c == _barrier) {
@@ -229,6 +363,7 @@ private:
     size_t threadCounter;
     bool* barArray;
     std::atomic<long> B[2];
+    treeBarrier *tree;    // used with many threads
 };
 
 
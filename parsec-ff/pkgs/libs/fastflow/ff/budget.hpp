@@ -0,0 +1,166 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/*!
+ *  \file budget.hpp
+ *  \ingroup aux_classes
+ *
+ *  \brief Process-wide budget of running worker threads
+ *
+ *  Each skeleton (farm, ParallelFor, ...) has its own threads, thus a
+ *  process using several skeletons easily has more threads than cores.
+ *  The budget counts the worker threads that are doing useful work in the
+ *  whole process:
+ *   - a ParallelFor/ParallelForReduce leases its workers at the beginning of
+ *     each loop and gives them back at the end; if the budget is (partly)
+ *     used by other skeletons the loop is executed by fewer workers, but it
+ *     always gets its fair share of the capacity (capacity/n. of skeletons
+ *     holding a lease). A loop started when no other skeleton is running
+ *     gets all the workers it asks for;
+ *   - a farm reserves its workers when it is started or thawed and gives them
+ *     back when it terminates or freezes. A farm is never shrunk, so it may
+ *     overcommit the budget.
+ *  A waiting thread using the spin policy parks (it sleeps for
+ *  \p FF_BUDGET_PARK_US microseconds at a time) when the budget is exhausted
+ *  and its skeleton is idle, or when it is a leased worker of a skeleton
+ *  that holds more than its fair share while another skeleton holds a lease
+ *  and the budget is overcommitted, so that the cores are left to the other
+ *  skeletons. A skeleton running alone never parks its workers.
+ *
+ *  The capacity is the number of cores, it can be changed by setting the
+ *  \p FF_THREAD_BUDGET environment variable or by calling \p setcapacity.
+ *  \p FF_THREAD_BUDGET=0 disables the budget (unlimited capacity).
+ */
+
+/* ***************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License version 3 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ *  License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ ****************************************************************************
+ */
+
+#ifndef FF_BUDGET_HPP
+#define FF_BUDGET_HPP
+
+#include <stdlib.h>
+#include <atomic>
+#include <algorithm>
+#include <ff/config.hpp>
+#include <ff/utils.hpp>
+#include <ff/mapping_utils.hpp>
+
+namespace ff {
+
+// sleeping time (us) of a parked thread
+#if !defined(FF_BUDGET_PARK_US)
+#define FF_BUDGET_PARK_US 100
+#endif
+
+/*!
+ * \class ff_budget
+ * \ingroup aux_classes
+ *
+ * \brief Number of worker threads running in the process (singleton).
+ *
+ * This class is defined in \ref budget.hpp
+ */
+class ff_budget {
+public:
+    static inline ff_budget &instance() {
+        static ff_budget budget;
+        return budget;
+    }
+
+    /**
+     * Leases at most \p n workers.
+     *
+     * \return the number of workers granted (0 if the budget is exhausted)
+     */
+    inline size_t acquire(size_t n) {
+        long u = used.load(std::memory_order_relaxed);
+        for(;;) {
+            const long c = cap.load(std::memory_order_relaxed);
+            // a skeleton running alone is never limited, otherwise it gets 
+            // at least its fair share
+            const long f = (c>0) ? c/(holders.load(std::memory_order_relaxed)+1) : 0;
+            const long g = (c<=0 || u<=0) ? (long)n : (std::min)((long)n, (std::max)(c-u, f));
+            if (g <= 0) return 0;
+            if (used.compare_exchange_weak(u, u+g)) { ++holders; return (size_t)g; }
+        }
+    }
+    /// reserves \p n workers even if they exceed the capacity
+    inline void reserve(size_t n) { used.fetch_add((long)n); ++holders; }
+    /// gives back a lease of \p n workers (acquired or reserved)
+    inline void release(size_t n) { used.fetch_sub((long)n); --holders; }
+    /// gives back \p n workers of a lease that is kept
+    inline void shrink(size_t n)  { used.fetch_sub((long)n); }
+
+    /// no more workers can be leased
+    inline bool exhausted() const {
+        const long c = cap.load(std::memory_order_relaxed);
+        return (c>0) && used.load(std::memory_order_relaxed) >= c;
+    }
+    /// more workers than the capacity are running
+    inline bool overcommitted() const {
+        const long c = cap.load(std::memory_order_relaxed);
+        return (c>0) && used.load(std::memory_order_relaxed) > c;
+    }
+    /// a skeleton holding \p lease workers is over its share of an overcommitted budget
+    inline bool overbudget(size_t lease) const {
+        const long h = holders.load(std::memory_order_relaxed);
+        return (h>1) && overcommitted() && (long)lease > cap.load(std::memory_order_relaxed)/h;
+    }
+
+    /// n. of workers leased or reserved
+    inline long   inuse()    const { return used.load(); }
+    /// n. of skeletons holding a lease
+    inline long   lessees()  const { return holders.load(); }
+    inline size_t capacity() const { return (size_t)cap.load(); }
+    /// 0 means unlimited
+    inline void   setcapacity(size_t c) { cap.store((long)c); }
+
+protected:
+    ff_budget() {
+        const char *e = getenv("FF_THREAD_BUDGET");
+        cap.store(e ? atol(e) : (long)ff_numCores());
+        used.store(0);
+        holders.store(0);
+    }
+
+private:
+    ff_budget(const ff_budget&);
+    ff_budget &operator=(const ff_budget&);
+
+private:
+    std::atomic_long cap;
+    std::atomic_long used;
+    std::atomic_long holders;  // skeletons holding a lease
+};
+
+/** 
+ * Called by a waiting thread: it parks if the cores are needed by the other
+ * skeletons. \p idle is true if the skeleton of the thread is idle, 
+ * \p lease is the lease of its skeleton if the thread is a leased worker.
+ */
+static inline bool ff_budget_park(const bool idle, const size_t lease=0) {
+    const ff_budget &b = ff_budget::instance();
+    if (idle ? b.exhausted() : (lease && b.overbudget(lease))) {
+        ff_relax(FF_BUDGET_PARK_US);
+        return true;
+    }
+    return false;
+}
+
+} // namespace ff
+
+#endif /* FF_BUDGET_HPP */
@@ -65,6 +65,8 @@
 #endif
 
 #include <ff/platforms/platform.h>
+#include <ff/waitpolicy.hpp>
+#include <ff/topology.hpp>
 
 namespace ff {
 
@@ -115,6 +117,8 @@ private:
 #endif
     const    unsigned long size;
     void                   ** buf;
+    ff_event               *  cons_ev;  // adaptive waiting (see waitpolicy.hpp)
+    ff_event               *  prod_ev;
     
 #if defined(SWSR_MULTIPUSH)
     /* massimot: experimental code (see multipush)
@@ -126,6 +130,16 @@ private:
     int     mcnt;
 #endif
 
+    // bytes of storage of the buffer (rounded to whole pages with FF_NUMA_LOCAL)
+    inline size_t storage() const {
+#if defined(FF_NUMA_LOCAL) && defined(_SC_PAGESIZE)
+        const size_t page = sysconf(_SC_PAGESIZE);
+        return ((size*sizeof(void*) + page-1)/page)*page;
+#else
+        return size*sizeof(void*);
+#endif
+    }
+
 public:
     /** 
      *  Constructor.
@@ -133,7 +147,7 @@ public:
      *  \param n the size of the buffer
      */
     SWSR_Ptr_Buffer(unsigned long n, const bool=true):
-        pread(0),pwrite(0),size(n),buf(0) {
+        pread(0),pwrite(0),size(n),buf(0),cons_ev(0),prod_ev(0) {
         // Avoid unused private field warning on padding1, padding2
         //(void)padding1;
         //(void)padding2;
@@ -161,7 +175,13 @@ public:
         if (size<MULTIPUSH_BUFFER_SIZE) return false;
 #endif
         // getAlignedMemory is a function defined in 'sysdep.h'
+#if defined(FF_NUMA_LOCAL) && defined(_SC_PAGESIZE)
+        // whole pages, so that the buffer can be moved on the NUMA node of 
+        // its consumer (see numa_place)
+        buf=(void**)getAlignedMemory(sysconf(_SC_PAGESIZE),storage());
+#else
         buf=(void**)getAlignedMemory(longxCacheLine*sizeof(long),size*sizeof(void*));
+#endif
         if (!buf) return false;
 
         reset(startatlineend);
@@ -265,6 +285,29 @@ public:
     }
 
 
+    /**
+     * Pushes up to \p len elements of the array \p data, in order. 
+     * Elements are written in chunks by using \p multipush, so that only
+     * the last slot of each chunk is checked and a single write barrier is
+     * issued per chunk. 
+     *
+     * \return the number of elements actually pushed (0 if the buffer is full)
+     */
+    inline unsigned long push_batch(void * const data[], unsigned long len) {
+        unsigned long n = 0, chunk = (len<size) ? len : (size-1);
+        while(n<len) {
+            if (chunk > len-n) chunk = len-n;
+            if (chunk<=1) {
+                if (!push(data[n])) break;
+                ++n;
+                continue;
+            }
+            if (multipush(data+n, (int)chunk)) n += chunk;
+            else chunk >>= 1;   // not enough room, try with a smaller chunk
+        }
+        return n;
+    }
+
 #if defined(SWSR_MULTIPUSH)
     
     // massimot: experimental code
@@ -320,6 +363,29 @@ public:
         //std::atomic_thread_fence(std::memory_order_acquire);
         return inc();
     } 
+
+    /**
+     *  Pops up to \p len elements storing them in \p data.
+     *  The elements are first read and then the slots are released all
+     *  together, so that each cache line is passed back to the producer
+     *  once per batch and not once per element.
+     *
+     *  \return the number of elements actually popped (0 if the buffer is empty)
+     */
+    inline unsigned long pop_batch(void ** data, unsigned long len) {
+        void * volatile * const vbuf = buf;
+        unsigned long n = 0, p = pread;
+        if (len>size) len = size;
+        while((n<len) && (vbuf[p]!=NULL)) {
+            data[n++] = vbuf[p];
+            p += (p+1 >= size) ? (1-size): 1;
+        }
+        for(unsigned long i=0; i<n; ++i) {
+            buf[pread]=NULL;
+            pread += (pread+1 >= size) ? (1-size): 1;
+        }
+        return n;
+    }
         
     /** 
      *  It returns the "head" of the buffer, i.e. the element pointed by the read
@@ -366,7 +432,36 @@ public:
         return size;  
     }
 
+    /**
+     * It moves the storage of the buffer on the NUMA node \p node
+     * (see \p FF_NUMA_LOCAL). It can be called at any time.
+     * Only whole pages are moved: if \p FF_NUMA_LOCAL is not defined the
+     * storage is not page aligned and small buffers are not moved.
+     *
+     * \return 0 on success, -1 otherwise
+     */
+    inline int numa_place(int node) { return ff_numa_move(buf, storage(), node); }
+
+    /// NUMA node where the storage of the buffer is (-1 if unknown)
+    inline int numa_where() const { return ff_numa_node_of(buf); }
+
+    /**
+     * It returns the length of the buffer as seen by the producer (the
+     * same as \p length, it is here for compatibility with uSWSR_Ptr_Buffer)
+     */
+    inline unsigned long length_producer() const { return length(); }
+
     inline bool isFixedSize() const { return true; }
+
+    /**
+     * Events used by the adaptive waiting policy. The consumer registers
+     * the event it sleeps on when the buffer is empty, the producer the
+     * one it sleeps on when the buffer is full.
+     */
+    inline void set_cons_event(ff_event *e) { cons_ev = e; }
+    inline void set_prod_event(ff_event *e) { prod_ev = e; }
+    inline ff_event *get_cons_event() const { return cons_ev; }
+    inline ff_event *get_prod_event() const { return prod_ev; }
 };
 
 /*!
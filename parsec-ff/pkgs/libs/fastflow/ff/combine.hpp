@@ -0,0 +1,188 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/*!
+ *  \file combine.hpp
+ *  \ingroup building_blocks
+ *
+ *  \brief Sequential composition of two nodes executed by one thread
+ *
+ *  \p ff_comb(first, second) is a node whose \p svc calls \p first->svc and
+ *  then \p second->svc on the result, i.e. it behaves as the two-stage
+ *  pipeline \p first -> \p second but without the thread and the channel
+ *  of the second stage. The tasks sent with \p ff_send_out by \p first are
+ *  passed to \p second->svc directly, the ones sent by \p second are sent
+ *  out by the combinator. The End-Of-Stream is notified to \p second when
+ *  it would have received it in the pipeline.
+ *
+ *  The combinator can be nested (\p first and \p second can be ff_comb) and
+ *  used wherever a sequential node is used (pipeline stage, farm worker,
+ *  emitter or collector). It is useful when one of the two stages is
+ *  much cheaper than the stages around it: its thread would be idle most of
+ *  the time but it would still pay the communication and use a core.
+ *  The time spent in each node is measured as if it were run by its own
+ *  thread, so that \p getsvcavg and \p getsvctime can be used on the
+ *  nodes after the combinator has been run (see \p ff_pipeline::set_fusion).
+ */
+
+/* ***************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License version 3 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ *  License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ ****************************************************************************
+ */
+
+#ifndef FF_COMBINE_HPP
+#define FF_COMBINE_HPP
+
+#include <ff/node.hpp>
+
+namespace ff {
+
+/*!
+ * \class ff_comb
+ * \ingroup building_blocks
+ *
+ * \brief Executes two sequential nodes, one after the other, in one thread.
+ *
+ * This class is defined in \ref combine.hpp
+ */
+class ff_comb: public ff_node {
+    // tasks sent out by the first node
+    static bool sendtosecond(void *task, unsigned long retry, unsigned long ticks, void *arg) {
+        ff_comb *c = reinterpret_cast<ff_comb*>(arg);
+        if (task == GO_ON || task == GO_OUT) return true;
+        if (task == EOS_NOFREEZE) { c->endsecond(); return true; }
+        if (task == EOS || task == EOSW) {
+            c->endsecond();
+            return c->send(task, retry, ticks);
+        }
+        if (task == BLK || task == NBLK) return c->send(task, retry, ticks);
+        void *r = c->call(c->second, task);
+        if (r == GO_ON) return true;
+        if (!r || r == EOS || r == EOSW || r == EOS_NOFREEZE || r == GO_OUT) {
+            // the second node ends the stream, it is done when first->svc returns
+            c->eos = true;
+            return true;
+        }
+        return c->send(r, retry, ticks);
+    }
+    // tasks sent out by the second node
+    static bool sendout(void *task, unsigned long retry, unsigned long ticks, void *arg) {
+        return reinterpret_cast<ff_comb*>(arg)->send(task, retry, ticks);
+    }
+
+    // sends out a task, the time waiting for room in the output channel is 
+    // not accounted to the node being called (as in ff_node's svc loop), nor
+    // the time spent by an enclosing combinator in the following nodes
+    inline bool send(void *task, unsigned long retry, unsigned long tw) {
+        const ticks t0 = getticks(), w0 = waitticks;
+        const bool r = ff_send_out(task, retry, tw);
+        nested += (callback ? getticks()-t0 : waitticks-w0);
+        return r;
+    }
+
+    // calls n->svc accounting to n the time not spent in nested calls
+    inline void *call(ff_node *n, void *task) {
+        const ticks saved = nested;
+        nested = 0;
+        const ticks t0 = getticks();
+        void *r = n->svc(task);
+        const ticks diff = getticks()-t0;
+        n->svcticks += diff - nested;
+        ++n->svccnt;
+        nested = saved + diff;
+        return r;
+    }
+
+    // the second node receives the End-Of-Stream
+    inline void endsecond() {
+        if (ended) return;
+        ended = true;
+        second->eosnotify();
+    }
+
+    // the nodes use the work time of the combinator to convert their ticks
+    static inline void settimes(ff_node *n, const ff_node *c) {
+        n->tstart  = c->tstart;   n->tstop  = c->tstop;
+        n->wtstart = c->wtstart;  n->wtstop = c->wtstop;
+        n->wttime  = c->wttime;   n->wtticks = c->wtticks;
+    }
+
+public:
+    /**
+     * \brief Constructor
+     *
+     * \param first the node executed first
+     * \param second the node receiving the output of \p first
+     * \param cleanup if \p true the two nodes are deleted by the destructor
+     */
+    ff_comb(ff_node *first, ff_node *second, bool cleanup=false):
+        first(first), second(second), cleanup(cleanup) {
+        first->registerCallback(sendtosecond, this);
+        second->registerCallback(sendout, this);
+    }
+
+    virtual ~ff_comb() {
+        if (cleanup) { delete first; delete second; }
+    }
+
+    int svc_init() {
+        ended = eos = false;
+        nested = 0;
+        first->set_id(get_my_id());
+        second->set_id(get_my_id());
+        if (first->svc_init()<0)  return -1;
+        if (second->svc_init()<0) return -1;
+        return 0;
+    }
+
+    void *svc(void *task) {
+        void *r = call(first, task);
+        if (r == GO_ON) return (eos ? EOS : GO_ON);
+        if (r == GO_OUT || r == EOS_NOFREEZE || r == BLK || r == NBLK) return r;
+        if (!r || r == EOS || r == EOSW) {
+            endsecond();
+            return (r ? r : EOS);
+        }
+        if (eos) return EOS;
+        return call(second, r);
+    }
+
+    void eosnotify(ssize_t id=-1) {
+        first->eosnotify(id);
+        endsecond();
+    }
+
+    void svc_end() {
+        settimes(first, this);
+        settimes(second, this);
+        first->svc_end();
+        second->svc_end();
+    }
+
+    ff_node *getFirst()  const { return first;  }
+    ff_node *getSecond() const { return second; }
+
+protected:
+    ff_node *first;
+    ff_node *second;
+    bool     cleanup;
+    bool     ended  = false;  // the second node has been notified the EOS
+    bool     eos    = false;  // the second node has ended the stream
+    ticks    nested = 0;
+};
+
+} // namespace ff
+
+#endif /* FF_COMBINE_HPP */
@@ -62,6 +62,20 @@
  */
 //#define FF_TASK_CALLBACK 1
 
+/* To place the storage of each channel on the NUMA node of the thread
+ * consuming from it (and the segments of an ff_allocator on the NUMA node
+ * of the thread registered as allocator), define the following macro. 
+ * The placement is done when the threads start, after they have been 
+ * mapped on their cores.
+ */
+//#define FF_NUMA_LOCAL 1
+
+/* To record, for each thread of the run-time, when every task is received,
+ * computed and sent out, define the following macro. The events are exported
+ * at exit as a Chrome trace-event JSON file (see trace.hpp).
+ */
+//#define TRACE_FASTFLOW_EVENTS 1
+
 namespace ff {
 static const size_t FF_EOS           = (ULLONG_MAX);  /// automatically propagated
 static const size_t FF_EOS_NOFREEZE  = (FF_EOS-0x1);  /// non automatically propagated
@@ -85,6 +99,12 @@ static const size_t FF_NBLK          = (FF_EOS-0x6);  /// automatically propagat
 #define FFTRACE(x)
 #endif
 
+#if defined(TRACE_FASTFLOW_EVENTS)
+#define FFTRACE_EVENT(x) x
+#else
+#define FFTRACE_EVENT(x)
+#endif
+
 #if defined(BLOCKING_MODE)
 #define RUNTIME_MODE true
 #else
@@ -116,6 +136,16 @@ static const size_t FF_NBLK          = (FF_EOS-0x6);  /// automatically propagat
 #define BACKOFF_MAX 1024
 #endif
 
+// Adaptive waiting policy (see waitpolicy.hpp): number of exponential
+// backoff rounds before sleeping on the queue event, and upper bound (in
+// microseconds) of a single sleep.
+#if !defined(FF_ADAPTIVE_SPIN_ROUNDS)
+#define FF_ADAPTIVE_SPIN_ROUNDS 12
+#endif
+#if !defined(FF_ADAPTIVE_SLEEP_US)
+#define FF_ADAPTIVE_SLEEP_US 2000
+#endif
+
 // TODO:
 //#if defined(NO_CMAKE_CONFIG)
 
@@ -60,6 +60,10 @@
 #include <ff/node.hpp>
 #include <ff/multinode.hpp>
 #include <ff/fftree.hpp>
+#include <ff/budget.hpp>
+#if (__cplusplus >= 201103L) || (defined __GXX_EXPERIMENTAL_CXX0X__) || (defined(HAS_CXX11_VARIADIC_TEMPLATES))
+#include <ff/make_unique.hpp>
+#endif
 
 namespace ff {
 
@@ -67,6 +71,7 @@ namespace ff {
 /* This file provides the following classes:
  *   ff_farm    task-farm pattern 
  *   ff_ofarm   ordered task-farm pattern
+ *   ff_seqfarm ordered task-farm pattern with any scheduling policy
  *   ff_Farm    typed version of the task-farm pattern (requires c++11)
  *
  */
@@ -97,14 +102,26 @@ protected:
         lb->set_barrier(barrier);
         if (gt) gt->set_barrier(barrier);
 
-        return (card + 1 + ((collector && !collector_removed)?1:0));
+        return (card + (inchannel?0:1) + ((collector && !collector_removed)?1:0));
     }
 
     inline int prepare() {
         size_t nworkers = workers.size();
+        if (inchannel) {
+            if (workstealing) {
+                error("FARM, work-stealing scheduling needs the Emitter\n");
+                return -1;
+            }
+            inchannel->set_consumers(nworkers);
+        }
         for(size_t i=0;i<nworkers;++i) {
-            if (workers[i]->create_input_buffer((int) (ondemand ? ondemand: (in_buffer_entries/nworkers + 1)), 
-                                                (ondemand ? true: fixedsize))<0) return -1;
+            if (inchannel) {
+                if (workers[i]->isMultiInput() || workers[i]->set_input_channel(inchannel)<0) {
+                    error("FARM, worker %d cannot take its input from the farm channel\n", i);
+                    return -1;
+                }
+            } else if (workers[i]->create_input_buffer((int) (ondemand ? ondemand: (in_buffer_entries/nworkers + 1)), 
+                                                       (ondemand ? true: fixedsize))<0) return -1;
             if ((collector && !collector_removed) || lb->masterworker()) 
                 // NOTE: force unbounded queue if masterworker
                 if (workers[i]->get_out_buffer()==NULL &&
@@ -114,6 +131,10 @@ protected:
             lb->register_worker(workers[i]);
             if (collector && !collector_removed) gt->register_worker(workers[i]);
         }
+        if (workstealing) {
+            wsdeques = new ff_wsgroup(nworkers);
+            for(size_t i=0;i<nworkers;++i) workers[i]->set_wsgroup(wsdeques, i);
+        }
         for(size_t i=0;i<nworkers;++i) {
             pthread_mutex_t   *m        = NULL;
             pthread_cond_t    *c        = NULL;
@@ -235,6 +256,7 @@ public:
      */
     ff_farm(std::vector<ff_node*>& W, ff_node *const Emitter=NULL, ff_node *const Collector=NULL, bool input_ch=false):
         has_input_channel(input_ch),prepared(false),collector_removed(false),ondemand(0),
+        workstealing(false),wsdeques(NULL),
         in_buffer_entries(DEF_IN_BUFF_ENTRIES),
         out_buffer_entries(DEF_OUT_BUFF_ENTRIES),
         worker_cleanup(false),emitter_cleanup(false),collector_cleanup(false),
@@ -301,6 +323,7 @@ public:
                      int max_num_workers=DEF_MAX_NUM_WORKERS,
                      bool fixedsize=false):  // NOTE: by default all the internal farm queues are unbounded !
         has_input_channel(input_ch),prepared(false),collector_removed(false),ondemand(0),
+        workstealing(false),wsdeques(NULL),
         in_buffer_entries(in_buffer_entries),
         out_buffer_entries(out_buffer_entries),
         worker_cleanup(worker_cleanup),emitter_cleanup(false),collector_cleanup(false),
@@ -362,6 +385,8 @@ public:
         }
         
         if (barrier) {delete barrier; barrier=NULL;}
+        if (wsdeques) {delete wsdeques; wsdeques=NULL;}
+        if (inchannel) {delete inchannel; inchannel=NULL;}
         
         //fftree stuff
         if (fftree_ptr) { delete fftree_ptr; fftree_ptr=NULL; }
@@ -424,6 +449,73 @@ public:
         else ondemand=inbufferentries;
     }
 
+    /**
+     * \brief Sets work-stealing scheduling
+     *
+     * The Emitter schedules tasks as usual (e.g. round-robin), but each
+     * Worker moves the tasks received into its own deque and, when it has
+     * nothing to do, it steals tasks from the tail of the deques of the other 
+     * Workers. This is useful when the cost of the tasks is highly variable.
+     * Tasks sent to a specific worker (\p ff_send_out_to) may be stolen as
+     * well, while control messages (EOS, ...) are always received by the 
+     * target worker. Workers should be sequential nodes.
+     * It must be called before running the farm.
+     */
+    void set_scheduling_workstealing() { workstealing = true; }
+
+    /**
+     * \brief Sets a load-aware scheduling policy
+     *
+     * The Emitter sends each task to the worker having the lowest number of
+     * tasks queued in its input channel. With \p p2c set, only two workers
+     * picked at random are compared (power of two choices), which is much
+     * cheaper with many workers and almost as good. Differently from the
+     * on-demand scheduling, the workers' queues are not shrunk, so the two
+     * can be combined by using more than one slot per worker 
+     * (e.g. \p set_scheduling_ondemand(8)). 
+     * It has no effect if the Emitter redefines \p selectworker.
+     *
+     * \param p2c selects the power of two choices variant
+     */
+    void set_scheduling_leastloaded(bool p2c=false) {
+        lb->set_scheduling_policy(p2c ? FF_SCHED_P2C : FF_SCHED_LEASTLOADED);
+    }
+
+    /**
+     * \brief Sets the elastic farm
+     *
+     * The number of running workers is adapted at run-time to the load, by
+     * parking (freezing) and unparking (thawing) the workers, so that either
+     * their utilisation stays high or the given throughput is reached with
+     * the minimum number of workers (see \p ff_loadbalancer::set_elastic).
+     * The farm is elastic by default if FF_ELASTIC is defined.
+     *
+     * \param enable enables or disables the elastic behaviour
+     * \param minw min number of running workers
+     * \param target throughput (tasks per second), 0 to maximise the efficiency
+     */
+    void set_elastic(bool enable=true, size_t minw=1, double target=0.0) {
+        lb->set_elastic(enable, minw, target);
+    }
+
+    /**
+     * \brief Sets the waiting policy of all farm's threads
+     *
+     * It sets the policy used by the emitter, the collector and by all the
+     * workers added so far when they find their channels empty (or full).
+     * With \p FF_WAIT_ADAPTIVE idle threads spin for a while and then sleep
+     * until there is something to do (see waitpolicy.hpp). Single threads
+     * can be tuned by using \p getlb()->set_wait_policy,
+     * \p getgt()->set_wait_policy and \p ff_node::set_wait_policy.
+     *
+     * \param p is the waiting policy
+     */
+    void set_wait_policy(ff_wait_t p) {
+        lb->set_wait_policy(p);
+        gt->set_wait_policy(p);
+        for(size_t i=0;i<workers.size();++i) workers[i]->set_wait_policy(p);
+    }
+
     /**
      *  \brief Adds workers to the form
      *
@@ -586,7 +678,11 @@ public:
      * \brief Removes the collector
      *
      * It allows not to start the collector thread, whereas all worker's output
-     * buffer will be created as if it were present.
+     * buffer will be created as if it were present. In a pipeline the next
+     * stage has to be multi-input (an \p ff_minode or a farm with a
+     * multi-input Emitter): it pops directly from the workers' SWSR buffers in
+     * round-robin and receives the EOS once all the workers have sent it, so
+     * no thread is spent for gathering the results.
      *
      * \return 0 is always returned.
      */
@@ -597,6 +693,74 @@ public:
         return 0;
     }
 
+    /**
+     *
+     * \brief Removes the emitter
+     *
+     * The Emitter thread is not started: the workers pull the tasks from a
+     * bounded MPMC channel (see \ref mpmcchannel.hpp) into which the
+     * producers push directly, i.e. the threads calling \p offload or the
+     * previous stage of the pipeline (a sequential node, the collector of a
+     * farm or the workers of a farm without collector). This saves one
+     * thread and one queue hop per task; the tasks are taken by the first
+     * idle worker, as in the on-demand scheduling. The End-Of-Stream is
+     * received by all the workers. It cannot be used together with a
+     * user-defined Emitter, the feedback channel,
+     * \p ff_send_out_to/\p broadcast_task and the work-stealing or elastic
+     * scheduling. It must be called before running the farm.
+     *
+     * \param nentries is the capacity of the channel (rounded up to a power of 2)
+     *
+     * \return 0 if successful, otherwise -1 is returned.
+     */
+    int remove_emitter(int nentries=DEF_IN_BUFF_ENTRIES) {
+        if (emitter) {
+            error("FARM, remove_emitter: emitter already present\n");
+            return -1;
+        }
+        if (prepared || inchannel) {
+            error("FARM, remove_emitter: the farm has already been prepared\n");
+            return -1;
+        }
+        inchannel = new ff_mpmc_channel;
+        if (!inchannel || !inchannel->init((nentries>0) ? nentries : DEF_IN_BUFF_ENTRIES)) {
+            error("FARM, remove_emitter: cannot create the input channel\n");
+            return -1;
+        }
+        lb->setfftree(NULL);
+        fftree_ptr->update_child(0, NULL);
+        return 0;
+    }
+
+    /**
+     * \brief Gets the input channel of the farm without Emitter (NULL otherwise)
+     */
+    ff_mpmc_channel * get_in_channel() const { return inchannel; }
+
+    int set_input_channel(ff_mpmc_channel * const) {
+        error("FARM, a farm cannot be fed by a shared channel\n");
+        return -1;
+    }
+
+    /**
+     * \internal
+     * \brief The output of the farm goes to a shared channel
+     *
+     * The tasks are pushed into the channel by the collector, if present,
+     * otherwise by each worker.
+     */
+    int set_output_channel(ff_mpmc_channel * const c) {
+        if (collector && !collector_removed) {
+            gt->set_out_channel(c);
+            c->set_producers(1);  // the collector sends the EOS
+            return 0;
+        }
+        for(size_t i=0;i<workers.size();++i)
+            if (workers[i]->set_output_channel(c)<0) return -1;
+        c->set_producers(workers.size());  // each worker sends its EOS
+        return 0;
+    }
+
     /**
      * \internal
      * \brief Sets multiple input nodes
@@ -663,7 +827,12 @@ public:
         
         if (!prepared) if (prepare()<0) return -1;
 
-        if (lb->run()<0) {
+        if (inchannel) {
+            if (lb->runWorkers()<0) {
+                error("FARM, running workers\n");
+                return -1;
+            }
+        } else if (lb->run()<0) {
             error("FARM, running load-balancer module\n");
             return -1;        
         }
@@ -673,6 +842,7 @@ public:
                 return -1;
             }
 
+        budget_lease(workers.size());
         return 0;
     }
 
@@ -725,8 +895,10 @@ public:
      */
     int wait(/* timeval */ ) {
         int ret=0;
-        if (lb->wait()<0) ret=-1;
+        if (inchannel) { if (lb->waitWorkers()<0) ret=-1; }
+        else if (lb->wait()<0) ret=-1;
         if (!collector_removed && collector) if (gt->wait()<0) ret=-1;
+        budget_unlease();
         return ret;
     }
 
@@ -739,8 +911,10 @@ public:
      */
     inline int wait_freezing(/* timeval */ ) {
         int ret=0;
-        if (lb->wait_freezing()<0) ret=-1;
+        if (inchannel) { if (lb->wait_freezingWorkers()<0) ret=-1; }
+        else if (lb->wait_freezing()<0) ret=-1;
         if (!collector_removed && collector) if (gt->wait_freezing()<0) ret=-1;
+        budget_unlease();
         return ret; 
     } 
 
@@ -776,6 +950,11 @@ public:
      * \return true if the pattern is frozen or has terminated the execution.
      */
     inline bool done() const { 
+        if (inchannel) {
+            for(size_t i=0;i<workers.size();++i)
+                if (!workers[i]->done()) return false;
+            return (!collector || collector_removed || gt->done());
+        }
         if (collector && !collector_removed) return (lb->done() && gt->done());
         return lb->done();
     }
@@ -794,6 +973,14 @@ public:
     inline bool offload(void * task,
                         unsigned long retry=((unsigned long)-1),
                         unsigned long ticks=ff_loadbalancer::TICKS2WAIT) { 
+        if (inchannel) {
+            for(unsigned long i=0;i<retry;++i) {
+                if (inchannel->push(task)) return true;
+                if (blocking_out) inchannel->wait_push();
+                else losetime_out(ticks);
+            }
+            return false;
+        }
         FFBUFFER * inbuffer = get_in_buffer();
 
         if (inbuffer) {
@@ -816,7 +1003,10 @@ public:
                 goto _retry;
             }
             for(unsigned long i=0;i<retry;++i) {
-                if (inbuffer->push(task)) return true;
+                if (inbuffer->push(task)) { 
+                    ff_wakeup_consumer(inbuffer); 
+                    return true; 
+                }
                 losetime_out(ticks);
             } 
             return false;
@@ -998,10 +1188,18 @@ public:
      *
      * It returns the starting time.
      *
-     * \return A structure of \p timeval showing the starting time.
+     * \return The starting time (ns, see \p ff_gettime).
      *
      */
-    const struct timeval getstarttime() const { return lb->getstarttime();}
+    ff_time_t getstarttime() const { 
+        if (inchannel) {
+            std::vector<ff_time_t> workertime(workers.size(),0);
+            for(size_t i=0;i<workers.size();++i)
+                workertime[i]=workers[i]->getstarttime();
+            return *std::min_element(workertime.begin(),workertime.end());
+        }
+        return lb->getstarttime();
+    }
 
     /**
      * \internal
@@ -1013,18 +1211,15 @@ public:
      * then return the vector, showing the collective finishing time of the
      * farm with no collector.
      *
-     * \return A \timeval showing the finishing time of the farm.
+     * \return The finishing time of the farm.
      */
-    const struct timeval  getstoptime()  const {
+    ff_time_t getstoptime()  const {
         if (collector && !collector_removed) return gt->getstoptime();
-        const struct timeval zero={0,0};
-        std::vector<struct timeval > workertime(workers.size()+1,zero);
+        std::vector<ff_time_t> workertime(workers.size()+1,0);
         for(size_t i=0;i<workers.size();++i)
             workertime[i]=workers[i]->getstoptime();
         workertime[workers.size()]=lb->getstoptime();
-        std::vector<struct timeval >::iterator it=
-            std::max_element(workertime.begin(),workertime.end(),time_compare);
-        return (*it);
+        return *std::max_element(workertime.begin(),workertime.end());
     }
 
     /**
@@ -1033,9 +1228,17 @@ public:
      *
      * It returnes the starting time.
      *
-     * \return A struct of type timeval showing the starting time.
+     * \return The starting time (ns, see \p ff_gettime).
      */
-    const struct timeval  getwstartime() const { return lb->getwstartime(); }    
+    ff_time_t getwstartime() const { 
+        if (inchannel) {
+            std::vector<ff_time_t> workertime(workers.size(),0);
+            for(size_t i=0;i<workers.size();++i)
+                workertime[i]=workers[i]->getwstartime();
+            return *std::min_element(workertime.begin(),workertime.end());
+        }
+        return lb->getwstartime(); 
+    }    
 
     /**
      * \internal
@@ -1047,17 +1250,14 @@ public:
      *
      * \return The vector showing the finishing time.
      */
-    const struct timeval  getwstoptime() const {
+    ff_time_t getwstoptime() const {
         if (collector && !collector_removed) return gt->getwstoptime();
-        const struct timeval zero={0,0};
-        std::vector<struct timeval > workertime(workers.size()+1,zero);
+        std::vector<ff_time_t> workertime(workers.size()+1,0);
         for(size_t i=0;i<workers.size();++i) {
             workertime[i]=workers[i]->getwstoptime();
         }
         workertime[workers.size()]=lb->getwstoptime();
-        std::vector<struct timeval >::iterator it=
-            std::max_element(workertime.begin(),workertime.end(),time_compare);
-        return (*it);
+        return *std::max_element(workertime.begin(),workertime.end());
     }
     
     /**
@@ -1071,9 +1271,9 @@ public:
      */
     double ffTime() {
         if (collector && !collector_removed)
-            return diffmsec(gt->getstoptime(), lb->getstarttime());
+            return diffmsec(gt->getstoptime(), getstarttime());
 
-        return diffmsec(getstoptime(),lb->getstarttime());
+        return diffmsec(getstoptime(),getstarttime());
     }
 
     /**
@@ -1086,9 +1286,9 @@ public:
      */
     double ffwTime() {
         if (collector && !collector_removed)
-            return diffmsec(gt->getwstoptime(), lb->getwstartime());
+            return diffmsec(gt->getwstoptime(), getwstartime());
 
-        return diffmsec(getwstoptime(),lb->getwstartime());
+        return diffmsec(getwstoptime(),getwstartime());
     }
 
 
@@ -1138,8 +1338,12 @@ protected:
      * If the thread is frozen, then thaw it. 
      */
     inline void thaw(bool _freeze=false, ssize_t nw=-1) {
-        lb->thaw(_freeze, nw);
+        if (inchannel) {
+            lb->ff_thread::thaw(_freeze);  // no thread, it only keeps the farm state
+            lb->thawWorkers(_freeze, nw);
+        } else lb->thaw(_freeze, nw);
         if (collector && !collector_removed) gt->thaw(_freeze, nw);
+        budget_lease((nw<0)?workers.size():(size_t)nw);
     }
 
     /**
@@ -1165,6 +1369,10 @@ protected:
      *  \return If successful 0, otherwsie a negative value.
      */
     int create_input_buffer(int nentries, bool fixedsize) {
+        if (inchannel) {
+            error("FARM without emitter, the input is the channel of the farm\n");
+            return -1;
+        }
         if (in) {
             error("FARM create_input_buffer, buffer already present\n");
             return -1;
@@ -1250,6 +1458,11 @@ protected:
             error("FARM with no collector, cannot set output buffer\n");
             return -1;
         }
+        if (collector_removed) {
+            // the workers cannot share a single SWSR buffer
+            error("FARM without collector, the next stage has to be multi-input (ff_minode)\n");
+            return -1;
+        }
         gt->set_out_buffer(o);
         if (collector && !collector_removed) {
             if (collector != (ff_node*)gt) collector->set_output_buffer(o);
@@ -1257,11 +1470,28 @@ protected:
         return 0;
     }
 
+protected:
+    // the running workers are counted in the process-wide budget (see budget.hpp),
+    // they park while waiting if the farm exceeds its share
+    inline void budget_lease(size_t n) {
+        if (!budgeted || budgetleased) return;
+        budgetleased = n;
+        ff_budget::instance().reserve(n);
+        for(size_t i=0;i<workers.size();++i) workers[i]->budgetlease = &budgetleased;
+    }
+    inline void budget_unlease() {
+        if (!budgetleased) return;
+        ff_budget::instance().release(budgetleased);
+        budgetleased = 0;
+    }
+
 protected:
     bool has_input_channel; // for accelerator
     bool prepared;
     bool collector_removed;
     int ondemand;          // if >0, emulates on-demand scheduling
+    bool workstealing;     // if true, idle workers steal tasks from their peers
+    ff_wsgroup *wsdeques;
     int in_buffer_entries;
     int out_buffer_entries;
     bool worker_cleanup, emitter_cleanup,collector_cleanup;
@@ -1275,6 +1505,9 @@ protected:
     svector<ff_node*>  workers;
     svector<ff_node*>  internalSupportNodes;
     bool               fixedsize;
+    bool               budgeted     = true;  // false if the budget is managed by the subclass
+    size_t             budgetleased = 0;
+    ff_mpmc_channel  * inchannel    = NULL;  // input of the workers if the emitter is removed
 
 };
 
@@ -1588,6 +1821,9 @@ private:
         static inline bool ff_send_out_ofarmC(void * task,unsigned long retry,unsigned long ticks, void *obj) {
             return ((ofarmC *)obj)->ff_send_out(task, retry, ticks);
         }
+        static inline bool ff_send_out_ofarmC_batch(void ** tasks,size_t n,unsigned long retry,unsigned long ticks, void *obj) {
+            return ((ofarmC *)obj)->ff_send_out_batch(tasks, n, retry, ticks);
+        }
     public:
         /**
          * \brief Constructor
@@ -1606,7 +1842,10 @@ private:
          */
         void setfilter(ff_node* f) { 
             C_f = f;
-            if (f) f->registerCallback(ff_send_out_ofarmC, this);
+            if (f) {
+                f->registerCallback(ff_send_out_ofarmC, this);
+                f->registerBatchCallback(ff_send_out_ofarmC_batch);
+            }
         }
 
         /**
@@ -1740,6 +1979,8 @@ public:
         C = new ofarmC(this->getgt());
         this->add_emitter(E);
         this->add_collector(C);
+        // the order is kept by visiting all the workers round-robin
+        this->getlb()->set_elastic(false);
     }
 
     /**
@@ -1775,6 +2016,21 @@ public:
     ff_node* getEmitter() const { return E_f;}
 
     ff_node* getCollector() const { return C_f; }
+
+    /**
+     * \brief Work-stealing is not available in the ordered farm 
+     * (tasks are collected from the workers in the scheduling order)
+     */
+    void set_scheduling_workstealing() {
+        error("OFARM, work-stealing scheduling not supported, ignored\n");
+    }
+
+    /**
+     * \brief Load-aware scheduling is not available in the ordered farm
+     */
+    void set_scheduling_leastloaded(bool=false) {
+        error("OFARM, least-loaded scheduling not supported, ignored\n");
+    }
     
     /**
      * \brief run
@@ -1793,10 +2049,285 @@ protected:
 };
 
 
+// max n. of tasks in flight in the ff_seqfarm (size of the reorder buffer)
+#if !defined(FF_SEQFARM_WINDOW)
+#define FF_SEQFARM_WINDOW 1024
+#endif
 
-#if (__cplusplus >= 201103L) || (defined __GXX_EXPERIMENTAL_CXX0X__) || (defined(HAS_CXX11_VARIADIC_TEMPLATES))
+/*!
+ *  \class ff_seqfarm
+ *  \ingroup core_patterns
+ *
+ *  \brief Ordered farm based on sequence numbers.
+ *
+ *  Like \p ff_ofarm the results are produced in the same order of the input
+ *  tasks, and the interface is the same (\p setEmitterF, \p add_workers,
+ *  \p setCollectorF). Differently from \p ff_ofarm the tasks are not
+ *  scheduled in strict round-robin: each task takes the next sequence number
+ *  (i.e. the next slot of a reorder buffer of \p window entries) and it is
+ *  dispatched with the policy of the farm (round-robin, on-demand,
+ *  least-loaded, work-stealing), thus a slow task does not stall the
+ *  workers. The Collector receives the slots in any order and releases the
+ *  results in sequence order. The Emitter waits when \p window tasks are in
+ *  flight, so the reorder buffer is bounded (backpressure).
+ *
+ *  The workers must be sequential nodes. For each input task a worker
+ *  produces the tasks sent with \p ff_send_out followed by the value
+ *  returned by \p svc (\p GO_ON means no result); \p ff_send_out can be
+ *  called by the workers only from \p svc.
+ *
+ *  This class is defined in \ref farm.hpp
+ */
+class ff_seqfarm: public ff_farm<> {
+protected:
+    // one entry of the reorder buffer
+    struct slot_t {
+        slot_t():task(NULL),arrived(false) {}
+        void           *task;    // the input task, then the result
+        svector<void*>  out;     // tasks sent by the worker with ff_send_out
+        bool            arrived; // written by the Collector only
+    };
 
-#include <ff/make_unique.hpp>
+    /// reorder buffer shared by the Emitter, the workers and the Collector
+    struct window_t {
+        window_t(size_t size):size(size),seq(0),next(0),waiting(false) {
+            slots = new slot_t[size];
+            pthread_mutex_init(&m, NULL);
+            pthread_cond_init(&c, NULL);
+        }
+        ~window_t() {
+            delete [] slots;
+            pthread_mutex_destroy(&m);
+            pthread_cond_destroy(&c);
+        }
+
+        // Emitter side: waits for a free slot
+        inline slot_t *acquire(void *task) {
+            if (seq - next.load() >= size) {
+                pthread_mutex_lock(&m);
+                waiting.store(true);
+                while(seq - next.load() >= size) pthread_cond_wait(&c, &m);
+                waiting.store(false);
+                pthread_mutex_unlock(&m);
+            }
+            slot_t *s = &slots[seq++ % size];
+            s->task = task;
+            return s;
+        }
+        // Collector side: the slot of the next result, NULL if it is not arrived yet
+        inline slot_t *head() {
+            slot_t *s = &slots[next.load(std::memory_order_relaxed) % size];
+            return s->arrived ? s : NULL;
+        }
+        inline void release(slot_t *s) {
+            s->arrived = false;
+            s->out.clear();
+            next.fetch_add(1);
+            if (waiting.load()) {
+                pthread_mutex_lock(&m);
+                pthread_cond_signal(&c);
+                pthread_mutex_unlock(&m);
+            }
+        }
+
+        const size_t        size;
+        slot_t            * slots;
+        size_t              seq;      // next sequence number (Emitter)
+        std::atomic<size_t> next;     // next result to be delivered (Collector)
+        std::atomic<bool>   waiting;
+        pthread_mutex_t     m;
+        pthread_cond_t      c;
+    };
+
+    class seqE: public ff_node {
+        static inline bool ff_send_out_seqE(void * task,unsigned long retry,unsigned long ticks, void *obj) {
+            return ((seqE*)obj)->send(task, retry, ticks);
+        }
+    public:
+        seqE(window_t *w):w(w),E_f(NULL) {}
+
+        void setfilter(ff_node* f) { 
+            E_f = f;
+            if (f) f->registerCallback(ff_send_out_seqE, this);
+        }
+
+        inline bool send(void *task, unsigned long retry=((unsigned long)-1),
+                         unsigned long ticks=(TICKS2WAIT)) {
+            // control messages are not numbered
+            if ((size_t)task >= FF_NBLK) return ff_send_out(task, retry, ticks);
+            return ff_send_out(w->acquire(task), retry, ticks);
+        }
+
+        int svc_init() { return E_f ? E_f->svc_init() : 0; }
+
+        void * svc(void * task) {
+            if (E_f) task = E_f->svc(task);
+            if (task == EOS || task == GO_ON) return task;
+            send(task);
+            return GO_ON;
+        }
+
+        void svc_end() { if (E_f) E_f->svc_end(); }
+    private:
+        window_t * w;
+        ff_node  * E_f;
+    };
+
+    class seqW: public ff_node {
+        static inline bool ff_send_out_seqW(void * task,unsigned long,unsigned long, void *obj) {
+            slot_t *s = ((seqW*)obj)->cur;
+            if (!s) {
+                error("SEQFARM, ff_send_out can be called by a worker only in svc\n");
+                return false;
+            }
+            s->out.push_back(task);
+            return true;
+        }
+    public:
+        seqW(ff_node *W):W(W),cur(NULL) { W->registerCallback(ff_send_out_seqW, this); }
+
+        ff_node *getworker() const { return W; }
+
+        int svc_init() {
+            W->set_id(get_my_id());
+            return W->svc_init();
+        }
+
+        void * svc(void * task) {
+            cur = (slot_t*)task;
+            void *r = W->svc(cur->task);
+            slot_t *s = cur;
+            cur = NULL;
+            if (!r || r == EOS) {
+                // the worker terminates, the slot has no result
+                s->task = GO_ON;
+                ff_send_out(s);
+                return EOS;
+            }
+            s->task = r;
+            return s;
+        }
+
+        void eosnotify(ssize_t id=-1) { W->eosnotify(id); }
+        void svc_end() { W->svc_end(); }
+    private:
+        ff_node * W;
+        slot_t  * cur;
+    };
+
+    class seqC: public ff_node {
+        static inline bool ff_send_out_seqC(void * task,unsigned long retry,unsigned long ticks, void *obj) {
+            return ((seqC *)obj)->ff_send_out(task, retry, ticks);
+        }
+        static inline bool ff_send_out_seqC_batch(void ** tasks,size_t n,unsigned long retry,unsigned long ticks, void *obj) {
+            return ((seqC *)obj)->ff_send_out_batch(tasks, n, retry, ticks);
+        }
+    public:
+        seqC(window_t *w):w(w),C_f(NULL) {}
+
+        void setfilter(ff_node* f) { 
+            C_f = f;
+            if (f) {
+                f->registerCallback(ff_send_out_seqC, this);
+                f->registerBatchCallback(ff_send_out_seqC_batch);
+            }
+        }
+
+        int svc_init() { return C_f ? C_f->svc_init() : 0; }
+
+        inline void deliver(void *task) {
+            if (C_f) task = C_f->svc(task);
+            if (task != GO_ON && ff_node::get_out_buffer()) ff_send_out(task);
+        }
+
+        void * svc(void * task) {
+            ((slot_t*)task)->arrived = true;
+            slot_t *s;
+            while((s = w->head())) {
+                for(size_t i=0;i<s->out.size();++i) deliver(s->out[i]);
+                if (s->task != GO_ON) deliver(s->task);
+                w->release(s);
+            }
+            return GO_ON;
+        }
+
+        void svc_end() { if (C_f) C_f->svc_end(); }
+    private:
+        window_t * w;
+        ff_node  * C_f;
+    };
+
+public:
+    /**
+     * \brief Constructor
+     *
+     * The parameters are the ones of \p ff_ofarm, \p window is the maximum
+     * number of tasks in flight (i.e. the size of the reorder buffer).
+     */
+    ff_seqfarm(bool input_ch=false,
+               int in_buffer_entries=DEF_IN_BUFF_ENTRIES, 
+               int out_buffer_entries=DEF_OUT_BUFF_ENTRIES,
+               bool worker_cleanup=false,
+               int max_num_workers=DEF_MAX_NUM_WORKERS,
+               bool fixedsize=false,
+               size_t window=FF_SEQFARM_WINDOW):
+        ff_farm<>(input_ch,in_buffer_entries,out_buffer_entries,worker_cleanup,max_num_workers,fixedsize),
+        win(window>0?window:1),E(NULL),C(NULL),E_f(NULL),C_f(NULL) {
+        E = new seqE(&win);
+        C = new seqC(&win);
+        ff_farm<>::add_emitter(E);
+        ff_farm<>::add_collector(C);
+    }
+
+    ~ff_seqfarm() {
+        // the wrappers are deleted by ff_farm if worker_cleanup is set
+        for(size_t i=0;i<W.size();++i) {
+            if (worker_cleanup) delete W[i]->getworker();
+            else delete W[i];
+        }
+        if (E) delete E;
+        if (C) delete C;
+    }
+
+    /// the workers are wrapped, their results are tagged with the sequence number of the input
+    int add_workers(std::vector<ff_node *> & w) {
+        std::vector<ff_node*> wrapped;
+        for(size_t i=0;i<w.size();++i) wrapped.push_back(new seqW(w[i]));
+        const int r = ff_farm<>::add_workers(wrapped);
+        for(size_t i=0;i<wrapped.size();++i) {
+            if (r<0) delete wrapped[i];
+            else W.push_back((seqW*)wrapped[i]);
+        }
+        return r;
+    }
+
+    void setEmitterF  (ff_node* f) { E_f = f; }
+    void setCollectorF(ff_node* f) { C_f = f; }
+
+    ff_node* getEmitter() const   { return E_f;}
+    ff_node* getCollector() const { return C_f; }
+
+    /// maximum n. of tasks in flight
+    size_t getwindow() const { return win.size; }
+
+    int run(bool skip_init=false) {
+        E->setfilter(E_f);
+        C->setfilter(C_f);
+        return ff_farm<>::run(skip_init);
+    }
+
+protected:
+    window_t       win;
+    seqE         * E;
+    seqC         * C;
+    ff_node      * E_f;
+    ff_node      * C_f;
+    svector<seqW*> W;
+};
+
+
+
+#if (__cplusplus >= 201103L) || (defined __GXX_EXPERIMENTAL_CXX0X__) || (defined(HAS_CXX11_VARIADIC_TEMPLATES))
 
 template<typename IN_t=char, typename OUT_t=IN_t>
 class ff_Farm: public ff_farm<> {
@@ -85,14 +85,14 @@ protected:
         --cons_counter;
     }
 
-    inline void push_done() {
+    inline void push_done(size_t n=1) {
         pthread_mutex_lock(p_cons_m);
         if ((*p_cons_counter).load() == 0) {
             pthread_cond_signal(p_cons_c);
         }
-        ++(*p_cons_counter);
+        (*p_cons_counter) += n;
         pthread_mutex_unlock(p_cons_m);
-        ++prod_counter;
+        prod_counter += n;
     }
 
     inline bool init_input_blocking(pthread_mutex_t   *&m,
@@ -178,6 +178,7 @@ protected:
      */
     virtual inline void losetime_out(unsigned long ticks=TICKS2WAIT) { 
         FFTRACE(lostpushticks+=ticks;++pushwait);
+        if (wait_policy == FF_WAIT_ADAPTIVE) { out_waiter.wait(); return; }
 #if defined(SPIN_USE_PAUSE)
         const long n = (long)ticks/2000;
         for(int i=0;i<=n;++i) PAUSE();
@@ -194,6 +195,7 @@ protected:
      */
     virtual inline void losetime_in(unsigned long ticks=TICKS2WAIT) { 
         FFTRACE(lostpopticks+=ticks;++popwait);
+        if (wait_policy == FF_WAIT_ADAPTIVE) { in_waiter.wait(); return; }
 #if defined(SPIN_USE_PAUSE)
         const long n = (long)ticks/2000;
         for(int i=0;i<=n;++i) PAUSE();
@@ -221,6 +223,7 @@ protected:
                 //assert(offline[nextr]==false);
                 if (workers[nextr]->get(task)) {
                     if (blkvector[nextr]) get_done(nextr);
+                    in_waiter.done();
                     return nextr;
                 }
                 else if (++cnt == ntentative()) break;
@@ -242,6 +245,14 @@ protected:
      * It pushes the tasks in a queue. 
      */
     inline bool push(void * task, unsigned long retry=((unsigned long)-1), unsigned long ticks=(TICKS2WAIT)) {
+        if (outchannel) {
+            for(unsigned long i=0;i<retry;++i) {
+                if (outchannel->push(task)) return true;
+                if (blocking_out) outchannel->wait_push();
+                else losetime_out(ticks);
+            }
+            return false;
+        }
         if (blocking_out) {
             if (!filter) {
                 while(!buffer->push(task)) {
@@ -264,17 +275,56 @@ protected:
         }
         if (!filter) {
             for(unsigned long i=0;i<retry;++i) {
-                if (buffer->push(task)) return true;
+                if (buffer->push(task)) { 
+                    ff_wakeup_consumer(buffer); 
+                    out_waiter.done(); 
+                    return true; 
+                }
                 losetime_out(ticks);
             }           
         } else 
             for(unsigned long i=0;i<retry;++i) {
-                if (filter->push(task)) return true;
+                if (filter->push(task)) { out_waiter.done(); return true; }
                 losetime_out();
             }
         return false;        
     }
 
+    /**
+     * \brief Pushes a batch of tasks in the output queue.
+     *
+     * It is the batched version of \p push.
+     */
+    inline bool push_batch(void ** tasks, size_t n, 
+                           unsigned long retry=((unsigned long)-1), unsigned long ticks=(TICKS2WAIT)) {
+        if (outchannel) {
+            for(size_t i=0;i<n;++i)
+                if (!push(tasks[i], retry, ticks)) return false;
+            return true;
+        }
+        size_t done = 0;
+        if (blocking_out) {
+            FFBUFFER *const outbuffer = filter ? filter->get_out_buffer() : buffer;
+            while(done<n) {
+                const size_t k = out_batch(tasks+done, n-done);
+                if (k) { push_done(k); done += k; continue; }
+                pthread_mutex_lock(&prod_m);
+                while(prod_counter.load() >= outbuffer->buffersize()) {
+                    pthread_cond_wait(&prod_c,&prod_m);
+                }
+                pthread_mutex_unlock(&prod_m);  
+            }
+            return true;
+        }
+        for(unsigned long i=0;(done<n) && (i<retry);) {
+            const size_t k = out_batch(tasks+done, n-done);
+            if (k) { done += k; out_waiter.done(); continue; }
+            losetime_out(ticks);
+            ++i;
+        }
+        return (done == n);
+    }
+
     /**
      * \brief Pop a task out of the queue.
      *
@@ -285,9 +335,13 @@ protected:
      */
     bool pop(void ** task) {
         if (!get_out_buffer()) return false;
+        // NOTE: this is called by the consumer of the collector (not by the 
+        // collector thread), so the collector's waiter cannot be used here
         while (! buffer->pop(task)) {
-            losetime_in();
+            if (wait_policy == FF_WAIT_ADAPTIVE) ticks_wait(TICKS2WAIT);
+            else losetime_in();
         } 
+        ff_wakeup_producer(buffer);
         return true;
     }
 
@@ -300,10 +354,30 @@ protected:
      */
     bool pop_nb(void ** task) {
         if (!get_out_buffer()) return false;
-        return buffer->pop(task);
+        if (!buffer->pop(task)) return false;
+        ff_wakeup_producer(buffer);
+        return true;
     }
 
 
+    /* pushes up to n tasks in the output queue */
+    inline size_t out_batch(void ** tasks, size_t n) {
+        if (filter) return filter->push_batch(tasks, n);
+        const size_t k = buffer->push_batch(tasks, n);
+        if (k) ff_wakeup_consumer(buffer);
+        return k;
+    }
+
+    static bool ff_send_out_collector_batch(void ** tasks, size_t n,
+                                            unsigned long retry, 
+                                            unsigned long ticks, void *obj) {
+        bool r = ((ff_gatherer *)obj)->push_batch(tasks, n, retry, ticks);
+#if defined(FF_TASK_CALLBACK)
+        if (r) for(size_t i=0;i<n;++i) ((ff_gatherer *)obj)->callbackOut(obj);
+#endif   
+        return r;
+    }
+
     static bool ff_send_out_collector(void * task,
                                       unsigned long retry, 
                                       unsigned long ticks, void *obj) {
@@ -322,6 +396,32 @@ protected:
     void callbackOut(void *t=NULL) { filter->callbackOut(t); }
 #endif
 
+    /* registers (or removes) the collector events on the queues it waits on */
+    void register_wait_events() {
+        const bool adaptive = (wait_policy == FF_WAIT_ADAPTIVE);
+        ff_event *const iev = adaptive ? in_waiter.event()  : NULL;
+        ff_event *const oev = adaptive ? out_waiter.event() : NULL;
+        FFBUFFER *b;
+        for(size_t i=0;i<workers.size();++i) 
+            if ((b=workers[i]->get_out_buffer())) b->set_cons_event(iev);
+        if (buffer) buffer->set_prod_event(oev);
+        if (filter && (b=filter->get_out_buffer())) b->set_prod_event(oev);
+    }
+
+    /* records the NUMA node of the collector thread and, if FF_NUMA_LOCAL
+     * is defined, moves the workers' output channels on it */
+    void numa_place() {
+        numanode = ff_numa_my_node();
+#if defined(FF_NUMA_LOCAL)
+        if (numanode<0 || ff_topology::instance().numNodes()<2) return;
+        FFBUFFER *b;
+        int r = 0;
+        for(size_t i=0;i<workers.size();++i) 
+            if ((b=workers[i]->get_out_buffer())) r |= b->numa_place(numanode);
+        if (r<0) error("GT, cannot move the input channels on NUMA node %d\n", numanode);
+#endif
+    }
+
 public:
 
     /**
@@ -333,7 +433,7 @@ public:
         running(-1),max_nworkers(max_num_workers), nextr(0),
         neos(0),neosnofreeze(0),channelid(-1),
         filter(NULL), workers(max_nworkers), offline(max_nworkers), buffer(NULL),
-        skip1pop(false), blkvector(max_nworkers) {
+        outchannel(NULL), skip1pop(false), blkvector(max_nworkers) {
         time_setzero(tstart);time_setzero(tstop);
         time_setzero(wtstart);time_setzero(wtstop);
         wttime=0;
@@ -342,8 +442,11 @@ public:
         p_cons_m = NULL, p_cons_c = NULL, p_cons_counter = NULL;
 
         blocking_in = blocking_out = RUNTIME_MODE;
+        wait_policy = FF_WAIT_SPIN;
+        numanode    = -1;
 
         FFTRACE(taskcnt=0;lostpushticks=0;pushwait=0;lostpopticks=0;popwait=0;ticksmin=(ticks)-1;ticksmax=0;tickstot=0);
+        FFTRACE_EVENT(trace=NULL);
     }
 
     virtual ~ff_gatherer() {}
@@ -363,6 +466,7 @@ public:
         filter = f;
         if (filter) { 
             filter->registerCallback(ff_send_out_collector, this);
+            filter->registerBatchCallback(ff_send_out_collector_batch);
             // setting the thread for the filter
             filter->setThread(this);
         }
@@ -378,6 +482,14 @@ public:
      */
     void set_out_buffer(FFBUFFER * const buff) { buffer=buff;}
 
+    /**
+     * \brief Sets the shared output channel
+     *
+     * The gathered tasks are pushed into the channel \p c (the input of a
+     * farm without Emitter) instead of the output buffer.
+     */
+    void set_out_channel(ff_mpmc_channel * const c) { outchannel=c;}
+
     /**
      * \brief Gets the channel id
      *
@@ -396,6 +508,15 @@ public:
      */
     inline size_t getnworkers() const { return (size_t)(running-neos-neosnofreeze); }
 
+    /**
+     * \brief Sets the waiting policy of the collector (see waitpolicy.hpp)
+     *
+     * It is applied when the collector thread starts (or is thawed).
+     */
+    void set_wait_policy(ff_wait_t p) { wait_policy = p; }
+
+    ff_wait_t get_wait_policy() const { return wait_policy; }
+
     
     inline size_t getrunning() const { return (size_t)running;}
     
@@ -453,8 +574,11 @@ public:
      * \return It returns the task if successful, otherwise 0 is returned.
      */
     virtual int svc_init() { 
-        gettimeofday(&tstart,NULL);
+        tstart = ff_gettime();
         for(size_t i=0;i<workers.size();++i)  offline[i]=false;
+        register_wait_events();
+        numa_place();
+        FFTRACE_EVENT(if (!trace) trace = ff_tracer::instance()->newring("collector", (int)tid));
         if (filter) return filter->svc_init(); 
         return 0;
     }
@@ -469,7 +593,7 @@ public:
     virtual void * svc(void *) {
         void * ret  = EOS;
         void * task = NULL;
-        bool outpresent  = (get_out_buffer() != NULL);
+        bool outpresent  = (get_out_buffer() != NULL) || outchannel;
         bool skipfirstpop = skip1pop;
         bool local_blocking_in = blocking_in;  // default behavior is nonblocking
         size_t nblk = 0;
@@ -484,11 +608,16 @@ public:
             set_out_buffer(filter->get_in_buffer());
         }
        
-        gettimeofday(&wtstart,NULL);
+        FFTRACE_EVENT(ff_trace_ring *const tr = trace);
+        FFTRACE_EVENT(unsigned long long tt = ff_trace_now());
+
+        wtstart = ff_gettime();
         do {
             task = NULL;
-            if (!skipfirstpop) 
+            if (!skipfirstpop) {
                 nextr = gather_task(&task); 
+                FFTRACE_EVENT(tt = tr->record(FF_TRACE_RECV, tt));
+            }
             else skipfirstpop=false;
 
             if (task == BLK || task == NBLK) {
@@ -530,7 +659,17 @@ public:
 #if defined(FF_TASK_CALLBACK)
                     if (filter) callbackIn(this);
 #endif
+                    FFTRACE_EVENT(tt = ff_trace_now());
                     task = filter->svc(task);
+                    FFTRACE_EVENT(tt = tr->record(FF_TRACE_SVC, tt));
+#if defined(TRACE_FASTFLOW_EVENTS)
+                    if (tr->qsample_due()) {
+                        size_t len=0;
+                        for(size_t i=0;i<nw;++i)
+                            if (workers[i]->get_out_buffer()) len += workers[i]->get_out_buffer()->length();
+                        tr->qsample(len);
+                    }
+#endif
 
 #if defined(TRACE_FASTFLOW)
                     ticks diff=(getticks()-t0);
@@ -550,7 +689,10 @@ public:
                     ret = EOS;
                     break;
                 }                
-                if (outpresent) push(task);
+                if (outpresent) {
+                    push(task);
+                    FFTRACE_EVENT(tt = tr->record(FF_TRACE_SEND, tt));
+                }
                 if (task == BLK || task == NBLK) blocking_out = (task == BLK);                
 #if defined(FF_TASK_CALLBACK)
                 else 
@@ -567,7 +709,7 @@ public:
         }
         if (ret == EOSW) ret = EOS; // EOSW is like an EOS but it is not propagated
         
-        gettimeofday(&wtstop,NULL);
+        wtstop = ff_gettime();
         wttime+=diffmsec(wtstop,wtstart);
         if (neos>=(size_t)running) neos=0;
         if (neosnofreeze>=(size_t)running) neosnofreeze=0;
@@ -583,7 +725,7 @@ public:
      */
     virtual void svc_end() {
         if (filter) filter->svc_end();
-        gettimeofday(&tstop,NULL);
+        tstop = ff_gettime();
     }
 
     /**
@@ -639,6 +781,7 @@ public:
             channelid = retry.back();
             if(_workers[channelid]->get(&V[channelid])) {
                 if (blkvector[channelid]) get_done(channelid);
+                in_waiter.done();
                 retry.pop_back();
             }
             else {
@@ -699,10 +842,10 @@ public:
         return diffmsec(wtstop,wtstart);
     }
 
-    virtual const struct timeval & getstarttime() const { return tstart;}
-    virtual const struct timeval & getstoptime()  const { return tstop;}
-    virtual const struct timeval & getwstartime() const { return wtstart;}
-    virtual const struct timeval & getwstoptime() const { return wtstop;}
+    virtual ff_time_t getstarttime() const { return tstart;}
+    virtual ff_time_t getstoptime()  const { return tstop;}
+    virtual ff_time_t getwstartime() const { return wtstart;}
+    virtual ff_time_t getwstoptime() const { return wtstop;}
 
 
 #if defined(TRACE_FASTFLOW)  
@@ -718,7 +861,12 @@ public:
             << "  n. tasks      : " << taskcnt   << "\n"
             << "  svc ticks     : " << tickstot  << " (min= " << (filter?ticksmin:0) << " max= " << ticksmax << ")\n"
             << "  n. push lost  : " << pushwait  << " (ticks=" << lostpushticks << ")" << "\n"
-            << "  n. pop lost   : " << popwait   << " (ticks=" << lostpopticks  << ")" << "\n";
+            << "  n. pop lost   : " << popwait   << " (ticks=" << lostpopticks  << ")" << "\n"
+            << "  NUMA node     : " << numanode  << " (workers' channels on nodes:";
+        FFBUFFER *b;
+        for(size_t i=0;i<workers.size();++i) 
+            out << " " << ((b=workers[i]->get_out_buffer()) ? b->numa_where() : -1);
+        out << ")\n";
     }
 
     virtual double getworktime() const { return wttime; }
@@ -742,12 +890,13 @@ private:
     svector<ff_node*> workers;
     svector<bool>     offline;
     FFBUFFER        * buffer;
+    ff_mpmc_channel * outchannel;    /// shared output channel, replaces buffer
     bool              skip1pop;
 
-    struct timeval tstart;
-    struct timeval tstop;
-    struct timeval wtstart;
-    struct timeval wtstop;
+    ff_time_t tstart;
+    ff_time_t tstop;
+    ff_time_t wtstart;
+    ff_time_t wtstop;
     double wttime;
 
 protected:
@@ -771,6 +920,16 @@ protected:
     bool               blocking_out;
     svector<bool>      blkvector;
 
+    // adaptive waiting policy
+    ff_wait_t          wait_policy;
+    ff_waiter          in_waiter;
+    ff_waiter          out_waiter;
+
+    int                numanode;            // NUMA node of the collector thread
+
+#if defined(TRACE_FASTFLOW_EVENTS)
+    ff_trace_ring    * trace;
+#endif
 #if defined(TRACE_FASTFLOW)
     unsigned long taskcnt;
     ticks         lostpushticks;
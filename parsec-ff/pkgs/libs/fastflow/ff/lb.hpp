@@ -36,12 +36,38 @@
 
 #include <iosfwd>
 #include <deque>
+#include <vector>
 
 #include <ff/utils.hpp>
 #include <ff/node.hpp>
 
 namespace ff {
 
+/*
+ * Built-in scheduling policies of the ff_loadbalancer
+ *  FF_SCHED_RR:          round-robin (default)
+ *  FF_SCHED_LEASTLOADED: the worker having the shortest input queue
+ *  FF_SCHED_P2C:         the worker having the shorter input queue between
+ *                        two workers picked at random (power of two choices)
+ */
+enum ff_sched_t { FF_SCHED_RR=0, FF_SCHED_LEASTLOADED=1, FF_SCHED_P2C=2 };
+
+/*
+ * Elastic farm (see ff_loadbalancer::set_elastic). Every FF_ELASTIC_PERIOD_MS
+ * the emitter measures the utilisation of the running workers (fraction of
+ * time spent in svc), then it unparks one worker if the utilisation is above
+ * FF_ELASTIC_HIGH, or parks one worker if it is below FF_ELASTIC_LOW.
+ * Defining FF_ELASTIC all the farms are elastic by default.
+ */
+#if !defined(FF_ELASTIC_PERIOD_MS)
+#define FF_ELASTIC_PERIOD_MS 100
+#endif
+#if !defined(FF_ELASTIC_LOW)
+#define FF_ELASTIC_LOW  0.5
+#endif
+#if !defined(FF_ELASTIC_HIGH)
+#define FF_ELASTIC_HIGH 0.9
+#endif
 
 /*!
  *  \class ff_loadbalancer
@@ -177,7 +203,55 @@ protected:
      *
      * \return The number of worker to be selected.
      */
-    virtual inline size_t selectworker() { return (++nextw % running); }
+    virtual inline size_t selectworker() { 
+        switch(sched_policy) {
+        case FF_SCHED_LEASTLOADED: return selectworker_leastloaded();
+        case FF_SCHED_P2C:         return selectworker_p2c();
+        default: break;
+        }
+        return (++nextw % running); 
+    }
+
+    /// number of tasks queued to the worker \p id (producer-side estimate)
+    inline unsigned long worker_load(size_t id) const {
+        FFBUFFER *const b = workers[id]->get_in_buffer();
+        return (b ? b->length_producer() : 0);
+    }
+
+    /**
+     * \brief Selects the worker having the shortest input queue
+     *
+     * The scan starts from the worker following the last one selected, so
+     * that ties are broken in a round-robin fashion, and it stops as soon as
+     * an empty queue is found.
+     */
+    inline size_t selectworker_leastloaded() {
+        const size_t start = (size_t)(nextw+1) % running;
+        size_t best = start;
+        unsigned long min = worker_load(start);
+        for(ssize_t i=1; (min>0) && (i<running); ++i) {
+            const size_t w = (start+i) % running;
+            const unsigned long l = worker_load(w);
+            if (l<min) { min = l; best = w; }
+        }
+        return best;
+    }
+
+    /**
+     * \brief Power of two choices: the less loaded between two random workers
+     *
+     * It reads just two queues per task, so it is to be preferred to
+     * \p selectworker_leastloaded when the farm has many workers.
+     */
+    inline size_t selectworker_p2c() {
+        if (running<2) return 0;
+        sched_seed = sched_seed*1103515245u + 12345u;
+        const size_t a = (sched_seed>>16) % running;
+        sched_seed = sched_seed*1103515245u + 12345u;
+        size_t b = (sched_seed>>16) % (running-1);
+        if (b>=a) ++b;
+        return (worker_load(b) < worker_load(a)) ? b : a;
+    }
 
 #if defined(LB_CALLBACK)
 
@@ -220,6 +294,7 @@ protected:
      */
     virtual inline void losetime_out(unsigned long ticks=TICKS2WAIT) {
         FFTRACE(lostpushticks+=ticks; ++pushwait);
+        if (wait_policy == FF_WAIT_ADAPTIVE) { out_waiter.wait(); return; }
 #if defined(SPIN_USE_PAUSE)
         const long n = (long)ticks/2000;
         for(int i=0;i<=n;++i) PAUSE();
@@ -235,6 +310,7 @@ protected:
      */
     virtual inline void losetime_in(unsigned long ticks=TICKS2WAIT) {
         FFTRACE(lostpopticks+=ticks; ++popwait);
+        if (wait_policy == FF_WAIT_ADAPTIVE) { in_waiter.wait(); return; }
 #if defined(SPIN_USE_PAUSE)
         const long n = (long)ticks/2000;
         for(int i=0;i<=n;++i) PAUSE();
@@ -295,6 +371,7 @@ protected:
 #endif
                 if(workers[nextw]->put(task)) {
                     FFTRACE(++taskcnt);
+                    out_waiter.done();
                     return true;
                 }
                 ++cnt;
@@ -331,6 +408,7 @@ protected:
                     const size_t idx = (start-availworkers.begin());
                     channelid = (idx >= multi_input_start) ? -1: (*start)->get_my_id();
                     if (blkvector[idx]) pop_done(*start);
+                    in_waiter.done();
                     return start;
                 }
                 else { 
@@ -339,6 +417,8 @@ protected:
                         if (filter && !filter->in_active) { *task=NULL; channelid=-2; return ite;}
                         if (buffer && buffer->pop(task)) {
                             if (blkvector[availworkers.size()]) pop_done(NULL);
+                            ff_wakeup_producer(buffer);
+                            in_waiter.done();
                             channelid = -1;
                             return ite;
                         }
@@ -389,10 +469,12 @@ protected:
             pop_done(NULL);
             return true;
         }
-        if (!filter) 
+        if (!filter) {
             while (! buffer->pop(task)) losetime_in();
-        else 
+            ff_wakeup_producer(buffer);
+        } else 
             while (! filter->pop(task)) losetime_in();
+        in_waiter.done();
         return true;
     }
     
@@ -414,6 +496,7 @@ protected:
         if (task == BLK || task == NBLK) { 
             ((ff_loadbalancer *)obj)->blocking_out = (task==BLK); 
         }
+        if (r && ((ff_loadbalancer *)obj)->elastic_on) ((ff_loadbalancer *)obj)->elastic_step();
 #if defined(FF_TASK_CALLBACK)
         if (r) ((ff_loadbalancer *)obj)->callbackOut(obj);
 #endif
@@ -429,6 +512,44 @@ protected:
         return 0;
     }
 
+    /* registers (or removes) the emitter events on the queues it waits on */
+    void register_wait_events() {
+        const bool adaptive = (wait_policy == FF_WAIT_ADAPTIVE);
+        ff_event *const iev = adaptive ? in_waiter.event()  : NULL;
+        ff_event *const oev = adaptive ? out_waiter.event() : NULL;
+        FFBUFFER *b;
+        if (buffer) buffer->set_cons_event(iev);
+        if (filter && (b=filter->get_in_buffer())) b->set_cons_event(iev);
+        for(size_t i=0;i<workers.size();++i) {
+            if ((b=workers[i]->get_in_buffer())) b->set_prod_event(oev);
+            if (master_worker && (b=workers[i]->get_out_buffer())) 
+                b->set_cons_event(iev);
+        }
+        for(size_t i=0;i<multi_input.size();++i)
+            if ((b=multi_input[i]->get_out_buffer())) b->set_cons_event(iev);
+        for(size_t i=0;i<int_multi_input.size();++i)
+            if ((b=int_multi_input[i]->get_out_buffer())) b->set_cons_event(iev);
+    }
+
+    /* records the NUMA node of the emitter thread and, if FF_NUMA_LOCAL is
+     * defined, moves the queues it reads from on it */
+    void numa_place() {
+        numanode = ff_numa_my_node();
+#if defined(FF_NUMA_LOCAL)
+        if (numanode<0 || ff_topology::instance().numNodes()<2) return;
+        FFBUFFER *b;
+        int r = 0;
+        if (buffer) r |= buffer->numa_place(numanode);
+        else if (filter && (b=filter->get_in_buffer())) r |= b->numa_place(numanode);
+        if (master_worker)
+            for(size_t i=0;i<workers.size();++i) 
+                if ((b=workers[i]->get_out_buffer())) r |= b->numa_place(numanode);
+        for(size_t i=0;i<multi_input.size();++i)
+            if ((b=multi_input[i]->get_out_buffer())) r |= b->numa_place(numanode);
+        if (r<0) error("LB, cannot move the input channels on NUMA node %d\n", numanode);
+#endif
+    }
+
     void absorb_eos(svector<ff_node*>& W) {
         void *task;
         for(size_t i=0;i<W.size();++i) {
@@ -464,8 +585,13 @@ public:
         prod_counter.store(-1);
         p_prod_m = NULL, p_prod_c = NULL, p_prod_counter = NULL;
         blocking_in = blocking_out = RUNTIME_MODE;
+        wait_policy = FF_WAIT_SPIN;
+        sched_policy = FF_SCHED_RR;
+        numanode     = -1;
+        sched_seed   = (unsigned)(size_t)this;
 
         FFTRACE(taskcnt=0;lostpushticks=0;pushwait=0;lostpopticks=0;popwait=0;ticksmin=(ticks)-1;ticksmax=0;tickstot=0);
+        FFTRACE_EVENT(trace=NULL);
     }
 
     /** 
@@ -620,6 +746,7 @@ public:
     virtual inline bool ff_send_out_to(void *task, int id,  
                                unsigned long retry=((unsigned long)-1),
                                unsigned long ticks=(TICKS2WAIT)) {        
+        while(elastic_on && id>=running && id<elastic_maxw) elastic_unpark();
         if (blocking_out) {
         _retry:
             if (workers[id]->put(task)) {
@@ -651,6 +778,7 @@ public:
         for(unsigned long i=0;i<retry;++i) {
             if (workers[id]->put(task)) {
                 FFTRACE(++taskcnt);
+                out_waiter.done();
 #if defined(FF_TASK_CALLBACK)
                 callbackOut(this);
 #endif
@@ -671,6 +799,13 @@ public:
      */
     virtual inline void broadcast_task(void * task) {
        std::vector<size_t> retry;
+       if (elastic_on) {
+           while(running<elastic_maxw) elastic_unpark();
+           // a worker still has to leave svc for its last parking, the task must 
+           // not find it out of the svc loop (e.g. an EOS followed by ff_thread::wait)
+           for(ssize_t i=0;i<running;++i)
+               while(workers[i]->parking.load()) losetime_out();
+       }
        if (blocking_out) {
            for(ssize_t i=0;i<running;++i) {
                if(!workers[i]->put(task))
@@ -705,6 +840,7 @@ public:
                retry.pop_back();
            else losetime_out();
        }       
+       out_waiter.done();
 #if defined(FF_TASK_CALLBACK)
        callbackOut(this);
 #endif
@@ -713,6 +849,64 @@ public:
        }    
     }
 
+    /**
+     * \brief Sets the waiting policy of the emitter (see waitpolicy.hpp)
+     *
+     * It is applied when the emitter thread starts (or is thawed).
+     */
+    void set_wait_policy(ff_wait_t p) { wait_policy = p; }
+
+    ff_wait_t get_wait_policy() const { return wait_policy; }
+
+    /**
+     * \brief Sets the built-in scheduling policy (see \p ff_sched_t)
+     *
+     * The load-aware policies look at the number of tasks queued in the
+     * input channel of each worker, so they work best with a bounded number
+     * of slots per worker (e.g. together with on-demand scheduling with more
+     * than one slot). They are ignored if \p selectworker is redefined.
+     */
+    void set_scheduling_policy(ff_sched_t p) { sched_policy = p; }
+
+    ff_sched_t get_scheduling_policy() const { return sched_policy; }
+
+    /**
+     * \brief Makes the number of running workers adapt to the load
+     *
+     * The emitter periodically measures the utilisation of the workers and
+     * the throughput of the farm, then it parks (freezes) or unparks (thaws)
+     * one worker at a time (see FF_ELASTIC_* in lb.hpp):
+     *  - with \p target=0 the utilisation is kept between FF_ELASTIC_LOW and
+     *    FF_ELASTIC_HIGH, a worker is added only if tasks are waiting in the
+     *    queues;
+     *  - with \p target>0 a worker is added when the throughput (tasks/s) is
+     *    below \p target and the workers are saturated, and it is removed when
+     *    the utilisation is low or the target is met with one worker less.
+     * The worker having the highest index is parked: it is not given new
+     * tasks and, once its queue is empty, it is frozen (\p svc_end and
+     * \p svc_init are not called). The parked workers are unparked when a
+     * task is sent to them with \p ff_send_out_to, when a task is broadcast
+     * and when the stream ends.
+     * The tasks already sent to a worker are not moved, thus the farm
+     * adapts faster if the workers' queues are short (e.g. on-demand
+     * scheduling or bounded queues).
+     * It has no effect on farms with a feedback channel, with multiple
+     * inputs, with workers that are not sequential nodes, with the
+     * work-stealing scheduling or run with \p run_then_freeze.
+     *
+     * \param enable enables or disables the elastic behaviour
+     * \param minw min number of running workers
+     * \param target throughput (tasks per second) to be reached, 0 to
+     * maximise the efficiency
+     */
+    void set_elastic(bool enable=true, size_t minw=1, double target=0.0) {
+        elastic        = enable;
+        elastic_minw   = (minw>0) ? minw : 1;
+        elastic_target = target;
+    }
+
+    bool get_elastic() const { return elastic; }
+
     /**
      * \brief Gets the masterworker flags
      */
@@ -765,12 +959,18 @@ public:
             set_in_buffer(filter->get_in_buffer());
         }
 
-        gettimeofday(&wtstart,NULL);
-        if (!master_worker && (multi_input.size()==0) && (int_multi_input.size()==0)) {
+        FFTRACE_EVENT(ff_trace_ring *const tr = trace);
+        FFTRACE_EVENT(unsigned long long tt = ff_trace_now());
 
+        wtstart = ff_gettime();
+        if (!master_worker && (multi_input.size()==0) && (int_multi_input.size()==0)) {
+            elastic_start();
             do {
                 if (inpresent) {
-                    if (!skipfirstpop) pop(&task);
+                    if (!skipfirstpop) {
+                        pop(&task);
+                        FFTRACE_EVENT(tt = tr->record(FF_TRACE_RECV, tt));
+                    }
                     else skipfirstpop=false;
                     
                     if (task == EOS) {
@@ -796,7 +996,13 @@ public:
 #if defined(FF_TASK_CALLBACK)
                     callbackIn(this);
 #endif
+                    FFTRACE_EVENT(tt = ff_trace_now());
                     task = filter->svc(task);
+                    FFTRACE_EVENT(tt = tr->record(FF_TRACE_SVC, tt));
+#if defined(TRACE_FASTFLOW_EVENTS)
+                    if (inpresent && tr->qsample_due())
+                        tr->qsample(get_in_buffer()->length());
+#endif
 
 #if defined(TRACE_FASTFLOW)
                     ticks diff=(getticks()-t0);
@@ -831,10 +1037,13 @@ public:
                 
                 const bool r = schedule_task(task);
                 assert(r); (void)r;
+                FFTRACE_EVENT(tt = tr->record(FF_TRACE_SEND, tt));
 #if defined(FF_TASK_CALLBACK)
                 callbackOut(this);
 #endif
+                if (elastic_on) elastic_step();
             } while(true);
+            elastic_on = false;
         } else {
             bool local_blocking_in = blocking_in;
             size_t nw=0, nw_blk=0, nblk=0;                        
@@ -950,7 +1159,9 @@ public:
 #if defined(FF_TASK_CALLBACK)
                         callbackIn(this);
 #endif   
+                        FFTRACE_EVENT(tt = ff_trace_now());
                         task = filter->svc(task);
+                        FFTRACE_EVENT(tt = tr->record(FF_TRACE_SVC, tt));
 
 #if defined(TRACE_FASTFLOW)
                         ticks diff=(getticks()-t0);
@@ -983,13 +1194,14 @@ public:
                         }
                     }
                     schedule_task(task);
+                    FFTRACE_EVENT(tt = tr->record(FF_TRACE_SEND, tt));
 #if defined(FF_TASK_CALLBACK)
                     callbackOut(this);
 #endif   
                 }
             } while(1);
         }
-        gettimeofday(&wtstop,NULL);
+        wtstop = ff_gettime();
         wttime+=diffmsec(wtstop,wtstart);
 
         return ret;
@@ -1004,8 +1216,12 @@ public:
      *
      */
     virtual int svc_init() { 
-        gettimeofday(&tstart,NULL);
+        tstart = ff_gettime();
+        elastic_on = false;
 
+        register_wait_events();
+        numa_place();
+        FFTRACE_EVENT(if (!trace) trace = ff_tracer::instance()->newring("emitter", (int)tid));
         if (filter && filter->svc_init() <0) return -1;        
 
         return 0;
@@ -1019,7 +1235,7 @@ public:
      */
     virtual void svc_end() {
         if (filter) filter->svc_end();
-        gettimeofday(&tstop,NULL);
+        tstop = ff_gettime();
     }
 
     /**
@@ -1283,10 +1499,10 @@ public:
         return diffmsec(wtstop,wtstart);
     }
 
-    virtual const struct timeval & getstarttime() const { return tstart;}
-    virtual const struct timeval & getstoptime()  const { return tstop;}
-    virtual const struct timeval & getwstartime() const { return wtstart;}
-    virtual const struct timeval & getwstoptime() const { return wtstop;}
+    virtual ff_time_t getstarttime() const { return tstart;}
+    virtual ff_time_t getstoptime()  const { return tstop;}
+    virtual ff_time_t getwstartime() const { return wtstart;}
+    virtual ff_time_t getwstoptime() const { return wtstop;}
     
 #if defined(TRACE_FASTFLOW) 
     /**
@@ -1300,7 +1516,9 @@ public:
             << "  n. tasks      : " << taskcnt   << "\n"
             << "  svc ticks     : " << tickstot  << " (min= " << (filter?ticksmin:0) << " max= " << ticksmax << ")\n"
             << "  n. push lost  : " << pushwait  << " (ticks=" << lostpushticks << ")" << "\n"
-            << "  n. pop lost   : " << popwait   << " (ticks=" << lostpopticks  << ")" << "\n";
+            << "  n. pop lost   : " << popwait   << " (ticks=" << lostpopticks  << ")" << "\n"
+            << "  NUMA node     : " << numanode
+            << " (input channel on node " << (buffer ? buffer->numa_where() : -1) << ")\n";
     }
 
     virtual double getworktime() const { return wttime; }
@@ -1325,12 +1543,95 @@ private:
     size_t             multi_input_start;   // position in the availworkers array
     svector<ff_node*>  int_multi_input;
 
-    struct timeval tstart;
-    struct timeval tstop;
-    struct timeval wtstart;
-    struct timeval wtstop;
+    ff_time_t tstart;
+    ff_time_t tstop;
+    ff_time_t wtstart;
+    ff_time_t wtstop;
     double wttime;
 
+    // elastic farm (see set_elastic)
+#if defined(FF_ELASTIC)
+    bool               elastic = true;
+#else
+    bool               elastic = false;
+#endif
+    bool               elastic_on = false;  // the controller is active in this run
+    size_t             elastic_minw = 1;
+    double             elastic_target = 0.0;
+    ssize_t            elastic_maxw = 0;    // workers running when the run started
+    ff_time_t          elastic_t0;
+    ticks              elastic_ticks0 = 0;
+    std::vector<size_t> elastic_cnt;        // svc calls of each worker at elastic_t0
+    std::vector<ticks>  elastic_svc;        // ticks spent in svc by each worker at elastic_t0
+
+    inline void elastic_start() {
+        elastic_on = false;
+        // in run_then_freeze mode the thaws of the farm and of the controller would mix up
+        if (!elastic || running<2 || ff_thread::isfrozen()) return;
+        for(ssize_t i=0;i<running;++i)
+            if (workers[i]->getFFType()!=WORKER || workers[i]->wsgroup ||
+                !workers[i]->get_in_buffer()) return;
+        elastic_on   = true;
+        elastic_maxw = running;
+        elastic_cnt.assign(running, 0);
+        elastic_svc.assign(running, 0);
+        elastic_sample();
+    }
+
+    // takes the counters at the beginning of a period
+    inline void elastic_sample() {
+        elastic_t0     = ff_gettime();
+        elastic_ticks0 = getticks();
+        for(ssize_t i=0;i<elastic_maxw;++i) {
+            elastic_cnt[i] = __atomic_load_n(&workers[i]->svccnt, __ATOMIC_RELAXED);
+            elastic_svc[i] = __atomic_load_n(&workers[i]->svcticks, __ATOMIC_RELAXED);
+        }
+    }
+
+    inline void elastic_step() {
+        const double ms = diffmsec(ff_gettime(), elastic_t0);
+        if (ms < FF_ELASTIC_PERIOD_MS) return;
+        const double dt = (double)(getticks()-elastic_ticks0);
+        size_t done = 0, queued = (buffer ? buffer->length() : 0);
+        double util = 0.0;
+        for(ssize_t i=0;i<elastic_maxw;++i) {
+            done += __atomic_load_n(&workers[i]->svccnt, __ATOMIC_RELAXED) - elastic_cnt[i];
+            if (i<running) {
+                util   += (double)(__atomic_load_n(&workers[i]->svcticks, __ATOMIC_RELAXED) -
+                                   elastic_svc[i]) / dt;
+                queued += worker_load(i);  // we are the producer of the worker queue
+            }
+        }
+        const ssize_t n   = running;
+        const double  thr = (done*1000.0)/ms;
+        util /= n;
+        if (n<elastic_maxw && util>FF_ELASTIC_HIGH &&
+            ((elastic_target>0) ? (thr<elastic_target) : (queued>(size_t)n)))
+            elastic_unpark();
+        else if (n>(ssize_t)elastic_minw && !workers[n-1]->parking.load() &&
+                 (util*n/(n-1))<=FF_ELASTIC_HIGH &&
+                 ((util<FF_ELASTIC_LOW) || 
+                  ((elastic_target>0) && (thr*(n-1)/n)>=elastic_target)))
+            elastic_park();
+        elastic_sample();
+    }
+
+    // the last running worker gets no more tasks and freezes when its queue is empty,
+    // it can be parked again only once it has restarted (parking back to 0)
+    inline void elastic_park() {
+        const ssize_t w = running-1;
+        ++workers[w]->parking;
+        workers[w]->freeze();
+        ff_send_out_to(GO_OUT, (int)w);
+        running = w;
+    }
+
+    inline void elastic_unpark() {
+        const ssize_t w = running;
+        workers[w]->thaw();
+        running = w+1;
+    }
+
  protected:
 
     // for the input queue
@@ -1352,6 +1653,20 @@ private:
     bool               blocking_out;
     svector<bool>      blkvector;
 
+    // adaptive waiting policy
+    ff_wait_t          wait_policy;
+    ff_waiter          in_waiter;
+    ff_waiter          out_waiter;
+
+    // built-in scheduling policy
+    ff_sched_t         sched_policy;
+    unsigned           sched_seed;
+
+    int                numanode;            // NUMA node of the emitter thread
+
+#if defined(TRACE_FASTFLOW_EVENTS)
+    ff_trace_ring    * trace;
+#endif
 #if defined(TRACE_FASTFLOW)
     unsigned long taskcnt;
     ticks         lostpushticks;
@@ -5,6 +5,7 @@
 #include <type_traits>
 #include <utility>
 
+namespace ff {
 
 #if __cplusplus < 201400L   // to check
 // C++11 implementation of make_unique
@@ -36,5 +37,6 @@ using std::make_unique;// need to check if only the name is sufficient
 
 #endif
 
+} // namespace ff
 
 #endif // FF_MAKEUNIQUE_HPP
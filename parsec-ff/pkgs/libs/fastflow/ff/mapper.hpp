@@ -33,7 +33,9 @@
 #include <ff/svector.hpp>
 #include <ff/utils.hpp>
 #include <ff/mapping_utils.hpp>
+#include <ff/topology.hpp>
 #include <vector>
+#include <string.h>
 // #define ENABLE_FF_MAMMUT_MAPPING
 #ifdef ENABLE_FF_MAMMUT_MAPPING
 #include <mammut/mammut.hpp>
@@ -65,6 +67,23 @@ namespace ff {
  *  @{
  */
 
+/*
+ * Named mapping policies (see threadMapper::setMappingPolicy):
+ *  FF_MAPPING_LINEAR:  CPU ids in increasing order (the default)
+ *  FF_MAPPING_COMPACT: fill one physical core at a time (SMT siblings are
+ *                      used one after the other), then one socket at a time
+ *  FF_MAPPING_SCATTER: round-robin across the sockets, one thread per
+ *                      physical core before using the SMT siblings
+ *  FF_MAPPING_CORES:   one thread per physical core (socket by socket)
+ *                      before using the SMT siblings
+ *  FF_MAPPING_SOCKET:  fill one socket at a time (physical cores first,
+ *                      then their SMT siblings), so that threads started
+ *                      one after the other (e.g. emitter, workers and
+ *                      collector of a farm) stay on the same socket
+ */
+enum ff_mapping_t { FF_MAPPING_LINEAR=0, FF_MAPPING_COMPACT, FF_MAPPING_SCATTER,
+                    FF_MAPPING_CORES, FF_MAPPING_SOCKET };
+
 /*! 
  * \class threadMapper
  * \ingroup shared_memory_fastflow
@@ -128,8 +147,10 @@ public:
             }
         }
 #else
+		// the ids of the online CPUs (they may have gaps)
+		const std::vector<ff_cpu_t> &cpus = ff_topology::instance().getCpus();
 		for (int i = 0; i < nc; ++i)
-			CList.push_back(i);
+			CList.push_back((size_t)i < cpus.size() ? cpus[i].id : i);
 #endif
 		for (unsigned int i = nc, j = 0; i < size; ++i, j++)
 			CList.push_back(j);
@@ -139,6 +160,10 @@ public:
 
 		rrcnt = 0;
 
+		// the mapping policy can be selected without recompiling
+		const char *policy = getenv("FF_MAPPING_POLICY");
+		if (policy) setMappingPolicy(policy);
+
 #if 0
 		const int max_supported_platforms = 10;
 		const int max_supported_devices = 10;
@@ -204,7 +229,7 @@ public:
 				error("setMapping, invalid mapping string\n");
 				return;
 			}
-			if (cpuid > (num_cores - 1)) {
+			if (!checkCPUId((int)cpuid)) {
 				error("setMapping, invalid cpu id in the mapping string\n");
 				return;
 			}
@@ -236,8 +261,8 @@ public:
 		svector<int> List(mask + 1);
         for (size_t i=0; i<mapping.size(); ++i) {
 			auto cpuid = mapping[i];
-            if (cpuid > (num_cores - 1)) {
-				error("setMapping, invalid cpu id in the mapping string\n");
+            if (!checkCPUId((int)cpuid)) {
+				error("setMapping, invalid cpu id in the mapping list\n");
 				return;
             }
             List.push_back(cpuid);
@@ -254,7 +279,61 @@ public:
 		CList = List;
 	}
 
-    
+    /**
+     * It sets the mapping list according to one of the named policies
+     * (see \p ff_mapping_t), computed on the topology of the machine read
+     * from sysfs (see \ref topology.hpp).
+     *
+     * \return false if the policy is not valid.
+     */
+    bool setMappingPolicy(ff_mapping_t policy) {
+        const std::vector<ff_cpu_t> &cpus = ff_topology::instance().getCpus();
+        if (cpus.empty()) return false;
+
+        // rank of each physical core within its socket
+        std::vector<int> rank(ff_topology::instance().numCores(), -1);
+        std::vector<int> ncs(ff_topology::instance().numSockets(), 0);
+        for(size_t i=0;i<cpus.size();++i)
+            if (rank[cpus[i].core] < 0) rank[cpus[i].core] = ncs[cpus[i].socket]++;
+
+        // sort keys, from the most significant to the least significant one
+        std::vector<std::pair<std::vector<int>, size_t> > keys;
+        for(size_t i=0;i<cpus.size();++i) {
+            const ff_cpu_t &c = cpus[i];
+            std::vector<int> k(3);
+            switch(policy) {
+            case FF_MAPPING_LINEAR:  k[0]=c.id;     k[1]=0;            k[2]=0;        break;
+            case FF_MAPPING_COMPACT: k[0]=c.socket; k[1]=rank[c.core]; k[2]=c.smt;    break;
+            case FF_MAPPING_SCATTER: k[0]=c.smt;    k[1]=rank[c.core]; k[2]=c.socket; break;
+            case FF_MAPPING_CORES:   k[0]=c.smt;    k[1]=c.socket;     k[2]=rank[c.core]; break;
+            case FF_MAPPING_SOCKET:  k[0]=c.socket; k[1]=c.smt;        k[2]=rank[c.core]; break;
+            default: error("setMappingPolicy, invalid policy\n"); return false;
+            }
+            keys.push_back(std::make_pair(k, (size_t)c.id));
+        }
+        std::sort(keys.begin(), keys.end());
+
+        std::vector<size_t> mapping;
+        for(size_t i=0;i<keys.size();++i) mapping.push_back(keys[i].second);
+        setMappingList(mapping);
+        return true;
+    }
+
+    /**
+     * It sets the mapping policy by name: "linear", "compact", "scatter",
+     * "cores" or "socket". It is also used to read the environment variable
+     * \p FF_MAPPING_POLICY when the threadMapper is created.
+     *
+     * \return false if the name is not valid.
+     */
+    bool setMappingPolicy(const char *name) {
+        static const char *names[] = { "linear", "compact", "scatter", "cores", "socket" };
+        for(int i=0;i<(int)(sizeof(names)/sizeof(names[0]));++i)
+            if (strcmp(name, names[i]) == 0) return setMappingPolicy((ff_mapping_t)i);
+        error("setMappingPolicy, unknown policy %s\n", name);
+        return false;
+    }
+
 	/**
 	 *  Returns the next CPU id using a round-robin mapping access on the
 	 *  mapping list. This is clearly a raound robind scheduling!
@@ -300,13 +379,13 @@ public:
 	}
 
 	/**
-	 * It checks whether the taken core is within the range of the cores
-	 * available on the machine.
+	 * It checks whether the taken core is one of the online CPUs of the
+	 * machine (their ids may have gaps, e.g. offlined cores or cpusets).
 	 *
 	 * \return It will return either \p true of \p false.
 	 */
 	inline bool checkCPUId(const int cpuId) const {
-		return ((unsigned) cpuId < num_cores);
+		return (cpuId >= 0) && (ff_topology::instance().getCpu(cpuId) != NULL);
 	}
 
 #if defined(FF_CUDA) 
@@ -45,6 +45,7 @@
 #include <errno.h>
 #include <ff/config.hpp>
 #include <ff/utils.hpp>
+#include <ff/topology.hpp>
 #if defined(__linux__)
 #include <sched.h>
 #include <sys/types.h>
@@ -135,6 +136,25 @@ static inline unsigned long ff_getCpuFreq() {
     return (t);
 }
 
+/** 
+ *  \brief Returnes the maximum frequency of the CPU
+ *
+ *  Differently from \p ff_getCpuFreq, which returns the current frequency
+ *  (that changes with the frequency scaling), it returns the nominal maximum
+ *  frequency of the CPUs as given by cpufreq. If it is not available, the
+ *  current frequency is returned.
+ *  
+ *  \return An integer value showing the maximum frequency of the core.
+ */
+static inline unsigned long ff_getCpuMaxFreq() {
+#if defined(__linux__)
+    int khz;
+    if (ff::ff_topology::read_int(FF_SYSFS_ROOT "/cpu/cpu0/cpufreq/cpuinfo_max_freq", khz))
+        return ((unsigned long)khz * 1000);
+#endif
+    return ff_getCpuFreq();
+}
+
 /**
  *  \brief Returns the number of cores in the system
  *
@@ -147,10 +167,7 @@ static inline unsigned long ff_getCpuFreq() {
 static inline ssize_t ff_numCores() {
     ssize_t  n=-1;
 #if defined(__linux__)
-    FILE       *f;    
-    f = popen("cat /proc/cpuinfo |grep processor | wc -l", "r");
-    if (fscanf(f, "%ld", &n) == EOF) { pclose(f); return n;}
-    pclose(f);
+    n = ff::ff_topology::instance().numCpus();
 #elif defined(__APPLE__) // BSD
     int nn;
     size_t len = sizeof(nn);
@@ -180,10 +197,10 @@ static inline ssize_t ff_realNumCores() {
     ssize_t  n=-1;
 #if defined(_WIN32)
 	n = 2; // Not yet implemented
+#elif defined(__linux__)
+    n = ff::ff_topology::instance().numCores();
 #else
-#if defined(__linux__)
-    char inspect[]="cat /proc/cpuinfo|egrep 'core id|physical id'|tr -d '\n'|sed 's/physical/\\nphysical/g'|grep -v ^$|sort|uniq|wc -l";
-#elif defined (__APPLE__)
+#if defined (__APPLE__)
     char inspect[]="sysctl hw.physicalcpu | awk '{print $2}'";
 #else 
     char inspect[]="";
@@ -213,10 +230,10 @@ static inline ssize_t ff_numSockets() {
    ssize_t  n=-1;
 #if defined(_WIN32)
    n = 1;
+#elif defined(__linux__)
+    n = ff::ff_topology::instance().numSockets();
 #else
-#if defined(__linux__)
-    char inspect[]="cat /proc/cpuinfo|grep 'physical id'|sort|uniq|wc -l";
-#elif defined (__APPLE__)
+#if defined (__APPLE__)
     char inspect[]="sysctl hw.packages | awk '{print $2}'";
 #else 
     char inspect[]="";
@@ -235,6 +252,27 @@ static inline ssize_t ff_numSockets() {
     return n;
 }
 
+/**
+ *  \brief Returns the number of NUMA nodes of the system.
+ *
+ *  It returns the number of NUMA nodes having at least one CPU. It works on
+ *  Linux OS (1 is returned on the other platforms).
+ *
+ *  \return An integer value showing the number of NUMA nodes.
+ */
+static inline ssize_t ff_numNUMANodes() {
+    return ff::ff_topology::instance().numNodes();
+}
+
+/**
+ *  \brief Returns the NUMA node of the given CPU.
+ *
+ *  \return The NUMA node of the CPU \p cpu_id, -1 if it is not known.
+ */
+static inline ssize_t ff_getNUMANode(int cpu_id) {
+    return ff::ff_topology::instance().nodeOf(cpu_id);
+}
+
 
 /**
  * \brief Sets the scheduling priority
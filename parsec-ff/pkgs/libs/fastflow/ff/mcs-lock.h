@@ -0,0 +1,165 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/*!
+ *  \file mcs-lock.h
+ *  \ingroup building_blocks
+ *
+ *  \brief MCS queue lock usable from both C and C++ code
+ *
+ *  J. M. Mellor-Crummey and M. L. Scott, "Algorithms for scalable
+ *  synchronization on shared-memory multiprocessors", ACM TOCS 1991.
+ *
+ *  The waiting threads form a FIFO queue; each one spins on a flag in its
+ *  own queue node, which is a cache line of the thread-local storage (thus
+ *  allocated on the NUMA node of the thread), and the lock is handed off by
+ *  writing only the flag of the successor. As a consequence the traffic on
+ *  the interconnect does not grow with the number of waiting threads, as it
+ *  happens with test-and-set locks.
+ *
+ *  The interface is the one of \p pthread_mutex_t (the lock must be released
+ *  by the same thread that acquired it), so it can replace the mutexes used
+ *  as fine-grain locks (e.g. one per hash bucket). The lock itself is two
+ *  pointers. A thread can hold at most \p FF_MCS_MAXHELD MCS locks at the
+ *  same time. A waiting thread, and a releasing thread waiting for its
+ *  successor to link itself, yields the CPU every \p FF_MCS_SPINS spins, so
+ *  that a preempted peer can make progress when there are more threads than
+ *  cores. Even so, each hand-off to a waiter that is not running costs a
+ *  context switch: with more threads than cores a mutex is usually faster.
+ *
+ *  From C++ code the lock can be used as the other FastFlow spin-locks by
+ *  means of the \p mcs_lock_t type defined in spin-lock.hpp.
+ */
+
+/* ***************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License version 3 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ *  License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ ****************************************************************************
+ */
+
+#ifndef FF_MCS_LOCK_H
+#define FF_MCS_LOCK_H
+
+#include <stddef.h>
+#include <stdlib.h>
+#include <sched.h>
+
+// max n. of MCS locks held at the same time by one thread
+#if !defined(FF_MCS_MAXHELD)
+#define FF_MCS_MAXHELD 8
+#endif
+// spins before yielding the CPU while waiting
+#if !defined(FF_MCS_SPINS)
+#define FF_MCS_SPINS 128
+#endif
+
+#if defined(__i386__) || defined(__x86_64__)
+#define FF_MCS_PAUSE() __asm__ __volatile__ ("rep; nop" : : : "memory")
+#else
+#define FF_MCS_PAUSE() __asm__ __volatile__ ("" : : : "memory")
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct ff_mcs_node {
+    struct ff_mcs_node *next;    /* successor in the queue */
+    int                 locked;  /* 1 while waiting */
+    int                 busy;    /* the node is in use by the thread */
+} __attribute__((aligned(64))) ff_mcs_node_t;
+
+typedef struct {
+    ff_mcs_node_t *tail;         /* last thread in the queue, NULL if free */
+    ff_mcs_node_t *holder;       /* node of the owner (written by the owner only) */
+} ff_mcs_lock_t;
+
+/* queue nodes of the calling thread */
+static __thread ff_mcs_node_t ff_mcs_nodes[FF_MCS_MAXHELD];
+
+static inline ff_mcs_node_t *ff_mcs_getnode(void) {
+    int i;
+    for(i=0;i<FF_MCS_MAXHELD;++i)
+        if (!ff_mcs_nodes[i].busy) {
+            ff_mcs_nodes[i].busy = 1;
+            return &ff_mcs_nodes[i];
+        }
+    abort();  /* too many MCS locks held, increase FF_MCS_MAXHELD */
+    return NULL;
+}
+
+static inline int ff_mcs_init(ff_mcs_lock_t *l) {
+    l->tail = NULL, l->holder = NULL;
+    return 0;
+}
+static inline int ff_mcs_destroy(ff_mcs_lock_t *l) {
+    return (l->tail != NULL) ? -1 : 0;
+}
+
+static inline int ff_mcs_lock(ff_mcs_lock_t *l) {
+    ff_mcs_node_t *me = ff_mcs_getnode(), *pred;
+    me->next = NULL, me->locked = 1;
+    pred = __atomic_exchange_n(&l->tail, me, __ATOMIC_ACQ_REL);
+    if (pred) {
+        unsigned spins = 0;
+        __atomic_store_n(&pred->next, me, __ATOMIC_RELEASE);
+        while(__atomic_load_n(&me->locked, __ATOMIC_ACQUIRE)) {
+            if (++spins == FF_MCS_SPINS) { spins = 0; sched_yield(); }
+            else FF_MCS_PAUSE();
+        }
+    }
+    l->holder = me;
+    return 0;
+}
+
+/* 0 if the lock has been acquired, -1 if it is busy */
+static inline int ff_mcs_trylock(ff_mcs_lock_t *l) {
+    ff_mcs_node_t *me = ff_mcs_getnode(), *expected = NULL;
+    me->next = NULL, me->locked = 0;
+    if (!__atomic_compare_exchange_n(&l->tail, &expected, me, 0,
+                                     __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+        me->busy = 0;
+        return -1;
+    }
+    l->holder = me;
+    return 0;
+}
+
+static inline int ff_mcs_unlock(ff_mcs_lock_t *l) {
+    ff_mcs_node_t *me = l->holder, *next;
+    unsigned spins = 0;
+    next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE);
+    if (!next) {
+        ff_mcs_node_t *expected = me;
+        if (__atomic_compare_exchange_n(&l->tail, &expected, (ff_mcs_node_t*)NULL, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            me->busy = 0;
+            return 0;
+        }
+        /* a successor is enqueueing itself (it may have been preempted) */
+        while((next = __atomic_load_n(&me->next, __ATOMIC_ACQUIRE)) == NULL) {
+            if (++spins == FF_MCS_SPINS) { spins = 0; sched_yield(); }
+            else FF_MCS_PAUSE();
+        }
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+    me->busy = 0;
+    return 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FF_MCS_LOCK_H */
@@ -35,6 +35,7 @@
 
 #include <cstdlib>
 #include <vector>
+#include <new>
 #include <ff/buffer.hpp>
 #include <ff/sysdep.h>
 #include <ff/allocator.hpp>
@@ -91,7 +92,9 @@ namespace ff {
  * \class MPMC_Ptr_Queue
  *  \ingroup aux_classes
  *
- * \brief An implementation of the \a bounded Multi-Producer/Multi-Consumer queue. Not currently used.
+ * \brief An implementation of the \a bounded Multi-Producer/Multi-Consumer queue.
+ *
+ * It is used by the input channel of the farm without Emitter (see \ref mpmcchannel.hpp).
  *
  * This class describes an implementation of the MPMC queue inspired by the solution
  * proposed by <a href="https://sites.google.com/site/1024cores/home/lock-free-algorithms/queues/bounded-mpmc-queue" target="_blank">Dmitry Vyukov</a>. \n
@@ -114,7 +117,7 @@ public:
     /*
      * \brief Constructor
      */
-    MPMC_Ptr_Queue() {}
+    MPMC_Ptr_Queue():buf(NULL),mask(0) {}
     
     /*
      * \brief Destructor
@@ -232,6 +235,21 @@ public:
         node->seq.store((pr+mask+1), std::memory_order_release);
         return true;
     }
+
+    /**
+     * \brief number of slots
+     */
+    inline size_t buffersize() const { return mask+1; }
+
+    /**
+     * \brief number of elements (approximated if there are concurrent accesses)
+     *
+     * The elements being pushed are counted as well.
+     */
+    inline size_t length() const {
+        const unsigned long pr = pread.load();
+        return pwrite.load() - pr;
+    }
     
 private:
     union {
@@ -262,7 +280,7 @@ public:
     /**
      *  \brief Constructor
      */
-    MPMC_Ptr_Queue() {}
+    MPMC_Ptr_Queue():buf(NULL),mask(0) {}
 
     /**
      *
@@ -372,6 +390,21 @@ public:
         atomic_long_set(&node->seq,(pr+mask+1));
         return true;
     }
+
+    /**
+     * \brief number of slots
+     */
+    inline size_t buffersize() const { return mask+1; }
+
+    /**
+     * \brief number of elements (approximated if there are concurrent accesses)
+     *
+     * The elements being pushed are counted as well.
+     */
+    inline size_t length() {
+        const unsigned long pr = atomic_long_read(&pread);
+        return (unsigned long)atomic_long_read(&pwrite) - pr;
+    }
     
 private:
     // WARNING: on 64bit Windows platform sizeof(unsigned long) = 32 !!
@@ -425,7 +458,11 @@ public:
     ~uMPMC_Ptr_Queue() {
         if (buf) {
             for(size_t i=0;i<(mask+1);++i) {
-                if (buf[i]) delete (uSWSR_Ptr_Buffer*)(buf[i]);
+                if (buf[i]) {
+                    uSWSR_Ptr_Buffer *b = (uSWSR_Ptr_Buffer*)(buf[i]);
+                    b->~uSWSR_Ptr_Buffer();
+                    freeAlignedMemory(b);
+                }
             }
             freeAlignedMemory(buf);
             buf = NULL;
@@ -447,7 +484,8 @@ public:
         seqC=(sequenceP_t*)getAlignedMemory(longxCacheLine*sizeof(long),nqueues*sizeof(sequenceC_t));
 
         for(size_t i=0;i<nqueues;++i) {
-            buf[i]= new uSWSR_Ptr_Buffer(size);
+            // the buffers are cache-line aligned, plain new does not guarantee it
+            buf[i]= new (getAlignedMemory(CACHE_LINE_SIZE,sizeof(uSWSR_Ptr_Buffer))) uSWSR_Ptr_Buffer(size);
             ((uSWSR_Ptr_Buffer*)(buf[i]))->init();
             atomic_long_set(&(seqP[i]),long(i));
             atomic_long_set(&(seqC[i]),long(i));
@@ -654,7 +692,8 @@ public:
     
     ~MSqueue() {
         if (delayedAllocator)  {
-            delete delayedAllocator;
+            delayedAllocator->~FFAllocator();
+            freeAlignedMemory(delayedAllocator);
             delayedAllocator = NULL;
         }
     }
@@ -668,7 +707,9 @@ public:
     /** initialize the MSqueue */
     int init() {
         if (delayedAllocator) return 0;
-        delayedAllocator = new FFAllocator(2); 
+        // FFAllocator is cache-line aligned, plain new does not guarantee it
+        void *p = getAlignedMemory(CACHE_LINE_SIZE,sizeof(FFAllocator));
+        delayedAllocator = p ? new (p) FFAllocator(2) : NULL;
         if (!delayedAllocator) {
             error("MSqueue::init, cannot allocate FFAllocator\n");
             return -1;
@@ -757,18 +798,24 @@ protected:
     enum {DEFAULT_NUM_QUEUES=4, DEFAULT_uSPSC_SIZE=2048};
 
 public:
-    multiSWSR() {}
+    multiSWSR():buf(NULL),PLock(NULL),CLock(NULL),mask(0) {}
     
     ~multiSWSR() {
         if (buf) {
             for(size_t i=0;i<(mask+1);++i) {
-                if (buf[i]) delete buf[i];
+                if (buf[i]) { buf[i]->~uSWSR_Ptr_Buffer(); freeAlignedMemory(buf[i]); }
             }
             freeAlignedMemory(buf);
             buf = NULL;
         }
-        if (PLock) freeAlignedMemory(PLock);        
-        if (CLock) freeAlignedMemory(CLock);
+        if (PLock) {
+            for(size_t i=0;i<(mask+1);++i) PLock[i].~CLHSpinLock();
+            freeAlignedMemory(PLock);
+        }
+        if (CLock) {
+            for(size_t i=0;i<(mask+1);++i) CLock[i].~CLHSpinLock();
+            freeAlignedMemory(CLock);
+        }
     }
 
     inline bool init(unsigned long nqueues=DEFAULT_NUM_QUEUES, size_t size=DEFAULT_uSPSC_SIZE) {
@@ -781,8 +828,11 @@ public:
         CLock=(CLHSpinLock*)getAlignedMemory(CACHE_LINE_SIZE,nqueues*sizeof(CLHSpinLock));
 
         for(size_t i=0;i<nqueues;++i) {
-            buf[i]= new uSWSR_Ptr_Buffer(size);
+            buf[i]= new (getAlignedMemory(CACHE_LINE_SIZE,sizeof(uSWSR_Ptr_Buffer))) uSWSR_Ptr_Buffer(size);
             buf[i]->init();
+            // the locks live in raw aligned memory, they have to be constructed
+            new (&PLock[i]) CLHSpinLock();
+            new (&CLock[i]) CLHSpinLock();
             PLock[i].init();
             CLock[i].init();
         }
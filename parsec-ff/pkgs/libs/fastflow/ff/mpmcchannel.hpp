@@ -0,0 +1,130 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/*!
+ *  \file mpmcchannel.hpp
+ *  \ingroup building_blocks
+ *
+ *  \brief Bounded channel shared by many producers and many consumers
+ *
+ *  It is the input channel of a farm without the Emitter (see
+ *  \p ff_farm::remove_emitter): the producers (the threads calling
+ *  \p offload or the previous pipeline stage) push the tasks directly into
+ *  the channel and the workers pull them, so that each task pays one queue
+ *  hop and no thread is spent for scheduling. The queue is the bounded
+ *  MPMC queue by D. Vyukov (\p MPMC_Ptr_Queue).
+ */
+
+/* ***************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License version 3 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ *  License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ ****************************************************************************
+ */
+
+#ifndef FF_MPMCCHANNEL_HPP
+#define FF_MPMCCHANNEL_HPP
+
+#include <atomic>
+#include <ff/config.hpp>
+#include <ff/waitpolicy.hpp>
+#include <ff/mpmc/MPMCqueues.hpp>
+
+namespace ff {
+
+/*!
+ * \class ff_mpmc_channel
+ * \ingroup building_blocks
+ *
+ * \brief Bounded MPMC channel with sleeping producers and consumers.
+ *
+ * \p push and \p pop never block; when they fail the caller either spins
+ * or sleeps with \p wait_push / \p wait_pop, which return as soon as a
+ * peer has popped / pushed something. The End-Of-Stream (EOS, EOSW,
+ * EOS_NOFREEZE) enters the channel when all the \p nproducers producers
+ * have sent it, and it is received by each of the \p nconsumers consumers:
+ * the consumer that pops it puts it back until all the consumers have had
+ * it, thus it must be the last message pushed.
+ */
+class ff_mpmc_channel {
+public:
+    ff_mpmc_channel():nproducers(1),nconsumers(1) { eosin.store(0); eoscnt.store(0); }
+
+    /// \p size is rounded up to a power of 2
+    inline bool init(size_t size) { return q.init(size); }
+
+    inline void set_producers(size_t n) { nproducers = (n>0) ? n : 1; }
+    inline void set_consumers(size_t n) { nconsumers = (n>0) ? n : 1; }
+    inline size_t get_producers() const { return nproducers; }
+    inline size_t get_consumers() const { return nconsumers; }
+
+    inline size_t buffersize() const { return q.buffersize(); }
+    inline size_t length()           { return q.length(); }
+    inline bool   empty()            { return q.length()==0; }
+
+    inline bool push(void * const task) {
+        if ((size_t)task >= FF_EOSW && nproducers>1) {
+            // only the last EOS is pushed, it waits here if the channel is full
+            if (eosin.fetch_add(1)+1 < nproducers) return true;
+            eosin.store(0);
+            while(!q.push(task)) wait_push();
+            cons_ev.notify();
+            return true;
+        }
+        if (!q.push(task)) return false;
+        cons_ev.notify();
+        return true;
+    }
+
+    inline bool pop(void ** task) {
+        if (!q.pop(task)) return false;
+        if ((size_t)*task >= FF_EOSW) {
+            if (eoscnt.fetch_add(1)+1 < nconsumers) {
+                // the slot just freed is there, unless a producer does not respect the EOS
+                while(!q.push(*task)) PAUSE();
+                cons_ev.notify();
+                return true;
+            }
+            eoscnt.store(0);
+        }
+        prod_ev.notify();
+        return true;
+    }
+
+    /// sleeps until the channel is not full (or for FF_ADAPTIVE_SLEEP_US at most)
+    inline void wait_push() {
+        const unsigned s = prod_ev.prepare_wait();
+        if (length() >= buffersize()) prod_ev.commit_wait(s, FF_ADAPTIVE_SLEEP_US);
+        else prod_ev.cancel_wait();
+    }
+
+    /// sleeps until the channel is not empty (or for FF_ADAPTIVE_SLEEP_US at most)
+    inline void wait_pop() {
+        const unsigned s = cons_ev.prepare_wait();
+        if (empty()) cons_ev.commit_wait(s, FF_ADAPTIVE_SLEEP_US);
+        else cons_ev.cancel_wait();
+    }
+
+protected:
+    MPMC_Ptr_Queue      q;
+    size_t              nproducers;
+    size_t              nconsumers;
+    std::atomic<size_t> eosin;    // producers that have sent the EOS
+    std::atomic<size_t> eoscnt;   // consumers that have received the current EOS
+    ff_event            cons_ev;  // sleeping consumers
+    ff_event            prod_ev;  // sleeping producers
+};
+
+} // namespace ff
+
+#endif /* FF_MPMCCHANNEL_HPP */
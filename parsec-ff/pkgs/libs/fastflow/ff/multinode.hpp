@@ -53,7 +53,9 @@ namespace ff {
  *
  * \brief Multiple input ff_node (the SPMC mediator)
  *
- * The ff_node with many input channels.
+ * The ff_node with many input channels. When it follows a farm without
+ * collector it pops directly from the SWSR output buffers of the workers,
+ * the gathering is done by the node's own thread.
  *
  * This class is defined in \ref farm.hpp
  */
@@ -204,6 +206,14 @@ public:
      */
     ssize_t get_channel_id() const { return gt->get_channel_id();}
 
+    /**
+     * \brief Sets the waiting policy of the node (it is run by the gatherer thread)
+     */
+    void set_wait_policy(ff_wait_t p) {
+        ff_node::set_wait_policy(p);
+        gt->set_wait_policy(p);
+    }
+
     /**
      * \internal
      * \brief Gets the gt
@@ -385,6 +395,14 @@ public:
         return run(true);
     }
 
+    /**
+     * \brief Sets the waiting policy of the node (it is run by the load-balancer thread)
+     */
+    void set_wait_policy(ff_wait_t p) {
+        ff_node::set_wait_policy(p);
+        lb->set_wait_policy(p);
+    }
+
     /**
      * \internal
      * \brief Gets the internal lb (Emitter)
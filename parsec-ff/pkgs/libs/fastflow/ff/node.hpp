@@ -44,6 +44,13 @@
 #include <ff/config.hpp>
 #include <ff/svector.hpp>
 #include <ff/barrier.hpp>
+#include <ff/waitpolicy.hpp>
+#include <ff/budget.hpp>
+#include <ff/wsdeque.hpp>
+#include <ff/mpmcchannel.hpp>
+#if defined(TRACE_FASTFLOW_EVENTS)
+#include <ff/trace.hpp>
+#endif
 #include <atomic>
 
 static void *GO_ON        = (void*)ff::FF_GO_ON;
@@ -436,6 +443,8 @@ private:
     friend class ff_loadbalancer;
     friend class ff_gatherer;
     friend class ff_ofarm;
+    friend class ff_seqfarm;
+    friend class ff_comb;
 
 private:
     FFBUFFER        * in;           ///< Input buffer, built upon SWSR lock-free (wait-free) 
@@ -454,27 +463,131 @@ private:
 
     ff_thread       * thread;       /// A \p thWorker object, which extends the \p ff_thread class 
     bool (*callback)(void *,unsigned long,unsigned long, void *);
+    bool (*callback_batch)(void **,size_t,unsigned long,unsigned long, void *);
     void            * callback_arg;
+    void           ** inbatch;      /// local input batch (see set_input_batch)
+    size_t            inbatch_size;
+    size_t            inbatch_pos;
+    size_t            inbatch_cnt;
+    ff_wsgroup      * wsgroup;      /// work-stealing farm the node belongs to (if any)
+    size_t            wsid;
+    void            * ws_ctrl;      /// pending control message (work-stealing mode)
+    unsigned          ws_seed;
+    ff_mpmc_channel * mpmc_in;      /// shared input channel (farm without Emitter), replaces in
+    ff_mpmc_channel * mpmc_out;     /// shared output channel, replaces out
+    const size_t    * budgetlease;  /// lease of the farm the worker belongs to (see budget.hpp)
     BARRIER_T       * barrier;      /// A \p Barrier object
-    struct timeval tstart;
-    struct timeval tstop;
-    struct timeval wtstart;
-    struct timeval wtstop;
+    ff_time_t tstart;
+    ff_time_t tstop;
+    ff_time_t wtstart;
+    ff_time_t wtstop;
     double wttime;
+    ticks  wtticks;               /// ticks elapsed in the svc loop (to calibrate svcticks)
+    ticks  svcticks;              /// ticks spent in svc
+    ticks  waitticks;             /// ticks spent waiting for room in the output channel
+    size_t svccnt;                /// number of svc calls
+    std::atomic<unsigned> parking; /// pending parkings (elastic farm, see lb.hpp)
 
 protected:    
     bool               blocking_in; 
     bool               blocking_out;
+    ff_wait_t          wait_policy;
+    int                numanode;     // NUMA node of the thread running the node
 protected:
     
     void set_id(ssize_t id) { myid = id;}
     
-    virtual inline bool push(void * ptr) { return out->push(ptr); }
+    virtual inline bool push(void * ptr) { 
+        if (!out->push(ptr)) return false;
+        ff_wakeup_consumer(out);
+        return true;
+    }
     virtual inline bool pop(void ** ptr) { 
         if (!in_active) return false; // it does not want to receive data
-        return in->pop(ptr);
+        if (wsgroup) { size_t drained; return ws_pop(ptr, drained, true); }
+        if (inbatch) {
+            if (inbatch_pos == inbatch_cnt && !refill_inbatch()) return false;
+            *ptr = inbatch[inbatch_pos++];
+            return true;
+        }
+        if (!in->pop(ptr)) return false;
+        ff_wakeup_producer(in);
+        return true;
+    }
+    /* 
+     * Work-stealing mode (see wsdeque.hpp): the whole content of the input
+     * channel is moved into the node deque (so that peers can steal it) and
+     * tasks are taken from the deque head. When there is nothing left, a 
+     * task is stolen from a peer. The pending control message (if any) is
+     * returned only when there is nothing to steal, and if \p waitpeers is
+     * true only when all the peers are idle, so that a node does not exit
+     * while its peers are still busy. \p drained is set to the number of 
+     * messages removed from the input channel.
+     */
+    inline bool ws_pop(void ** ptr, size_t &drained, const bool waitpeers) {
+        ff_wsdeque *const own = wsgroup->get(wsid);
+        drained = 0;
+        while(!ws_ctrl) {
+            void * tmp[FF_WS_BATCH];
+            size_t n = 0;
+            while((n<FF_WS_BATCH) && in->pop(&tmp[n])) {
+                if ((size_t)tmp[n] >= FF_NBLK) { // control messages cannot be stolen
+                    ws_ctrl = tmp[n];
+                    ++drained;
+                    break;
+                }
+                ++n;
+            }
+            drained += n;
+            if (n) {
+                if (!own->push(tmp, n)) {
+                    error("NODE, work-stealing deque allocation failed\n");
+                    abort();
+                }
+                own->queued(-(long)n);
+                wsgroup->wakeup(wsid);  // peers sleeping in blocking mode can steal
+            }
+            if (n<FF_WS_BATCH) break;
+        }
+        if (drained) ff_wakeup_producer(in);
+        if (own->pop(ptr)) return true;
+        if (wsgroup->steal(wsid, ptr, ws_seed)) return true;
+        if (ws_ctrl && !(waitpeers && wsgroup->busy(wsid))) { 
+            *ptr = ws_ctrl; ws_ctrl = NULL; 
+            return true; 
+        }
+        return false;
+    }
+    /* the node takes part to work-stealing with id \p id */
+    inline void set_wsgroup(ff_wsgroup *g, size_t id) {
+        wsgroup = g; wsid = id; ws_ctrl = NULL; ws_seed = (unsigned)id+1;
+        g->set_sleeper(id, &cons_m, &cons_c);
+    }
+    /* pops a new batch of tasks from the input channel */
+    inline size_t refill_inbatch() {
+        inbatch_pos = 0;
+        inbatch_cnt = in->pop_batch(inbatch, inbatch_size);
+        if (inbatch_cnt) ff_wakeup_producer(in);
+        return inbatch_cnt;
+    }
+    /* pushes up to n tasks onto the output channel, returns how many have been pushed */
+    virtual inline size_t push_batch(void ** ptrs, size_t n) {
+        const size_t k = out->push_batch(ptrs, n);
+        if (k) ff_wakeup_consumer(out);
+        return k;
     }
     virtual inline bool Push(void *ptr, unsigned long retry=((unsigned long)-1), unsigned long ticks=(TICKS2WAIT)) {
+        if (mpmc_out) {
+            for(unsigned long i=0;i<retry;++i) {
+                if (mpmc_out->push(ptr)) return true;
+                if (blocking_out) {
+                    const auto w0 = getticks();
+                    mpmc_out->wait_push();
+                    waitticks += getticks()-w0;
+                } else losetime_out(ticks);
+            }
+            return false;
+        }
         if (blocking_out) {
         retry:
             bool r = push(ptr);
@@ -488,43 +601,71 @@ protected:
                 ++prod_counter;
             } else { // FULL
                 //assert(fixedsize);
+                const auto w0 = getticks();
                 pthread_mutex_lock(&prod_m);
                 while(prod_counter.load() >= out->buffersize()) {
                     pthread_cond_wait(&prod_c,&prod_m);
                 }
                 pthread_mutex_unlock(&prod_m);
+                waitticks += getticks()-w0;
                 goto retry;
             }
             return true;
         }
         for(unsigned long i=0;i<retry;++i) {
-            if (push(ptr)) return true;
+            if (push(ptr)) { out_waiter.done(); return true; }
             losetime_out(ticks);
         }     
         return false;
     }
     
     virtual inline bool Pop(void **ptr, unsigned long retry=((unsigned long)-1), unsigned long ticks=(TICKS2WAIT)) {    
+        if (mpmc_in) {
+            for(unsigned long i=0;i<retry;++i) {
+                if (!in_active) { *ptr=NULL; return false; }
+                if (mpmc_in->pop(ptr)) return true;
+                if (blocking_in) mpmc_in->wait_pop();
+                else losetime_in(ticks);
+            }
+            return false;
+        }
         if (blocking_in) {
             if (!in_active) { *ptr=NULL; return false; }
+            // the counters have already been updated for the whole batch
+            if (inbatch && (inbatch_pos < inbatch_cnt)) { 
+                *ptr = inbatch[inbatch_pos++]; 
+                return true; 
+            }
         retry:
-            bool r = in->pop(ptr);
-            if (r) { // OK
+            size_t k = 0; // number of messages removed from the input channel
+            bool r;
+            if (wsgroup) r = ws_pop(ptr, k, false);
+            else if (inbatch) {
+                r = ((k = refill_inbatch()) > 0);
+                if (r) *ptr = inbatch[inbatch_pos++];
+            } else if ((r = in->pop(ptr))) k = 1;
+            if (k) {
                 // TODO: possible optimization, p_prod_m is NULL if the queue is unbounded
                 //if (p_prod_m) { // this is true only if fixedsize==true
                 pthread_mutex_lock(p_prod_m);
                 if ((*p_prod_counter).load() >= in->buffersize()) {
                     pthread_cond_signal(p_prod_c);
                 }
-                --(*p_prod_counter);
+                (*p_prod_counter) -= k;
                 pthread_mutex_unlock(p_prod_m);
                 //}
-                --cons_counter;
-            } else { // EMPTY
+                cons_counter -= k;
+            }
+            if (!r) { // EMPTY 
+                // NOTE: in work-stealing mode the node sleeps if there is nothing to 
+                // steal, it is woken up by a new message in its own channel or by 
+                // a peer having new tasks in its deque
                 pthread_mutex_lock(&cons_m);
-                while (cons_counter.load() == 0) {
+                if (wsgroup) wsgroup->sleeping(wsid, true);
+                while (cons_counter.load() == 0 && !(wsgroup && wsgroup->stealable(wsid))) {
                     pthread_cond_wait(&cons_c, &cons_m);
                 }
+                if (wsgroup) wsgroup->sleeping(wsid, false);
                 pthread_mutex_unlock(&cons_m);
                 goto retry;
             }
@@ -532,7 +673,7 @@ protected:
         }
         for(unsigned long i=0;i<retry;++i) {
             if (!in_active) { *ptr=NULL; return false; }
-            if (pop(ptr)) return true;
+            if (pop(ptr)) { in_waiter.done(); return true; }
             losetime_in(ticks);
         } 
         return true;
@@ -684,6 +825,32 @@ protected:
         return 0;
     }
 
+    /**
+     *  \brief Pops the input tasks from a shared channel
+     *
+     *  The node takes its input from the channel \p c, shared with other
+     *  nodes, instead of the input buffer (see \p ff_farm::remove_emitter).
+     *
+     *  \return 0 if successful, -1 otherwise
+     */
+    virtual int set_input_channel(ff_mpmc_channel * const c) {
+        mpmc_in = c;
+        return 0;
+    }
+
+    /**
+     *  \brief Pushes the output tasks into a shared channel
+     *
+     *  The node sends its output to the channel \p c, shared with other
+     *  producers, instead of the output buffer.
+     *
+     *  \return 0 if successful, -1 otherwise
+     */
+    virtual int set_output_channel(ff_mpmc_channel * const c) {
+        mpmc_out = c;
+        return 0;
+    }
+
     virtual inline int set_input(svector<ff_node *> & w) { return -1;}
     virtual inline int set_input(ff_node *) { return -1;}
     virtual inline bool isMultiInput() const { return multiInput;}
@@ -826,6 +993,7 @@ public:
         if (in && myinbuffer) delete in;
         if (out && myoutbuffer) delete out;
         if (thread && my_own_thread) delete reinterpret_cast<thWorker*>(thread);
+        if (inbatch) delete [] inbatch;
     };
 
     /**
@@ -920,6 +1088,24 @@ public:
      */
     virtual int getCPUId() const { return CPUId; }
 
+    /**
+     * \brief Sets the waiting policy used on empty input/full output channels
+     *
+     * \p FF_WAIT_SPIN (default) keeps the node spinning on its channels.
+     * \p FF_WAIT_ADAPTIVE spins with an exponential backoff and then puts
+     * the thread to sleep until the peer node pushes/pops (see waitpolicy.hpp).
+     * It has no effect in blocking mode. It is applied when the node thread
+     * starts (or is thawed).
+     *
+     * \param p is the waiting policy
+     */
+    virtual void set_wait_policy(ff_wait_t p) { wait_policy = p; }
+
+    /**
+     * \brief Gets the waiting policy of the node
+     */
+    ff_wait_t get_wait_policy() const { return wait_policy; }
+
     /**
      * \brief Nonblocking put onto output channel
      *
@@ -929,7 +1115,15 @@ public:
      *
      */
     virtual inline bool  put(void * ptr) { 
-        return in->push(ptr);
+        // work-stealing: the peers know that there are tasks in the channel
+        const bool ws = wsgroup && ((size_t)ptr < FF_NBLK);
+        if (ws) wsgroup->get(wsid)->queued(1);
+        if (!in->push(ptr)) {
+            if (ws) wsgroup->get(wsid)->queued(-1);
+            return false;
+        }
+        ff_wakeup_consumer(in);
+        return true;
     }
     
     /**
@@ -940,20 +1134,31 @@ public:
      * \param ptr is a pointer to the task
      *
      */
-    virtual inline bool  get(void **ptr) { return out->pop(ptr);}
+    virtual inline bool  get(void **ptr) { 
+        if (!out->pop(ptr)) return false;
+        ff_wakeup_producer(out);
+        return true;
+    }
    
     virtual inline void losetime_out(unsigned long ticks=ff_node::TICKS2WAIT) {
         FFTRACE(lostpushticks+=ticks; ++pushwait);
+        const auto w0 = getticks();
+        if (wait_policy == FF_WAIT_ADAPTIVE) out_waiter.wait();
+        else if (!(budgetlease && ff_budget_park(false, *budgetlease))) {
 #if defined(SPIN_USE_PAUSE)
-        const long n = (long)ticks/2000;
-        for(int i=0;i<=n;++i) PAUSE();
+            const long n = (long)ticks/2000;
+            for(int i=0;i<=n;++i) PAUSE();
 #else
-        ticks_wait(ticks);
+            ticks_wait(ticks);
 #endif /* SPIN_USE_PAUSE */
+        }
+        waitticks += getticks()-w0;
     }
 
     virtual inline void losetime_in(unsigned long ticks=ff_node::TICKS2WAIT) {
         FFTRACE(lostpopticks+=ticks; ++popwait);
+        if (wait_policy == FF_WAIT_ADAPTIVE) { in_waiter.wait(); return; }
+        if (budgetlease && ff_budget_park(false, *budgetlease)) return;
 #if defined(SPIN_USE_PAUSE)
         const long n = (long)ticks/2000;
         for(int i=0;i<=n;++i) PAUSE();
@@ -980,22 +1185,58 @@ public:
      */
     virtual FFBUFFER * get_out_buffer() const { return out;}
 
-    virtual const struct timeval getstarttime() const { return tstart;}
+    /**
+     * \brief Gets the shared input channel (NULL if the node has none)
+     */
+    virtual ff_mpmc_channel * get_in_channel() const { return mpmc_in;}
 
-    virtual const struct timeval getstoptime()  const { return tstop;}
+    virtual ff_time_t getstarttime() const { return tstart;}
 
-    virtual const struct timeval getwstartime() const { return wtstart;}
+    virtual ff_time_t getstoptime()  const { return tstop;}
 
-    virtual const struct timeval getwstoptime() const { return wtstop;}    
+    virtual ff_time_t getwstartime() const { return wtstart;}
+
+    virtual ff_time_t getwstoptime() const { return wtstop;}    
+
+    /**
+     * \brief Gets the number of tasks computed by the node (calls to \p svc)
+     */
+    virtual size_t getsvccnt() const { return svccnt; }
+
+    /**
+     * \brief Gets the time spent in \p svc (ms)
+     *
+     * Each call to \p svc is timed by reading the time-stamp counter
+     * (\p getticks), which is cheap enough to be always enabled. The ticks
+     * are converted using the time measured with \p ff_gettime over the
+     * whole svc loop, so no separate calibration is needed.
+     * The time \p svc spends in \p ff_send_out waiting for room in a full
+     * output channel is not counted: a stage that only generates tasks is
+     * not busy while the next stage is behind.
+     */
+    virtual double getsvctime() const {
+        if (!wtticks) return 0.0;
+        return wttime * ((double)svcticks/(double)wtticks);
+    }
+
+    /**
+     * \brief Gets the average time of one \p svc call (ns)
+     */
+    virtual double getsvcavg() const {
+        return svccnt ? (getsvctime()*1e6)/svccnt : 0.0;
+    }
 
 #if defined(TRACE_FASTFLOW)
     virtual void ffStats(std::ostream & out) {
         out << "ID: " << get_my_id()
             << "  work-time (ms): " << wttime    << "\n"
             << "  n. tasks      : " << taskcnt   << "\n"
+            << "  svc time (ms) : " << getsvctime() << " (avg ns= " << getsvcavg() << ")\n"
             << "  svc ticks     : " << tickstot  << " (min= " << ticksmin << " max= " << ticksmax << ")\n"
             << "  n. push lost  : " << pushwait  << " (ticks=" << lostpushticks << ")" << "\n"
-            << "  n. pop lost   : " << popwait   << " (ticks=" << lostpopticks  << ")" << "\n";
+            << "  n. pop lost   : " << popwait   << " (ticks=" << lostpopticks  << ")" << "\n"
+            << "  NUMA node     : " << numanode  
+            << " (input channel on node " << (in ? in->numa_where() : -1) << ")\n";
     }
 
     virtual double getworktime() const { return wttime; }
@@ -1030,7 +1271,107 @@ public:
         return r;
     }
 
+    /**
+     * \brief Sends out a batch of tasks
+     *
+     * It is like calling \p ff_send_out for each element of \p tasks, but when
+     * the node writes directly onto a FastFlow channel (pipeline stages, farm
+     * workers and collectors) the tasks are pushed in batches, so that the 
+     * synchronisation with the consumer is paid once per batch.
+     * When the run-time has to schedule each task on its own (e.g. in 
+     * the farm emitter) the tasks are sent one at a time. 
+     * Control messages (BLK/NBLK) cannot be sent with this method.
+     *
+     * \param tasks the array of tasks
+     * \param n number of tasks
+     * \param retry number of tries (nonblocking mode only)
+     * \param ticks delay between successive retries
+     *
+     * \return \p true if all the tasks have been sent
+     */
+    virtual bool ff_send_out_batch(void ** tasks, size_t n,
+                                   unsigned long retry=((unsigned long)-1),
+                                   unsigned long ticks=(TICKS2WAIT)) { 
+        if (callback_batch) return callback_batch(tasks,n,retry,ticks,callback_arg);
+        if (callback || !out) {
+            for(size_t i=0;i<n;++i) 
+                if (!ff_send_out(tasks[i],retry,ticks)) return false;
+            return true;
+        }
+        size_t done = 0;
+        if (blocking_out) {
+            while(done<n) {
+                const size_t k = push_batch(tasks+done, n-done);
+                if (k) {
+                    pthread_mutex_lock(p_cons_m);
+                    if ((*p_cons_counter).load() == 0) {
+                        pthread_cond_signal(p_cons_c);
+                    }
+                    (*p_cons_counter) += k;
+                    pthread_mutex_unlock(p_cons_m);
+                    prod_counter += k;
+                    done += k;
+                    continue;
+                }
+                // FULL
+                const auto w0 = getticks();
+                pthread_mutex_lock(&prod_m);
+                while(prod_counter.load() >= out->buffersize()) {
+                    pthread_cond_wait(&prod_c,&prod_m);
+                }
+                pthread_mutex_unlock(&prod_m);
+                waitticks += getticks()-w0;
+            }
+        } else {
+            for(unsigned long i=0;(done<n) && (i<retry);) {
+                const size_t k = push_batch(tasks+done, n-done);
+                if (k) { done += k; out_waiter.done(); continue; }
+                losetime_out(ticks);
+                ++i;
+            }
+        }
+#if defined(FF_TASK_CALLBACK)
+        for(size_t i=0;i<done;++i) callbackOut();
+#endif
+        return (done == n);
+    }
+
+    /**
+     * \brief Sets the size of the input batch
+     *
+     * If \p n is greater than 1, the node pops up to \p n tasks at a time from
+     * its input channel and then calls \p svc on each of them. This amortises
+     * the cost of the communication on fine-grained streams.
+     * It must be called before running the node. Input batching cannot be
+     * used together with run-time switching between blocking and nonblocking
+     * mode (BLK/NBLK messages).
+     * If \p FF_PIPE_INBATCH is defined greater than 1, the sequential stages
+     * of a pipeline (but the first one) use an input batch of 
+     * \p FF_PIPE_INBATCH tasks if this method has not been called (by default
+     * batching is disabled).
+     * Farm workers pop one task at a time, unless this method is called,
+     * since the Emitter schedules each task on its own.
+     *
+     * \param n maximum number of tasks popped at a time (1 disables batching)
+     *
+     * \return 0 if successful, -1 otherwise
+     */
+    virtual int set_input_batch(size_t n) {
+        if (inbatch_pos < inbatch_cnt) {
+            error("NODE, set_input_batch, the input batch is not empty\n");
+            return -1;
+        }
+        if (inbatch) { delete [] inbatch; inbatch = NULL; }
+        inbatch_size = inbatch_pos = inbatch_cnt = 0;
+        if (n <= 1) { inbatch_size = 1; return 0; }  // explicitly disabled
+        inbatch = new void*[n];
+        inbatch_size = n;
+        return 0;
+    }
+
     // Warning resetting queues while the node is running may produce unexpected results.
+    // The tasks already popped in the input batch are not dropped, they are 
+    // the first ones processed when the node runs again.
     virtual void reset() {
         if (in)  in->reset();
         if (out) out->reset();
@@ -1089,11 +1430,17 @@ protected:
               myoutbuffer(false),myinbuffer(false),
               skip1pop(false), in_active(true), 
               multiInput(false), multiOutput(false), my_own_thread(true),
-              thread(NULL),callback(NULL),barrier(NULL) {
+              thread(NULL),callback(NULL),callback_batch(NULL),inbatch(NULL),
+              inbatch_size(0),inbatch_pos(0),inbatch_cnt(0),
+              wsgroup(NULL),wsid(0),ws_ctrl(NULL),ws_seed(1),
+              mpmc_in(NULL),mpmc_out(NULL),budgetlease(NULL),barrier(NULL) {
         time_setzero(tstart);time_setzero(tstop);
         time_setzero(wtstart);time_setzero(wtstop);
         wttime=0;
+        wtticks=0; svcticks=0; svccnt=0; waitticks=0;
+        parking.store(0);
         FFTRACE(taskcnt=0;lostpushticks=0;pushwait=0;lostpopticks=0;popwait=0;ticksmin=(ticks)-1;ticksmax=0;tickstot=0);
+        FFTRACE_EVENT(trace=NULL);
         
         fftree_ptr = NULL;
 
@@ -1103,6 +1450,8 @@ protected:
         p_cons_m = NULL, p_cons_c = NULL, p_cons_counter = NULL;
 
         blocking_in = blocking_out = RUNTIME_MODE;
+        wait_policy = FF_WAIT_SPIN;
+        numanode    = -1;
     };
         
     virtual inline void input_active(const bool onoff) {
@@ -1110,6 +1459,24 @@ protected:
             in_active= onoff;
     }
 
+    /* registers (or removes) the node events on its own channels */
+    inline void register_wait_events() {
+        const bool adaptive = (wait_policy == FF_WAIT_ADAPTIVE);
+        if (in)  in->set_cons_event(adaptive ? in_waiter.event() : NULL);
+        if (out) out->set_prod_event(adaptive ? out_waiter.event() : NULL);
+    }
+
+    /* records the NUMA node of the calling thread and, if FF_NUMA_LOCAL is
+     * defined, moves the input channel on it */
+    inline void numa_place() {
+        numanode = ff_numa_my_node();
+#if defined(FF_NUMA_LOCAL)
+        if (in && numanode>=0 && ff_topology::instance().numNodes()>1 &&
+            in->numa_place(numanode)<0)
+            error("NODE, cannot move the input channel on NUMA node %d\n", numanode);
+#endif
+    }
+
     fftree *getfftree() const   { return fftree_ptr;}
     void setfftree(const fftree *ptr) { 
         fftree_ptr=const_cast<fftree*>(ptr); 
@@ -1117,15 +1484,21 @@ protected:
 
     void registerCallback(bool (*cb)(void *,unsigned long,unsigned long,void *), void * arg) {
         callback=cb;
+        callback_batch=NULL;
         callback_arg=arg;
     }
 
+    // it must be called after registerCallback (the argument is shared)
+    void registerBatchCallback(bool (*cb)(void **,size_t,unsigned long,unsigned long,void *)) {
+        callback_batch=cb;
+    }
+
 private:  
     /* ------------------------------------------------------------------------------------- */
     class thWorker: public ff_thread {
     public:
         thWorker(ff_node * const filter):
-            ff_thread(filter->barrier),filter(filter) {}
+            ff_thread(filter->barrier),filter(filter),parked(false) {}
         
         inline bool push(void * task) {
             /* NOTE: filter->push and not buffer->push because of the filter can be a dnode
@@ -1147,15 +1520,21 @@ private:
         inline void* svc(void * ) {
             void * task = NULL;
             void * ret  = EOS;
-            bool inpresent  = (filter->get_in_buffer() != NULL);
-            bool outpresent = (filter->get_out_buffer() != NULL);
+            bool inpresent  = (filter->get_in_buffer() != NULL) || filter->mpmc_in;
+            bool outpresent = (filter->get_out_buffer() != NULL) || filter->mpmc_out;
             bool skipfirstpop = filter->skipfirstpop(); 
             bool exit=false;            
+            FFTRACE_EVENT(ff_trace_ring *const tr = filter->trace);
+            FFTRACE_EVENT(unsigned long long tt = ff_trace_now());
 
-            gettimeofday(&filter->wtstart,NULL);
+            filter->wtstart = ff_gettime();
+            const ticks wt0 = getticks();
             do {
                 if (inpresent) {
-                    if (!skipfirstpop) pop(&task); 
+                    if (!skipfirstpop) {
+                        pop(&task); 
+                        FFTRACE_EVENT(tt = tr->record(FF_TRACE_RECV, tt));
+                    }
                     else skipfirstpop=false;
                     if ((task == EOS) || (task == EOSW) ||
                         (task == EOS_NOFREEZE)) {
@@ -1167,7 +1546,7 @@ private:
                         }
                         break;
                     }
-                    if (task == GO_OUT) break;
+                    if (task == GO_OUT) { ret = task; break; }
                 }
                 if (task == BLK || task == NBLK) {
                     if (outpresent) push(task);
@@ -1176,16 +1555,27 @@ private:
                     continue;
                 }
                 FFTRACE(++filter->taskcnt);
-                FFTRACE(ticks t0 = getticks());
 
 #if defined(FF_TASK_CALLBACK)
                 if (filter) callbackIn();
 #endif                    
 
+                FFTRACE_EVENT(tt = ff_trace_now());
+                const ticks t0 = getticks();
+                const ticks w0 = filter->waitticks;
                 ret = filter->svc(task);
+                // the waits for room in the output channel are not service time
+                const ticks diff = getticks()-t0 - (filter->waitticks-w0);
+                filter->svcticks += diff;
+                ++filter->svccnt;
+                FFTRACE_EVENT(tt = tr->record(FF_TRACE_SVC, tt));
+#if defined(TRACE_FASTFLOW_EVENTS)
+                if (inpresent && tr->qsample_due())
+                    tr->qsample(filter->mpmc_in ? filter->mpmc_in->length() :
+                                filter->get_in_buffer()->length());
+#endif
 
 #if defined(TRACE_FASTFLOW)
-                ticks diff=(getticks()-t0);
                 filter->tickstot +=diff;
                 filter->ticksmin=(std::min)(filter->ticksmin,diff); // (std::min) for win portability)
                 filter->ticksmax=(std::max)(filter->ticksmax,diff);
@@ -1206,32 +1596,40 @@ private:
                 }
                 if ( outpresent && ((ret != GO_ON) && (ret != EOS_NOFREEZE)) ) { 
                     push(ret);
+                    FFTRACE_EVENT(tt = tr->record(FF_TRACE_SEND, tt));
 #if defined(FF_TASK_CALLBACK)
                     if (filter) callbackOut();
 #endif
                 }
             } while(!exit);
             
-            gettimeofday(&filter->wtstop,NULL);
+            filter->wtstop = ff_gettime();
+            filter->wtticks += getticks()-wt0;
             filter->wttime+=diffmsec(filter->wtstop,filter->wtstart);
             
             return ret;
         }
         
         int svc_init() {
+            // restarting after having been parked: the node is still initialised
+            if (parked) { parked=false; --filter->parking; return 0; }
 #if !defined(HAVE_PTHREAD_SETAFFINITY_NP) && !defined(NO_DEFAULT_MAPPING)
             int cpuId = filter->getCPUId();
             if (ff_mapThreadToCpu((cpuId<0) ? (cpuId=threadMapper::instance()->getCoreId(tid)) : cpuId)!=0)
                 error("Cannot map thread %d to CPU %d, mask is %u,  size is %u,  going on...\n",tid, (cpuId<0) ? threadMapper::instance()->getCoreId(tid) : cpuId, threadMapper::instance()->getMask(), threadMapper::instance()->getCListSize());            
             filter->setCPUId(cpuId);
 #endif
-            gettimeofday(&filter->tstart,NULL);
+            filter->tstart = ff_gettime();
+            filter->register_wait_events();
+            filter->numa_place();
+            FFTRACE_EVENT(if (!filter->trace) filter->trace = ff_tracer::instance()->newring("node", filter->get_my_id()));
             return filter->svc_init(); 
         }
         
         void svc_end() {
+            if (filter->parking.load()>0) { parked=true; return; } // parked, not terminated
             filter->svc_end();
-            gettimeofday(&filter->tstop,NULL);
+            filter->tstop = ff_gettime();
         }
         
         int run(bool=false) { 
@@ -1254,6 +1652,7 @@ private:
 #endif        
     protected:    
         ff_node * const filter;
+        bool            parked;  // svc has been left because of a parking
     };
     /* ------------------------------------------------------------------------------------- */
 
@@ -1264,6 +1663,9 @@ private:
 
 protected:
 
+#if defined(TRACE_FASTFLOW_EVENTS)
+    ff_trace_ring *trace;
+#endif
 #if defined(TRACE_FASTFLOW)
     size_t        taskcnt;
     ticks         lostpushticks;
@@ -1297,6 +1699,10 @@ protected:
     pthread_mutex_t    *p_cons_m;
     pthread_cond_t     *p_cons_c;
     std::atomic_ulong  *p_cons_counter;
+
+    // adaptive waiting policy on the input and output queue
+    ff_waiter           in_waiter;
+    ff_waiter           out_waiter;
 };
 
 /* just a node interface for the input and output buffers */
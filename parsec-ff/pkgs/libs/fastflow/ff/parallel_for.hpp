@@ -42,6 +42,8 @@
  *      1 - default static scheduling
  *      2 - static scheduling with grain size greater than 0
  *      3 - dynamic scheduling with grain size greater than 0
+ *      4 - guided scheduling with minimum grain size (grain=PARFOR_GUIDED(min))
+ *      5 - adaptive scheduling (grain=PARFOR_ADAPTIVE)
  * 
  *  As a general rule, the scheduling strategy is selected according to the chunk value:
  *      - chunk == 0 means default static scheduling, that is, ~(#iteration_space/num_workers) 
@@ -54,6 +56,17 @@
  *                   than chunk iterations. Then chunks are assigned to the workers threads 
  *                   statically and in a round-robin fashion.
  *
+ *  The dynamic methods (parallel_for, parallel_for_thid, parallel_reduce, ...) also 
+ *  accept as grain:
+ *      - PARFOR_GUIDED(min) the chunks have decreasing size, about 
+ *                   #remaining_iterations/num_workers, but no less than min iterations
+ *      - PARFOR_ADAPTIVE the grain is computed so that one chunk lasts about 
+ *                   FF_PARFOR_ADAPTIVE_GRAIN_NS nanoseconds (default 20us), using the
+ *                   cost of the iterations measured in the previous PARFOR_ADAPTIVE loops
+ *                   executed by the same ParallelFor/ParallelForReduce object (the first 
+ *                   one is executed with PARFOR_GUIDED(1)). Useful when the same loop is 
+ *                   executed many times.
+ *
  *  If you want to use the static scheduling policy (either default or with a given grain),
  *  please use the **parallel_for_static** method.
  *
@@ -61,7 +74,13 @@
  *  As always, it depends on the application, scheduling strategy, platform at hand, 
  *  parallelism degree, ...etc....
  *
- *  The general rule is: a scheduler thread is started if:
+ *  By default no scheduler thread is used (decentralized engine): each worker takes 
+ *  the chunks from its own partition of the iteration space and steals them from the 
+ *  most loaded worker when it is empty. This is the best option for short loops.
+ *  The scheduler thread may be enabled at run-time by calling disableScheduler(false) 
+ *  or by setting the environment variable FF_PARFOR_SCHEDULER=1.
+ *
+ *  If enabled, the general rule is: a scheduler thread is started if:
  *   1. the dynamic scheduling policy is used (chunk>0);
  *   2. there are enough cores for hosting both worker threads and the scheduler thread;
  *   3. the number of tasks per thread is greater than 1.
@@ -71,6 +90,28 @@
  *  both at compile time and at run-time by using the disableScheduler method and the 
  *  two defines NO_PARFOR_SCHEDULER_THREAD and PARFOR_SCHEDULER_THREAD. 
  *
+ *  Nested loops:
+ *  a parallel_for called inside the body of a loop (of the same ParallelFor/
+ *  ParallelForReduce object, or of another one with at least as many workers) 
+ *  does not start any thread: it is split in chunks executed by the calling worker
+ *  and by the workers of the outer loop that have finished their own iterations 
+ *  (decentralized engine only). If no worker is idle the loop is executed 
+ *  sequentially by the calling worker, which also executes sequentially the nested
+ *  reductions and the loops nested at deeper levels. Inside a nested body the 
+ *  thread id is the one of the worker of the outer loop. A loop of an object with
+ *  less workers than the outer one is executed by its own threads as usual (or
+ *  sequentially, with thread id 0, if nested at deeper levels), so that the thread
+ *  ids stay within its number of workers.
+ *  A parallel_for called by a farm worker (or any thread that is not a worker of 
+ *  a ParallelFor) is executed by the threads of its object: their number is 
+ *  limited by the thread budget below, which avoids the oversubscription.
+ *
+ *  Thread budget:
+ *  the workers of each loop are leased from the process-wide budget (see budget.hpp),
+ *  thus when other skeletons are running a loop may be executed by less workers than 
+ *  requested. Between two loops, the spinning workers of an idle object park if the 
+ *  budget is exhausted. 
+ *
  *
  *  How to use the ParallelFor (in a nutshell) :
  *                                      ParallelForReduce<long> pfr;
@@ -116,7 +157,8 @@ public:
      * Set up a parallel for ParallelFor pattern run-time support 
      * (i.e. spawn workers threads)
      * A single object can be used as many times as needed to run different parallel for
-     * pattern instances (different loop bodies). They cannot be nested nor recursive.
+     * pattern instances (different loop bodies). They can be nested: the inner loops 
+     * are executed by the worker threads of the outer loop (see "Nested loops" above).
      * Nonblocking policy is to be preferred in case of repeated call of the 
      * some of the parallel_for methods (e.g. within a strict outer loop). On the same
      * ParallelFor object different parallel_for methods (e.g. parallel_for and 
@@ -154,7 +196,8 @@ public:
      * parallelism degree, task grain and platform. 
      * As rule of thumb on large multicore and fine-grain tasks active scheduling is
      * faster. On few cores passive scheduler enhances overall performance.
-     * Active scheduler is the default option.
+     * Passive scheduler is the default option (unless FF_PARFOR_SCHEDULER=1 is 
+     * set in the environment).
      * \param onoff <b>true</b> disable active schduling, 
      * <b>false</b> enable active scheduling
      */ 
@@ -163,6 +206,26 @@ public:
         ff_forall_farm<forallreduce_W<int> >::disableScheduler(onoff);
     }
 
+    /**
+     * \brief Affinity replay of the dynamic loops
+     *
+     * The chunks computed by each worker the first time a dynamic loop is 
+     * executed are recorded. When the same loop (same range, step, grain and 
+     * n. of workers) is executed again each worker gets the same chunks, 
+     * thus finding their data in its cache. Useful for loops executed many 
+     * times over the same data. A worker steals chunks only from workers 
+     * having more than <b>threshold</b> chunks left.
+     * \param onoff <b>true</b> enable, <b>false</b> disable (and forget the recorded loops)
+     * \param threshold stealing threshold (n. of chunks)
+     */
+    inline void affinityReplay(bool onoff=true, long threshold=FF_PARFOR_REPLAY_THRESHOLD) {
+        ff_forall_farm<forallreduce_W<int> >::affinityReplay(onoff, threshold);
+    }
+    /// n. of iterations computed by a worker other than the recorded one
+    inline unsigned long getMigrated() const { 
+        return ff_forall_farm<forallreduce_W<int> >::getMigrated();
+    }
+
     // It puts all spinning threads to sleep. It does not disable the spinWait flag
     // so at the next call, threads start spinning again.
     inline int threadPause() {
@@ -226,7 +289,8 @@ public:
      * @param last last value of the iteration variable
      * @param step step increment for the iteration variable
      * @param grain (> 0) minimum computation grain 
-     * (n. of iterations scheduled together to a single worker)
+     * (n. of iterations scheduled together to a single worker), 
+     * or PARFOR_GUIDED(min) or PARFOR_ADAPTIVE
      * @param f <b>f(const long idx)</b>  Lambda function, 
      * body of the parallel loop. <b>idx</b>: iteration
      * param nw number of worker threads
@@ -250,7 +314,8 @@ public:
      * @param first first value of the iteration variable
      * @param last last value of the iteration variable
      * @param step step increment for the iteration variable
-     * @param grain  minimum computation grain  (n. of iterations scheduled together to a single worker)
+     * @param grain  minimum computation grain  (n. of iterations scheduled together to a single worker),
+     * or PARFOR_GUIDED(min) or PARFOR_ADAPTIVE
      * @param f <b>f(const long idx, const int thid)</b>  Lambda function, body of the parallel loop. <b>idx</b>: iteration, <b>thid</b>: worker_id 
      * @param nw number of worker threads (default n. of platform HW contexts)
      */
@@ -327,6 +392,114 @@ public:
             } FF_PARFOR_T_STOP(this,int);
         }
     }
+
+    // -------------------- multi-dimensional parallel_for --------------------
+
+    /**
+     * \brief 2D parallel for region (tiles) - dynamic
+     *
+     * The iteration space [first0,last0) x [first1,last1) is divided in tiles of
+     * <b>tile0</b> x <b>tile1</b> indexes. Tiles are scheduled dynamically onto nw 
+     * worker threads in blocks of <b>grain</b> tiles, following the given 
+     * <b>order</b>: FF_TILE_ROWMAJOR, FF_TILE_MORTON (Z-order) or FF_TILE_HILBERT.
+     * The indexes of a tile are walked in row-major order (j is the inner index).
+     *
+     * \param first0 first value of the outer index i
+     * \param last0 last value of the outer index i
+     * \param tile0 tile size along i
+     * \param first1 first value of the inner index j
+     * \param last1 last value of the inner index j
+     * \param tile1 tile size along j
+     * \param f <b>f(const long i, const long j)</b> Lambda function, body of the parallel loop
+     * \param grain (> 0) n. of tiles scheduled together to a single worker, 
+     * or PARFOR_GUIDED(min) or PARFOR_ADAPTIVE
+     * \param order order of the tiles
+     * \param nw number of worker threads
+     */
+    template <typename Function>
+    inline void parallel_for_2d(long first0, long last0, long tile0,
+                                long first1, long last1, long tile1,
+                                const Function& f, long grain=1, 
+                                int order=FF_TILE_ROWMAJOR, const long nw=FF_AUTO) {
+        parallel_for_2d_idx(first0,last0,tile0, first1,last1,tile1,
+                            [&f](const long b0,const long e0,const long b1,const long e1,const int) {
+                                for(long i=b0;i<e0;++i)
+                                    for(long j=b1;j<e1;++j) f(i,j);
+                            }, grain, order, nw);
+    }
+
+    /**
+     * \brief 2D parallel for region (tiles) - dynamic - advanced usage
+     *
+     * As parallel_for_2d but the whole tile is passed to the body, that is
+     * <b>f(const long i_start, const long i_stop, const long j_start, const long j_stop, 
+     * const int thid)</b>.
+     */
+    template <typename Function>
+    inline void parallel_for_2d_idx(long first0, long last0, long tile0,
+                                    long first1, long last1, long tile1,
+                                    const Function& f, long grain=1, 
+                                    int order=FF_TILE_ROWMAJOR, const long nw=FF_AUTO) {
+        const long b[2] = { first0, first1 }, e[2] = { last0, last1 }, t[2] = { tile0, tile1 };
+        // a nested loop cannot use the tiling of the object (the outer one may be using it)
+        forall_tiles_t ntl, &tl = forall_tls().sched ? ntl : tiles;
+        const long ntiles = tl.set(2, b, e, t, order);
+        if (ntiles == 0) return;
+        FF_PARFOR_START(this, parfortile, 0, ntiles, 1, PARFOR_DYNAMIC(grain), nw) {
+            long tb[3], te[3];
+            tl.get(parfortile, tb, te);
+            f(tb[0],te[0],tb[1],te[1],_ff_thread_id);
+        } FF_PARFOR_STOP(this);
+    }
+
+    /**
+     * \brief 3D parallel for region (tiles) - dynamic
+     *
+     * As parallel_for_2d for the space [first0,last0) x [first1,last1) x [first2,last2).
+     * The body is <b>f(const long i, const long j, const long k)</b>, k is the 
+     * inner index.
+     */
+    template <typename Function>
+    inline void parallel_for_3d(long first0, long last0, long tile0,
+                                long first1, long last1, long tile1,
+                                long first2, long last2, long tile2,
+                                const Function& f, long grain=1, 
+                                int order=FF_TILE_ROWMAJOR, const long nw=FF_AUTO) {
+        parallel_for_3d_idx(first0,last0,tile0, first1,last1,tile1, first2,last2,tile2,
+                            [&f](const long b[3],const long e[3],const int) {
+                                for(long i=b[0];i<e[0];++i)
+                                    for(long j=b[1];j<e[1];++j)
+                                        for(long k=b[2];k<e[2];++k) f(i,j,k);
+                            }, grain, order, nw);
+    }
+
+    /**
+     * \brief 3D parallel for region (tiles) - dynamic - advanced usage
+     *
+     * As parallel_for_3d but the whole tile is passed to the body, that is
+     * <b>f(const long start[3], const long stop[3], const int thid)</b>.
+     */
+    template <typename Function>
+    inline void parallel_for_3d_idx(long first0, long last0, long tile0,
+                                    long first1, long last1, long tile1,
+                                    long first2, long last2, long tile2,
+                                    const Function& f, long grain=1, 
+                                    int order=FF_TILE_ROWMAJOR, const long nw=FF_AUTO) {
+        const long b[3] = { first0, first1, first2 }, e[3] = { last0, last1, last2 };
+        const long t[3] = { tile0, tile1, tile2 };
+        // a nested loop cannot use the tiling of the object (the outer one may be using it)
+        forall_tiles_t ntl, &tl = forall_tls().sched ? ntl : tiles;
+        const long ntiles = tl.set(3, b, e, t, order);
+        if (ntiles == 0) return;
+        FF_PARFOR_START(this, parfortile, 0, ntiles, 1, PARFOR_DYNAMIC(grain), nw) {
+            long tb[3], te[3];
+            tl.get(parfortile, tb, te);
+            f(tb,te,_ff_thread_id);
+        } FF_PARFOR_STOP(this);
+    }
+
+protected:
+    forall_tiles_t tiles;  // tiling of the last multi-dimensional loop
 };
 
  /*!
@@ -380,6 +553,7 @@ public:
     ~ParallelForReduce()                { 
         ff_forall_farm<forallreduce_W<T> >::stop();
         ff_forall_farm<forallreduce_W<T> >::wait();
+        for(size_t i=0;i<rbufs.size();++i) freebuf(rbufs[i]);
     }
 
     // By calling this method with 'true' the scheduler will be disabled,
@@ -389,6 +563,26 @@ public:
         ff_forall_farm<forallreduce_W<T> >::disableScheduler(onoff);
     }
 
+    /**
+     * \brief Affinity replay of the dynamic loops
+     *
+     * The chunks computed by each worker the first time a dynamic loop is 
+     * executed are recorded. When the same loop (same range, step, grain and 
+     * n. of workers) is executed again each worker gets the same chunks, 
+     * thus finding their data in its cache. Useful for loops executed many 
+     * times over the same data. A worker steals chunks only from workers 
+     * having more than <b>threshold</b> chunks left.
+     * \param onoff <b>true</b> enable, <b>false</b> disable (and forget the recorded loops)
+     * \param threshold stealing threshold (n. of chunks)
+     */
+    inline void affinityReplay(bool onoff=true, long threshold=FF_PARFOR_REPLAY_THRESHOLD) {
+        ff_forall_farm<forallreduce_W<T> >::affinityReplay(onoff, threshold);
+    }
+    /// n. of iterations computed by a worker other than the recorded one
+    inline unsigned long getMigrated() const { 
+        return ff_forall_farm<forallreduce_W<T> >::getMigrated();
+    }
+
     // It puts all spinning threads to sleep. It does not disable the spinWait flag
     // so at the next call, threads start spinning again.
     inline int threadPause() {
@@ -470,7 +664,8 @@ public:
      * @param first first value of the iteration variable
      * @param last last value of the iteration variable
      * @param step step increment for the iteration variable
-     * @param grain  minimum computation grain  (n. of iterations scheduled together to a single worker)
+     * @param grain  minimum computation grain  (n. of iterations scheduled together to a single worker),
+     * or PARFOR_GUIDED(min) or PARFOR_ADAPTIVE
      * @param f <b>f(const long idx, const int thid)</b>  Lambda function, body of the parallel loop. <b>idx</b>: iteration, <b>thid</b>: worker_id
      * @param nw number of worker threads (default n. of platform HW contexts)
      */
@@ -616,6 +811,7 @@ public:
      * \param first first value of the iteration variable
      * \param last last value of the iteration variable
      * \param step step increment for the iteration variable
+     * \param grain (> 0) minimum computation grain, or PARFOR_GUIDED(min) or PARFOR_ADAPTIVE
      * \param partialreduce_body reduce operation (1st phase, executed in parallel)
      * \param finalreduce_body reduce operation (2nd phase, executed sequentially)
      * \param nw number of worker threads
@@ -672,7 +868,145 @@ public:
             } FF_PARFORREDUCE_F_STOP(this, var, finalreduce);
         }
     }
-    
+
+    // -------------------- parallel_reduce_array --------------------
+
+    /**
+     * \brief Parallel reduce of an array (basic) - static
+     *
+     * Each worker thread accumulates into a private array of <b>n</b> elements,
+     * initialised to <b>identity</b>, which the body receives as <b>priv</b>.
+     * At the end the private arrays are combined pairwise (tree) and the result 
+     * is reduced into <b>out</b>, that is 
+     * out[j] = finalreduce(out[j], priv_0[j] op priv_1[j] op ...).
+     * The combine phase is executed in parallel over the elements of the array.
+     *
+     * The private arrays are aligned to (and padded to a multiple of) the 
+     * cache line, thus no false sharing occurs among the workers. They are 
+     * allocated (and first touched) by the workers the first time and then reused
+     * by the following calls.
+     *
+     * \param out array to be updated with the result (n elements)
+     * \param n number of elements of the array
+     * \param identity identity value for the reduction function
+     * \param first first value of the iteration variable
+     * \param last last value of the iteration variable
+     * \param body <b>body(const long idx, T *priv)</b> body of the parallel loop
+     * \param finalreduce <b>finalreduce(T &a, const T &b)</b> reduce operation (a op= b)
+     * \param nw number of worker threads
+     */
+    template <typename Function, typename FReduction>
+    inline void parallel_reduce_array(T *out, size_t n, const T& identity,
+                                      long first, long last,
+                                      const Function& body, const FReduction& finalreduce,
+                                      const long nw=FF_AUTO) {
+        reduce_array(out,n,identity,first,last,1,PARFOR_STATIC(0),body,finalreduce,nw);
+    }
+
+    /**
+     * \brief Parallel reduce of an array (step, grain) - dynamic
+     *
+     * As the above one but iterations are scheduled dynamically in blocks 
+     * of minimal size <b>grain</b> (or PARFOR_GUIDED(min), PARFOR_ADAPTIVE) and
+     * the iteration space is walked with stride <b>step</b>.
+     */
+    template <typename Function, typename FReduction>
+    inline void parallel_reduce_array(T *out, size_t n, const T& identity,
+                                      long first, long last, long step, long grain,
+                                      const Function& body, const FReduction& finalreduce,
+                                      const long nw=FF_AUTO) {
+        reduce_array(out,n,identity,first,last,step,PARFOR_DYNAMIC(grain),body,finalreduce,nw);
+    }
+
+protected:
+    // private array of one worker, gen is the call in which it has been initialised
+    struct rbuf_t {
+        T     *ptr;
+        size_t cap;
+        long   gen;
+    };
+
+    static inline void freebuf(rbuf_t &b) {
+        if (!b.ptr) return;
+        for(size_t j=0;j<b.cap;++j) b.ptr[j].~T();
+        freeAlignedMemory(b.ptr);
+        b.ptr = NULL, b.cap = 0;
+    }
+    // called by the worker thread w
+    inline T *privbuf(const int w, const size_t n, const T &identity, const long gen) {
+        rbuf_t &b = rbufs[w];
+        if (b.gen == gen) return b.ptr;
+        if (b.cap < n) {
+            freebuf(b);
+            // padded to a multiple of the cache line
+            const size_t bytes = ((n*sizeof(T)+CACHE_LINE_SIZE-1)/CACHE_LINE_SIZE)*CACHE_LINE_SIZE;
+            b.ptr = (T*)getAlignedMemory(CACHE_LINE_SIZE, bytes);
+            if (!b.ptr) {
+                error("ParallelForReduce: parallel_reduce_array, unable to allocate memory\n");
+                abort();
+            }
+            b.cap = bytes/sizeof(T);
+            for(size_t j=0;j<b.cap;++j) new (&b.ptr[j]) T();
+        }
+        for(size_t j=0;j<n;++j) b.ptr[j] = identity;
+        b.gen = gen;
+        return b.ptr;
+    }
+
+    template <typename Function, typename FReduction>
+    inline void reduce_array(T *out, const size_t n, const T& identity,
+                             long first, long last, long step, long chunk,
+                             const Function& body, const FReduction& finalreduce,
+                             const long nw) {
+        if (n == 0) return;
+        if (forall_tls().sched) {
+            // nested in the body of a loop: executed sequentially by the calling worker
+            std::vector<T> priv(n, identity);
+            for(long idx=first; idx<last; idx+=step) body(idx, priv.data());
+            for(size_t j=0;j<n;++j) finalreduce(out[j], priv[j]);
+            return;
+        }
+        const size_t maxnw = this->getNWorkers();
+        if (rbufs.size() < maxnw) {
+            const rbuf_t b = { NULL, 0, 0 };
+            rbufs.resize(maxnw, b);
+        }
+        const long gen = ++rgen;
+        FF_PARFOR_T_START_IDX(this, T, parforidx, first, last, step, chunk, nw) {
+            T *const priv = privbuf(_ff_thread_id, n, identity, gen);
+            for(long idx=ff_start_idx; idx<ff_stop_idx; idx+=step) body(idx, priv);
+        } FF_PARFOR_T_STOP(this, T);
+
+        // combine phase: the arrays are summed pairwise, block by block
+        rused.clear();
+        for(size_t i=0;i<rbufs.size();++i) 
+            if (rbufs[i].gen == gen) rused.push_back(rbufs[i].ptr);
+        const size_t nb = rused.size();
+        auto combine = [&](const long b, const long e) {
+            const long bsize = 1024;
+            for(long b0=b; b0<e; b0+=bsize) {
+                const long e0 = (std::min)(b0+bsize, e);
+                for(size_t s=1; s<nb; s<<=1)
+                    for(size_t i=0; i+s<nb; i+=2*s) {
+                        T *const d = rused[i];
+                        const T *const src = rused[i+s];
+                        for(long j=b0;j<e0;++j) finalreduce(d[j], src[j]);
+                    }
+                if (nb) for(long j=b0;j<e0;++j) finalreduce(out[j], rused[0][j]);
+            }
+        };
+        if (nb <= 1 || n*nb < 16384) combine(0, (long)n);
+        else {
+            FF_PARFOR_T_START_IDX(this, T, parforidx, 0, (long)n, 1, PARFOR_STATIC(0), nw) {
+                combine(ff_start_idx, ff_stop_idx);
+            } FF_PARFOR_T_STOP(this, T);
+        }
+    }
+
+protected:
+    std::vector<rbuf_t> rbufs;   // private arrays of parallel_reduce_array
+    std::vector<T*>     rused;
+    long                rgen = 0;
 };
 
 
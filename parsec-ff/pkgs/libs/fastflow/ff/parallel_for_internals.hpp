@@ -54,6 +54,7 @@
 // #endif
 // #endif
 
+#include <stdlib.h>
 #include <atomic>
 #include <algorithm>
 #include <deque>
@@ -64,9 +65,29 @@
 #include <ff/node.hpp>
 #include <ff/farm.hpp>
 #include <ff/spin-lock.hpp>
+#include <ff/budget.hpp>
 
 enum {FF_AUTO=-1};
 
+/*
+ * By default the loops are executed by the decentralized engine: there is 
+ * no scheduler thread, each worker takes the chunks from its own partition 
+ * of the iteration space with a CAS and, when it is empty, steals them 
+ * from the partition of the most loaded worker. The loop is started by 
+ * waking up the workers (one message each) and terminated by a barrier.
+ * The scheduler thread (active scheduling) can be enabled at run-time by 
+ * setting the environment variable FF_PARFOR_SCHEDULER=1 or by calling 
+ * disableScheduler(false), or at compile time by defining PARFOR_SCHEDULER_THREAD.
+ */
+static inline bool parfor_scheduler_default() {
+    static int r = -1;
+    if (r < 0) {
+        const char *e = getenv("FF_PARFOR_SCHEDULER");
+        r = (e && atoi(e) > 0) ? 1 : 0;
+    }
+    return r == 1;
+}
+
 #ifdef FF_PARFOR_PASSIVE_NOSTEALING
 static int dummyTask;
 static bool globalSchedRunning;
@@ -113,6 +134,14 @@ namespace ff {
      *  NOTE: inside the body of the PARFOR/PARFORREDUCE, it is possible to use the 
      *        '_ff_thread_id' const integer variable to identify the thread id 
      *        running the sequential portion of the loop.
+     *
+     *  NOTE: a PARFOR executed inside the body of another PARFOR/PARFORREDUCE 
+     *        (of the same object, or of a different one having at least as many
+     *        worker threads) does not use its own threads: it is executed by the 
+     *        thread that calls it, helped by the idle worker threads of the outer
+     *        loop (see forall_Scheduler::runNested), thus '_ff_thread_id' is the
+     *        id of the worker of the outer loop. 
+     *        A nested PARFORREDUCE is executed sequentially by the calling thread.
      */
 
     /**
@@ -148,7 +177,8 @@ namespace ff {
 #define FF_PARFOR_END(name)                                                       \
     };                                                                            \
     {                                                                             \
-      if (name.getnw()>1) {                                                       \
+      if (name.nested()) name.runNested(F_##name);                                \
+      else if (name.getnw()>1) {                                                  \
         name.setF(F_##name);                                                      \
         if (name.run_and_wait_end()<0) {                                          \
 			error("running parallel for\n");                                      \
@@ -182,7 +212,8 @@ namespace ff {
 
 #define FF_PARFORREDUCE_END(name, var, op)                                        \
         };                                                                        \
-        if (name.getnw()>1) {                                                     \
+        if (name.nested()) name.runNestedReduce(F_##name, var);                   \
+        else if (name.getnw()>1) {                                                \
           auto ovar_##name = var;                                                 \
           name.setF(F_##name,idtt_##name);                                        \
           if (name.run_and_wait_end()<0) {                                        \
@@ -200,7 +231,8 @@ namespace ff {
 
 #define FF_PARFORREDUCE_F_END(name, var, F)                                       \
         };                                                                        \
-        if (name.getnw()>1) {                                                     \
+        if (name.nested()) name.runNestedReduce(F_##name, var);                   \
+        else if (name.getnw()>1) {                                                \
           auto ovar_##name = var;                                                 \
           name.setF(F_##name,idtt_##name);                                        \
           if (name.run_and_wait_end()<0)                                          \
@@ -291,7 +323,8 @@ namespace ff {
 
 #define FF_PARFOR_STOP(name)                                                             \
     };                                                                                   \
-    if (name->getnw()>1) {                                                               \
+    if (name->nested()) name->runNested(F_##name);                                       \
+    else if (name->getnw()>1) {                                                          \
       name->setF(F_##name);                                                              \
       if (name->run_then_freeze(name->getnw())<0)                                        \
 		 error("running ff_forall_farm (name)\n");                                       \
@@ -300,7 +333,8 @@ namespace ff {
 
 #define FF_PARFOR_T_STOP(name, type)                                                     \
     };                                                                                   \
-    if (name->getnw()>1) {                                                               \
+    if (name->nested()) name->runNested(F_##name);                                       \
+    else if (name->getnw()>1) {                                                          \
         name->setF(F_##name, type());                                                    \
         if (name->run_then_freeze(name->getnw())<0)                                      \
 		  error("running ff_forall_farm (name)\n");                                      \
@@ -333,7 +367,8 @@ namespace ff {
 
 #define FF_PARFORREDUCE_STOP(name, var, op)                                              \
         };                                                                               \
-        if (name->getnw()>1) {                                                           \
+        if (name->nested()) name->runNestedReduce(F_##name, var);                        \
+        else if (name->getnw()>1) {                                                      \
           auto ovar_##name = var;                                                        \
           name->setF(F_##name,idtt_##name);                                              \
           if (name->run_then_freeze(name->getnw())<0)                                    \
@@ -350,7 +385,8 @@ namespace ff {
 
 #define FF_PARFORREDUCE_F_STOP(name, var, F)                                             \
         };                                                                               \
-        if (name->getnw()>1) {                                                           \
+        if (name->nested()) name->runNestedReduce(F_##name, var);                        \
+        else if (name->getnw()>1) {                                                      \
           auto ovar_##name = var;                                                        \
           name->setF(F_##name,idtt_##name);                                              \
           if (name->run_then_freeze(name->getnw())<0)                                    \
@@ -373,6 +409,29 @@ namespace ff {
 #define PARFOR_STATIC(X)   (X>0?-X:X)
 #define PARFOR_DYNAMIC(X)  (X<0?-X:X)
 
+// guided and adaptive scheduling are encoded in the (positive) chunk value
+// by setting one of the two bits below, so they pass unchanged through
+// PARFOR_DYNAMIC and through all the dynamic parallel_for/reduce methods
+#define FF_PARFOR_GUIDED_FLAG    (1L<<(sizeof(long)*8-3))
+#define FF_PARFOR_ADAPTIVE_FLAG  (1L<<(sizeof(long)*8-4))
+#define FF_PARFOR_FLAGS          (FF_PARFOR_GUIDED_FLAG|FF_PARFOR_ADAPTIVE_FLAG)
+#define PARFOR_GUIDED(X)   (FF_PARFOR_GUIDED_FLAG | ((X)>0?(long)(X):1L))
+#define PARFOR_ADAPTIVE    (FF_PARFOR_ADAPTIVE_FLAG | 1L)
+
+// target execution time (ns) of a chunk for the PARFOR_ADAPTIVE policy
+#if !defined(FF_PARFOR_ADAPTIVE_GRAIN_NS)
+#define FF_PARFOR_ADAPTIVE_GRAIN_NS 20000
+#endif
+
+// affinity replay: n. of loops remembered and default stealing threshold, 
+// i.e. a worker steals only from workers having more than this n. of chunks left
+#if !defined(FF_PARFOR_REPLAY_SLOTS)
+#define FF_PARFOR_REPLAY_SLOTS 8
+#endif
+#if !defined(FF_PARFOR_REPLAY_THRESHOLD)
+#define FF_PARFOR_REPLAY_THRESHOLD 2
+#endif
+
     /* ------------------------------------------------------------------- */
 
 
@@ -410,6 +469,135 @@ struct dataPair {
 };
 
 
+// chunk-to-worker assignment of one dynamic loop (see affinity replay)
+struct forall_replay_t {
+    long   start, stop, step, chunk;
+    size_t nw;
+    std::vector<std::vector<std::pair<long,long> > > lists; // chunks computed by each worker
+};
+
+// nested loop, executed by the worker that publishes it and by the idle 
+// workers of the same pool taking span indexes at a time from next
+struct forall_nested_t {
+    std::atomic_long next;
+    long             stop, span;
+    const std::function<void(const long,const long,const int)> *F;
+};
+// one for each worker of the pool, users is the n. of helpers that may 
+// be accessing the loop published by the worker
+struct forall_nested_slot_t {
+    std::atomic<forall_nested_t*> loop;
+    std::atomic_long              users;
+    char padding[CACHE_LINE_SIZE];
+
+    forall_nested_slot_t() { loop.store(NULL); users.store(0); }
+};
+// per-thread state used to detect and run the nested loops
+struct forall_tls_t {
+    void       *sched;      // forall_Scheduler of the pool (NULL if not a worker)
+    int         wid;        // worker id in the pool
+    int         nested;     // >0 while running the body of a nested loop
+    const void *pending;    // ff_forall_farm whose loop has been set but not yet run
+    long        start, stop, step, chunk;
+    bool        seq;        // the pending loop is executed sequentially with thread id 0
+};
+static inline forall_tls_t &forall_tls() {
+    static thread_local forall_tls_t tls = { NULL, 0, 0, NULL, 0, 0, 1, 0, false };
+    return tls;
+}
+
+// order in which the tiles of a multi-dimensional loop are scheduled
+enum { FF_TILE_ROWMAJOR=0, FF_TILE_MORTON=1, FF_TILE_HILBERT=2 };
+
+/*
+ * Tiling of a 2D/3D iteration space (used by parallel_for_2d/3d).
+ * The space [first[d],last[d]) of each dimension d is divided in tiles of 
+ * tile[d] indexes, the tiles are numbered 0..ntiles()-1 in the requested 
+ * order, that is row-major or along a Morton (Z-order) or Hilbert curve.
+ * With the last two orders consecutive tiles are also close in space, so
+ * a worker computing a chunk of consecutive tiles finds in cache (part of)
+ * the data of the neighbours.
+ */
+struct forall_tiles_t {
+    forall_tiles_t():ndims(0),order(FF_TILE_ROWMAJOR),total(0) {
+        for(int d=0;d<3;++d) first[d]=0,last[d]=1,tile[d]=1,nt[d]=1;
+    }
+
+    // it returns the n. of tiles, the permutation is computed only if the
+    // geometry or the order are different from the previous call
+    inline long set(int dims, const long f[], const long l[], const long t[], int ord) {
+        bool same = (dims==ndims && ord==order);
+        for(int d=0;d<dims;++d) {
+            const long tl = (t[d]>0) ? t[d] : 1;
+            const long n  = (l[d]>f[d]) ? (l[d]-f[d]+tl-1)/tl : 0;
+            same = same && (first[d]==f[d] && last[d]==l[d] && tile[d]==tl);
+            first[d]=f[d], last[d]=l[d], tile[d]=tl, nt[d]=n;
+        }
+        for(int d=dims;d<3;++d) first[d]=0,last[d]=1,tile[d]=1,nt[d]=1;
+        ndims = dims, order = ord;
+        if (same) return total;
+        total = nt[0]*nt[1]*nt[2];
+        perm.clear();
+        if (order == FF_TILE_ROWMAJOR || total<=1) return total;
+
+        int bits = 1;
+        const long maxnt = (std::max)(nt[0],(std::max)(nt[1],nt[2]));
+        while((1L<<bits) < maxnt) ++bits;
+        std::vector<std::pair<unsigned long long,long> > keys(total);
+        for(long k=0;k<total;++k) {
+            unsigned x[3] = { (unsigned)(k/(nt[1]*nt[2])), (unsigned)((k/nt[2])%nt[1]), 
+                              (unsigned)(k%nt[2]) };
+            if (order == FF_TILE_HILBERT) hilbert(x, dims, bits);
+            keys[k] = std::make_pair(interleave(x, dims, bits), k);
+        }
+        std::sort(keys.begin(), keys.end());
+        perm.resize(total);
+        for(long k=0;k<total;++k) perm[k] = keys[k].second;
+        return total;
+    }
+    inline long ntiles() const { return total; }
+
+    // bounds of the k-th tile (in the scheduling order)
+    inline void get(long k, long b[3], long e[3]) const {
+        if (!perm.empty()) k = perm[k];
+        const long c[3] = { k/(nt[1]*nt[2]), (k/nt[2])%nt[1], k%nt[2] };
+        for(int d=0;d<3;++d) {
+            b[d] = first[d] + c[d]*tile[d];
+            e[d] = (std::min)(b[d]+tile[d], last[d]);
+        }
+    }
+
+protected:
+    // bits of the coordinates interleaved starting from the most significant one
+    static inline unsigned long long interleave(const unsigned x[], int n, int bits) {
+        unsigned long long key = 0;
+        for(int b=bits-1;b>=0;--b)
+            for(int i=0;i<n;++i) key = (key<<1) | ((x[i]>>b) & 1);
+        return key;
+    }
+    // coordinates transformed so that their interleaved bits give the position 
+    // along the Hilbert curve (J. Skilling, "Programming the Hilbert curve", 2004)
+    static inline void hilbert(unsigned x[], int n, int bits) {
+        const unsigned M = 1U << (bits-1);
+        unsigned t;
+        for(unsigned Q=M; Q>1; Q>>=1) {
+            const unsigned P = Q-1;
+            for(int i=0;i<n;++i)
+                if (x[i] & Q) x[0] ^= P;
+                else { t = (x[0]^x[i]) & P; x[0] ^= t; x[i] ^= t; }
+        }
+        for(int i=1;i<n;++i) x[i] ^= x[i-1];
+        t = 0;
+        for(unsigned Q=M; Q>1; Q>>=1) if (x[n-1] & Q) t ^= Q-1;
+        for(int i=0;i<n;++i) x[i] ^= t;
+    }
+
+    int  ndims, order;
+    long first[3], last[3], tile[3], nt[3];
+    long total;
+    std::vector<long> perm;  // perm[k]: row-major index of the k-th tile
+};
+
 //  used just to redefine losetime_in
 class foralllb_t: public ff_loadbalancer {
 protected:
@@ -449,7 +637,114 @@ protected:
 #ifdef FF_PARFOR_PASSIVE_NOSTEALING
     std::atomic_long       _nextIteration;
 #endif
+    std::atomic_long       _guidednext;   // next iteration (guided scheduling)
 protected:
+    // guided scheduling: chunks of decreasing size, ~remaining/nw but not
+    // less than _chunk iterations, taken from the shared index _guidednext.
+    // The size depends only on the starting index, so the sequence of chunks
+    // is the same whatever thread takes them.
+    inline long guided_end(long start) const {
+        const long rem = (_stop-start+_step-1)/_step;
+        long c = (rem+_guidednw-1)/_guidednw;
+        if (c < _chunk) c = _chunk;
+        if (c > rem)    c = rem;
+        return start + c*_step;
+    }
+    inline size_t init_guided(long start, long stop) {
+        static_scheduling = false;
+        _guidednw = (long)_nw;
+        _guidednext.store(start);
+        data.resize(_nw); eossent.resize(_nw);
+        if (taskv.size() < _nw) taskv.resize(_nw);
+        skip1=false,jump=0,maxid=-1;
+        for(size_t i=0;i<_nw;++i) { data[i].ntask=0; data[i].task.set(stop,stop); }
+        size_t tt = 0;
+        for(long s=start; s<stop; s=guided_end(s)) ++tt;
+        return tt;
+    }
+
+    // affinity replay: the chunks of a dynamic loop computed by each worker
+    // the first time are recorded; when the same loop (same range, step,
+    // grain and n. of workers) is executed again each worker gets the same
+    // chunks, so that it finds their data in its own cache. A worker that
+    // has finished its own chunks steals (one chunk at a time) from the most
+    // loaded worker only if it has more than replaythr chunks left.
+    // During the replay data[i].task.start is the index of the next chunk
+    // of worker i in its list and data[i].task.end the length of the list.
+    inline forall_replay_t *find_replay(long start, long stop, long step, long chunk, size_t nw) {
+        for(size_t i=0;i<replays.size();++i) {
+            forall_replay_t &r = replays[i];
+            if (r.start==start && r.stop==stop && r.step==step && r.chunk==chunk && r.nw==nw)
+                return &r;
+        }
+        // not found, a new slot is used (the oldest one if all are used)
+        forall_replay_t *r;
+        if (replays.size() < FF_PARFOR_REPLAY_SLOTS) {
+            replays.resize(replays.size()+1);
+            r = &replays.back();
+        } else {
+            r = &replays[nextslot];
+            nextslot = (nextslot+1) % FF_PARFOR_REPLAY_SLOTS;
+        }
+        r->start=start, r->stop=stop, r->step=step, r->chunk=chunk, r->nw=nw;
+        r->lists.clear();
+        return r;
+    }
+    inline size_t init_replay(forall_replay_t *r) {
+        size_t tt = 0;
+        if (r->lists.size() != _nw) return 0;
+        static_scheduling = false;
+        data.resize(_nw); eossent.resize(_nw);
+        if (taskv.size() < _nw) taskv.resize(_nw);
+        skip1=false,jump=0,maxid=-1;
+        for(size_t i=0;i<_nw;++i) {
+            data[i].ntask=0;
+            data[i].task.set(0, (long)r->lists[i].size());
+            tt += r->lists[i].size();
+        }
+        return tt;
+    }
+    inline bool nextReplay(forall_task_t *task, const int wid, const bool force=false) {
+        long id = wid;
+        for(;;) {
+            auto pos = data[id].task.start.load(std::memory_order_acquire);
+            if (pos < data[id].task.end) {
+                if (!data[id].task.start.compare_exchange_weak(pos, pos+1,
+                                                               std::memory_order_release,
+                                                               std::memory_order_relaxed))
+                    continue;
+                const std::pair<long,long> &c = replaying->lists[id][pos];
+                task->set(c.first, c.second);
+                if (id != wid) 
+                    migrated.fetch_add((c.second-c.first+_step-1)/_step, std::memory_order_relaxed);
+                return true;
+            }
+            long maxleft = force ? 0 : replaythr;
+            id = -1;
+            for(size_t i=0;i<_nw;++i) {
+                const long left = data[i].task.end - data[i].task.start.load(std::memory_order_relaxed);
+                if (left > maxleft) maxleft = left, id = (long)i;
+            }
+            if (id < 0) return false;
+        }
+    }
+    inline void record(long start, long end, const int wid) {
+        if (recording) recording->lists[wid].push_back(std::make_pair(start,end));
+    }
+    inline bool nextGuided(forall_task_t *task) {
+        long oldstart = _guidednext.load(std::memory_order_acquire);
+        for(;;) {
+            if (oldstart >= _stop) return false;
+            const long next = guided_end(oldstart);
+            if (_guidednext.compare_exchange_weak(oldstart, next,
+                                                  std::memory_order_release,
+                                                  std::memory_order_acquire)) {
+                task->set(oldstart, (std::min)(next-_step+1, _stop));
+                return true;
+            }
+        }
+    }
+
     // initialize the data vector
     virtual inline size_t init_data(ssize_t start, ssize_t stop) {
         static_scheduling = false;  // enable work stealing in the nextTaskConcurrent
@@ -541,10 +836,16 @@ protected:
 public:
     forall_Scheduler(ff_loadbalancer* lb, long start, long stop, long step, long chunk, size_t nw):
         lb(lb),_start(start),_stop(stop),_step(step),_chunk(chunk),totaltasks(0),_nw(nw),
-        jump(0),skip1(false),workersspinwait(false),static_scheduling(false) {
+        jump(0),skip1(false),workersspinwait(false),static_scheduling(false),
+        guided(false),adaptive(false),_guidednw(1),nsperiter(0.0),lastiters(0),
+        affinity(false),replaythr(FF_PARFOR_REPLAY_THRESHOLD),nextslot(0),
+        recording(NULL),replaying(NULL),nslots(new forall_nested_slot_t[nw]),nslotsize(nw) {
+        migrated.store(0);
+        nactive.store(0); hasnested.store(false); nestedhint.store(false); leased.store(0);
 #ifdef FF_PARFOR_PASSIVE_NOSTEALING
         _nextIteration = _start;
 #endif
+        _guidednext.store(_stop);
 		maxid.store(-1); // MA: consistency of store to be checked
         if (_chunk<=0) totaltasks = init_data_static(start,stop);
         else           totaltasks = init_data(start,stop);
@@ -552,18 +853,25 @@ public:
     }
     forall_Scheduler(ff_loadbalancer* lb, size_t nw):
         lb(lb),_start(0),_stop(0),_step(1),_chunk(1),totaltasks(0),_nw(nw),
-        jump(0),skip1(false),workersspinwait(false),static_scheduling(false) {
+        jump(0),skip1(false),workersspinwait(false),static_scheduling(false),
+        guided(false),adaptive(false),_guidednw(1),nsperiter(0.0),lastiters(0),
+        affinity(false),replaythr(FF_PARFOR_REPLAY_THRESHOLD),nextslot(0),
+        recording(NULL),replaying(NULL),nslots(new forall_nested_slot_t[nw]),nslotsize(nw) {
+        migrated.store(0);
+        nactive.store(0); hasnested.store(false); nestedhint.store(false); leased.store(0);
 #ifdef FF_PARFOR_PASSIVE_NOSTEALING
         _nextIteration = 0;
 #endif
+        _guidednext.store(0);
 		maxid.store(-1); // MA: consistency of store to be checked
         totaltasks = init_data(0,0);
         assert(totaltasks==0);
     }
+    ~forall_Scheduler() { delete [] nslots; }
 
 #ifdef FF_PARFOR_PASSIVE_NOSTEALING
     inline bool canUseNoStealing(){
-        return !globalSchedRunning && !static_scheduling && _step == 1 && _chunk == 1;
+        return !globalSchedRunning && !static_scheduling && !guided && !affinity && _step == 1 && _chunk == 1;
     }
 #endif
     inline bool sendTask(const bool skipmore=false) {
@@ -579,12 +887,32 @@ public:
         size_t remaining    = totaltasks;
         const long endchunk = (_chunk-1)*_step + 1;
 
+        if (guided) {
+            for(size_t wid=0;wid<_nw;++wid) {
+                if (!nextGuided(&taskv[wid])) break;
+                lb->ff_send_out_to(&taskv[wid], (int) wid);
+                --remaining;
+                eossent[wid]=false;
+            }
+            return (remaining>0);
+        }
+        if (replaying) {
+            // each worker starts with its own first chunk (or steals one if it has none)
+            for(size_t wid=0;wid<_nw;++wid) {
+                if (!nextReplay(&taskv[wid], (int)wid, true)) break;
+                lb->ff_send_out_to(&taskv[wid], (int) wid);
+                --remaining;
+                eossent[wid]=false;
+            }
+            return (remaining>0);
+        }
     more:
         for(size_t wid=0;wid<_nw;++wid) {
             if (data[wid].ntask >0) {
                 long start = data[wid].task.start;
                 long end   = (std::min)(start+endchunk, data[wid].task.end);
                 taskv[wid+jump].set(start, end);
+                record(start, end, (int)wid);
                 lb->ff_send_out_to(&taskv[wid+jump], (int) wid);
                 --remaining, --data[wid].ntask;
                 (data[wid].task).start = (end-1)+_step;  
@@ -629,6 +957,8 @@ public:
             return nextTaskConcurrentNoStealing(task, wid);
         }
 #endif
+        if (guided) return nextGuided(task);
+        if (replaying) return nextReplay(task, wid);
         const long endchunk = (_chunk-1)*_step + 1; // next end-point
         auto id  = wid;
     L1:
@@ -648,6 +978,7 @@ public:
             data[id].ntask.fetch_sub(1,std::memory_order_release);   
             if (oldstart<end) { // it might be possible that oldstart == end
                 task->set(oldstart, end); 
+                record(oldstart, end, wid);
                 return true;
             }
         }
@@ -715,6 +1046,8 @@ public:
                 return nextTaskConcurrentNoStealing(task, wid);
         }
 #endif
+        if (guided) return nextGuided(task);
+        if (replaying) return nextReplay(task, wid);
         const long endchunk = (_chunk-1)*_step + 1;
         int id  = wid;
         if (data[id].ntask) {
@@ -723,6 +1056,7 @@ public:
             long end = (std::min)(start+endchunk, data[id].task.end);
             --data[id].ntask, (data[id].task).start = (end-1)+_step;
             task->set(start, end);
+            record(start, end, wid);
             return true;
         }
         // no available task for the current thread
@@ -793,17 +1127,49 @@ public:
     }
 
     inline void setloop(long start, long stop, long step, long chunk, size_t nw) {
+        const long rchunk = chunk;
+        guided   = (chunk>0) && (chunk & FF_PARFOR_GUIDED_FLAG);
+        adaptive = (chunk>0) && (chunk & FF_PARFOR_ADAPTIVE_FLAG);
+        if (chunk>0) chunk &= ~FF_PARFOR_FLAGS;
         _start=start, _stop=stop, _step=step, _chunk=chunk, _nw=nw;
+        nestedhint.store(hasnested.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        hasnested.store(false, std::memory_order_relaxed);
 #ifdef FF_PARFOR_PASSIVE_NOSTEALING
         _nextIteration = _start;
 #endif
-        if (_chunk<=0) totaltasks = init_data_static(start,stop);
-        else           totaltasks = init_data(start,stop);
+        lastiters = (stop>start) ? (stop-start+step-1)/step : 0;
+        if (adaptive) {
+            // the grain is chosen so that one chunk lasts about
+            // FF_PARFOR_ADAPTIVE_GRAIN_NS, according to the cost of the
+            // iterations measured in the previous adaptive loops.
+            // The very first time guided scheduling is used.
+            if (nsperiter <= 0.0) guided = true, _chunk = 1;
+            else {
+                const long maxgrain = (std::max)(1L, lastiters/(4*(long)_nw));
+                const long g = std::lrint(FF_PARFOR_ADAPTIVE_GRAIN_NS / nsperiter);
+                _chunk = (std::max)(1L, (std::min)(g, maxgrain));
+            }
+        }
+        recording = replaying = NULL;
+        if (affinity && rchunk>0 && !guided && !adaptive) {
+            forall_replay_t *r = find_replay(start,stop,step,rchunk,nw);
+            const size_t tt    = init_replay(r);
+            if (tt > _nw) replaying = r, totaltasks = tt;
+            else {
+                recording = r;
+                r->lists.assign(_nw, std::vector<std::pair<long,long> >());
+            }
+        }
+        if (replaying) ;
+        else if (guided)     totaltasks = init_guided(start,stop);
+        else if (_chunk<=0)  totaltasks = init_data_static(start,stop);
+        else                 totaltasks = init_data(start,stop);
 
         assert(totaltasks>=1);        
         // adjust the number of workers that have to be started
         if ( (totaltasks/(double)_nw) <= 1.0 || (totaltasks==1) )
            _nw = totaltasks;
+        nactive.store((long)_nw);
     }
 
     inline long startIdx() const { return _start;}
@@ -812,6 +1178,101 @@ public:
     inline size_t running() const { return _nw; }
     inline void workersSpinWait() { workersspinwait=true;}
     inline size_t getnumtasks() const { return totaltasks;}
+
+    inline bool isadaptive() const { return adaptive; }
+    // called at the end of an adaptive loop executed by nw threads in ns nanoseconds
+    inline void adaptiveDone(size_t nw, ff_time_t ns) {
+        if (!adaptive || lastiters <= 0) return;
+        const double x = (double)ns * nw / lastiters;
+        nsperiter = (nsperiter <= 0.0) ? x : (nsperiter + x)/2.0;
+    }
+    // the last grain used (for adaptive loops: the one chosen by the policy)
+    inline long getgrain() const { return _chunk; }
+
+    // Executes the nested loop (start,stop( set by the worker wid while running
+    // the body of the current loop. The loop is published in the worker's slot 
+    // and split in chunks taken one at a time by the worker and by the workers 
+    // that have finished their own iterations (see workerDone); if no worker 
+    // is idle the calling worker executes all of them. A loop nested in a loop 
+    // that is already nested is executed sequentially.
+    inline void runNested(long start, long stop, long step, long chunk, 
+                          const std::function<void(const long,const long,const int)> &F,
+                          const int wid) {
+        if (start >= stop) return;
+        const long n = (stop-start+step-1)/step;
+        long grain;
+        if      (chunk>0) grain = chunk & ~FF_PARFOR_FLAGS;
+        else if (chunk<0) grain = -chunk;
+        else              grain = (std::max)(1L, n/(4*(long)nslotsize));
+        forall_nested_slot_t &s = nslots[wid];
+        if (n <= grain || s.loop.load(std::memory_order_relaxed) != NULL) {
+            F(start, stop, wid);
+            return;
+        }
+        forall_nested_t l;
+        l.next.store(start);
+        l.stop = stop, l.span = grain*step, l.F = &F;
+        hasnested.store(true, std::memory_order_relaxed);
+        s.loop.store(&l);
+        runChunks(l, wid);
+        s.loop.store(NULL);
+        // waits for the helpers still running a chunk
+        while(s.users.load() != 0) PAUSE();
+    }
+    // runs the chunks of the nested loops published by the other workers
+    inline bool helpNested(const int wid) {
+        bool done = false;
+        for(size_t k=1;k<nslotsize;++k) {
+            forall_nested_slot_t &s = nslots[(wid+k) % nslotsize];
+            if (s.loop.load(std::memory_order_relaxed) == NULL) continue;
+            s.users.fetch_add(1);
+            forall_nested_t *l = s.loop.load();
+            if (l) done |= runChunks(*l, wid);
+            s.users.fetch_sub(1);
+        }
+        return done;
+    }
+    // called by the worker wid (decentralized engine) when there are no more 
+    // iterations of the current loop for it: if nested loops have been used
+    // in the previous loop (i.e. the body is likely to use them again) or 
+    // already in the current one, it helps the other workers until all of 
+    // them have finished. Otherwise it returns at once: in the first loop 
+    // using nested loops, the workers finishing before the first nested loop
+    // is published do not help.
+    inline void workerDone(const int wid) {
+        if (nactive.fetch_sub(1) == 1) return;
+        if (!nestedhint.load(std::memory_order_relaxed) &&
+            !hasnested.load(std::memory_order_relaxed)) return;
+        forall_tls_t &tls = forall_tls();
+        ++tls.nested;
+        while(nactive.load() > 0)
+            if (!helpNested(wid)) PAUSE();
+        --tls.nested;
+    }
+    // n. of worker threads of the pool (the ids of the workers are in [0,poolsize))
+    inline size_t poolsize() const { return nslotsize; }
+
+    inline void setAffinityReplay(bool onoff, long threshold) {
+        affinity = onoff, replaythr = (threshold<0)?0:threshold;
+        if (!onoff) { replays.clear(); nextslot=0; recording = replaying = NULL; }
+    }
+    // n. of iterations computed by a worker different from the recorded one
+    inline unsigned long getmigrated() const { return migrated.load(); }
+    inline void resetmigrated() { migrated.store(0); }
+
+    // n. of workers leased from the budget for the current loop (0 if idle)
+    inline void   setleased(size_t n) { leased.store((long)n, std::memory_order_relaxed); }
+    inline size_t getleased() const   { return (size_t)leased.load(std::memory_order_relaxed); }
+protected:
+    static inline bool runChunks(forall_nested_t &l, const int wid) {
+        bool done = false;
+        for(;;) {
+            const long b = l.next.fetch_add(l.span);
+            if (b >= l.stop) return done;
+            (*l.F)(b, (std::min)(b+l.span, l.stop), wid);
+            done = true;
+        }
+    }
 protected:
     // the following fields are used only by the scheduler thread
     ff_loadbalancer *lb;
@@ -823,18 +1284,39 @@ protected:
     bool             skip1;
     bool             workersspinwait;
     bool             static_scheduling;
+    bool             guided;              // PARFOR_GUIDED (or first PARFOR_ADAPTIVE loop)
+    bool             adaptive;            // PARFOR_ADAPTIVE
+    long             _guidednw;           // n. of workers used to size the guided chunks
+    double           nsperiter;           // estimated cost (ns) of one iteration
+    long             lastiters;           // n. of iterations of the current loop
+    bool             affinity;            // affinity replay enabled
+    long             replaythr;           // stealing threshold (chunks) for the replay
+    size_t           nextslot;
+    std::vector<forall_replay_t> replays; // loops recorded
+    forall_replay_t *recording;           // the current loop is being recorded
+    forall_replay_t *replaying;           // the current loop is being replayed
+    std::atomic<unsigned long> migrated;
     std::vector<forall_task_t> taskv;
+    forall_nested_slot_t *nslots;         // nested loops, one slot per worker
+    size_t           nslotsize;
+    std::atomic_long nactive;             // workers still running the current loop
+    std::atomic<bool> hasnested;          // nested loops have been used in the current loop
+    std::atomic<bool> nestedhint;         // nested loops have been used in the previous loop
+    std::atomic_long leased;              // workers leased from the budget
 };
 
 // parallel for/reduce  worker node
 template<typename Tres>
 class forallreduce_W: public ff_node {
 public:
+    enum { nestable=1 };  // loops set by the body are executed as nested loops
     typedef Tres Tres_t;
     typedef std::function<void(const long,const long, const int, Tres&)> F_t;
 protected:
     virtual inline void losetime_in(unsigned long) {
         //FFTRACE(lostpopticks+=ff_node::TICKS2WAIT; ++popwait); // FIX
+        // the workers spinning between two loops leave the cores to the other skeletons
+        if (ff_budget_park(sched->getleased()==0)) return;
         workerlosetime_in(aggressive);
     }
 public:
@@ -847,23 +1329,26 @@ public:
     inline void* svc(void* t) {
         auto task = (forall_task_t*)t;
         auto myid = get_my_id();
+        forall_tls_t &tls = forall_tls();
+        tls.sched = sched, tls.wid = (int)myid;
 
 #ifdef FF_PARFOR_PASSIVE_NOSTEALING
         forall_task_t tmptask;
         if(t != (void*) &dummyTask || schedRunning){
-           F(task->start,task->end,myid,res);
+           if (task->start < task->end) F(task->start,task->end,myid,res);
            if (schedRunning) return t;
         }else{
            task = &tmptask;
         }
 #else
-        F(task->start,task->end,myid,res);
+        if (task->start < task->end) F(task->start,task->end,myid,res);
         if (schedRunning) return t;
 #endif
 
         // the code below is executed only if the scheduler thread is not running
         while(sched->nextTaskConcurrent(task,myid))
             F(task->start,task->end,myid,res);
+        sched->workerDone((int)myid);
         
         if (spinwait) {
             loopbar->doBarrier(myid);
@@ -892,6 +1377,7 @@ protected:
 
 class forallpipereduce_W: public forallreduce_W<ff_buffernode> {
 public:
+    enum { nestable=0 };
     typedef ff_buffernode Tres_t;
     typedef std::function<void(const long,const long, const int, ff_buffernode&)> F_t;
 public:
@@ -902,7 +1388,7 @@ public:
         auto task = (forall_task_t*)t;
         auto myid = get_my_id();
 
-        F(task->start,task->end,myid,res);
+        if (task->start < task->end) F(task->start,task->end,myid,res);
         if (schedRunning) return t;
 
         // the code below is executed only if the scheduler thread is not running
@@ -954,6 +1440,7 @@ public:
                  (ffBarrier*)(new spinBarrier(maxnw<=0?DEF_MAX_NUM_WORKERS+1:(size_t)(maxnw+1))) :
                  (ffBarrier*)(new Barrier(maxnw<=0?DEF_MAX_NUM_WORKERS+1:(size_t)(maxnw+1))) ),
         skipwarmup(skipwarmup),spinwait(spinwait) {
+        budgeted = false;  // the workers are leased loop by loop, see setloop
         numCores = ((foralllb_t*const)getlb())->getNCores();
         if (maxnw<=0) maxnw=numCores;
         std::vector<ff_node *> forall_w;
@@ -997,7 +1484,8 @@ public:
 
     // It returns true if the scheduler has to be started, false otherwise.
     //
-    // Unless the removeSched flag is set, the scheduler thread will be started 
+    // Unless the removeSched flag is set (default, see parfor_scheduler_default), 
+    // the scheduler thread will be started 
     // only if there are less threads than cores AND if the number of tasks per thread 
     // is greather than 1. In case of static scheduling (i.e. chunk<=0), the scheduler 
     // is never started because numtasks == nwtostart;
@@ -1027,10 +1515,25 @@ public:
     // ff_numCores() > ff_realNumCores() (i.e. HT or HMT is enabled)
     inline void disableScheduler(bool onoff=true) { removeSched=onoff; }
 
+    // Enables/disables the affinity replay of the dynamic loops: the 
+    // chunk-to-worker assignment of the first execution of a loop is 
+    // recorded and then replayed each time the same loop (same range, step, 
+    // grain and n. of workers) is executed again. A worker steals chunks only 
+    // from workers having more than threshold chunks left.
+    inline void affinityReplay(bool onoff=true, long threshold=FF_PARFOR_REPLAY_THRESHOLD) {
+        ((forall_Scheduler*)getEmitter())->setAffinityReplay(onoff, threshold);
+    }
+    // n. of iterations migrated (i.e. stolen) during the replayed loops
+    inline unsigned long getMigrated() const { 
+        return ((const forall_Scheduler*)getEmitter())->getmigrated(); 
+    }
+    inline void resetMigrated() { ((forall_Scheduler*)getEmitter())->resetmigrated(); }
+
     inline int run_then_freeze(ssize_t nw_=-1) {
         assert(skipwarmup == false);
         const ssize_t nwtostart = (nw_ == -1)?getNWorkers():nw_;
         auto r = -1;
+        loopstart = ff_gettime();
         if (schedRunning) {
             getlb()->skipfirstpop();
             if (spinwait) {
@@ -1039,15 +1542,15 @@ public:
             }
             r=ff_farm<foralllb_t>::run_then_freeze(nwtostart);
         } else {
+            // decentralized engine: the workers are just woken up, then each one
+            // takes its chunks from the task table by itself
             if (spinwait) {
                 // all worker threads have already crossed the barrier so it is safe to restart it
                 loopbar->barrierSetup(nwtostart+1);
                 // NOTE: here is not possible to use sendTask because otherwise there could be 
                 //       a race between the main thread and the workers in accessing the task table.
-                ((forall_Scheduler*)getEmitter())->sendWakeUp(); 
-            } else 
-                ((forall_Scheduler*)getEmitter())->sendTask(true);
-
+            }
+            ((forall_Scheduler*)getEmitter())->sendWakeUp(); 
             r = getlb()->thawWorkers(true, nwtostart);
         }
         return r;
@@ -1057,6 +1560,7 @@ public:
         assert(spinwait == false); 
         const size_t nwtostart = getnw();
         auto r= -1;
+        loopstart = ff_gettime();
         if (schedRunning) {
             //resetqueues(nwtostart);
             getlb()->skipfirstpop(); 
@@ -1066,10 +1570,11 @@ public:
                     r = getlb()->wait();
             }
         } else {
-            ((forall_Scheduler*)getEmitter())->sendTask(true);
+            ((forall_Scheduler*)getEmitter())->sendWakeUp();
             if (getlb()->runWorkers(nwtostart) != -1)
                 r = getlb()->waitWorkers();
         }
+        loopdone();
         return r;
     }
     
@@ -1099,13 +1604,13 @@ public:
     }
 
     inline int wait_freezing() {
+        auto r = 0;
         //if (startScheduler(getnw())) return getlb()->wait_lb_freezing();
-        if (schedRunning) return getlb()->wait_lb_freezing();
-        if (spinwait) { 
-            loopbar->doBarrier(getnw()); 
-            return 0;
-        }
-        return getlb()->wait_freezingWorkers();
+        if (schedRunning) r = getlb()->wait_lb_freezing();
+        else if (spinwait) loopbar->doBarrier(getnw()); 
+        else r = getlb()->wait_freezingWorkers();
+        loopdone();
+        return r;
     }
     
     inline int wait() {
@@ -1156,14 +1661,75 @@ public:
      *                   the iteration space is divided in chunks each one of no more 
      *                   than chunk iterations. Then chunks are assigned to the threads 
      *                   in a round-robin fashion.
+     *       - PARFOR_GUIDED(min) means dynamic scheduling with chunks of decreasing
+     *                   size (~remaining iterations/nw) but not smaller than min
+     *       - PARFOR_ADAPTIVE means dynamic scheduling with the grain computed from the 
+     *                   cost of the iterations measured in the previous PARFOR_ADAPTIVE 
+     *                   loops executed by this object (guided the first time)
      */
     inline void setloop(long begin,long end,long step,long chunk,long nw) {
-        assert(nw<=(ssize_t)getNWorkers());
+        forall_tls_t &tls = forall_tls();
         forall_Scheduler *sched = (forall_Scheduler*)getEmitter();
-        sched->setloop(begin,end,step,chunk,(nw<=0)?getNWorkers():(size_t)nw);
+        if (Worker_t::nestable && tls.sched) {
+            // called by the body of a loop: if the ids of the workers of the 
+            // outer pool are valid thread ids for this object (same pool, or
+            // at least as many workers), this object is left untouched and the
+            // loop is executed by runNested/runNestedReduce. Otherwise it is 
+            // executed by the threads of this object or, inside the body of a
+            // nested loop, sequentially with thread id 0 (this object is left
+            // untouched also in this case)
+            const forall_Scheduler *outer = (const forall_Scheduler*)tls.sched;
+            const bool sameids = (outer == sched || getNWorkers() >= outer->poolsize());
+            if (sameids || tls.nested) {
+                tls.pending = this, tls.seq = !sameids;
+                tls.start = begin, tls.stop = end, tls.step = step, tls.chunk = chunk;
+                return;
+            }
+        }
+        assert(nw<=(ssize_t)getNWorkers());
+        // the workers are leased from the process-wide budget (see budget.hpp), 
+        // if none is available the loop is executed by the calling thread
+        loopdone(false);
+        ff_budget &budget = ff_budget::instance();
+        const size_t got  = budget.acquire((nw<=0)?getNWorkers():(size_t)nw);
+        sched->setloop(begin,end,step,chunk,(got>0)?got:1);
+        const size_t run  = (sched->running()>1) ? sched->running() : 0;
+        if (got > run) {
+            if (run) budget.shrink(got-run);
+            else     budget.release(got);
+        }
+        sched->setleased((std::min)(got,run));
     }
     // return the number of workers running or supposed to run
-    inline size_t getnw() { return ((const forall_Scheduler*)getEmitter())->running(); }
+    // (1 inside the body of a nested loop)
+    inline size_t getnw() { 
+        if (forall_tls().nested) return 1;
+        return ((const forall_Scheduler*)getEmitter())->running(); 
+    }
+
+    // true if the last setloop has been called by the body of a loop
+    inline bool nested() const { return forall_tls().pending == this; }
+    // executes the nested loop on the pool of the calling worker
+    template<typename Fn>
+    inline void runNested(const Fn &F) {
+        forall_tls_t &tls = forall_tls();
+        tls.pending = NULL;
+        const std::function<void(const long,const long,const int)> body = 
+            [&F](const long s, const long e, const int id) { F(s,e,id,Tres_t()); };
+        ++tls.nested;
+        if (tls.seq) { if (tls.start < tls.stop) body(tls.start,tls.stop,0); }
+        else ((forall_Scheduler*)tls.sched)->runNested(tls.start,tls.stop,tls.step,tls.chunk,body,tls.wid);
+        --tls.nested;
+    }
+    // nested reductions are executed sequentially by the calling worker
+    template<typename Fn, typename V>
+    inline void runNestedReduce(const Fn &F, V &var) {
+        forall_tls_t &tls = forall_tls();
+        tls.pending = NULL;
+        ++tls.nested;
+        if (tls.start < tls.stop) F(tls.start,tls.stop,tls.seq?0:tls.wid,var);
+        --tls.nested;
+    }
     
     inline const Tres_t& getres(int i) {
         //return  ((forallreduce_W<Tres>*)(getWorkers()[i]))->getres();
@@ -1175,7 +1741,17 @@ public:
 
     void resetskipwarmup() { assert(skipwarmup); skipwarmup=false;}
 protected:
-    bool   removeSched = false;
+    // gives back the leased workers and feeds the adaptive policy with the 
+    // completion time of the loop
+    inline void loopdone(bool completed=true) {
+        forall_Scheduler *sched = (forall_Scheduler*)getEmitter();
+        const size_t n = sched->getleased();
+        if (n) { ff_budget::instance().release(n); sched->setleased(0); }
+        if (completed && sched->isadaptive()) sched->adaptiveDone(getnw(), ff_gettime()-loopstart);
+    }
+protected:
+    ff_time_t loopstart= 0;
+    bool   removeSched = !parfor_scheduler_default();
     bool   schedRunning= true;
     bool   skipwarmup  = false;
     bool   spinwait    = false;
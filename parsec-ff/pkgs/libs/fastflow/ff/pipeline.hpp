@@ -30,15 +30,31 @@
 #define FF_PIPELINE_HPP
 
 #include <cassert>
+#include <cstdio>
+#include <vector>
 #include <memory>
 #include <functional>
 #include <ff/svector.hpp>
 #include <ff/fftree.hpp>
 #include <ff/node.hpp>
+#include <ff/combine.hpp>
 #include <ff/ocl/clEnvironment.hpp>
+#if (__cplusplus >= 201103L) || (defined __GXX_EXPERIMENTAL_CXX0X__) || (defined(HAS_CXX11_VARIADIC_TEMPLATES))
+#include <ff/make_unique.hpp>
+#endif
 
 namespace ff {
 
+// max fraction of the pipeline execution time a fused thread can be busy
+#if !defined(FF_FUSION_MAXLOAD)
+#define FF_FUSION_MAXLOAD 0.9
+#endif
+// default input batch of the sequential stages (see ff_node::set_input_batch),
+// 1 (the default) disables it, e.g. -DFF_PIPE_INBATCH=16 enables it
+#if !defined(FF_PIPE_INBATCH)
+#define FF_PIPE_INBATCH 1
+#endif
+
 /**
  * \class ff_pipeline
  * \ingroup core_patterns
@@ -49,6 +65,7 @@ namespace ff {
 class ff_pipeline: public ff_node {
 protected:
     inline int prepare() {
+        if (fuse()<0) return -1;
         // create input FFBUFFER
         const int nstages=static_cast<int>(nodes_list.size());
         for(int i=1;i<nstages;++i) {
@@ -88,11 +105,21 @@ protected:
                         }
                     }
                 }
-            } else {
+            } else if (!nodes_list[i]->get_in_channel()) {
                 if (nodes_list[i]->create_input_buffer(in_buffer_entries, fixedsize)<0) {
                     error("PIPE, creating input buffer for node %d\n", i);
                     return -1;
                 }
+                // a sequential stage pops from its own SWSR channel: if 
+                // FF_PIPE_INBATCH>1 it takes all the tasks available (up to
+                // FF_PIPE_INBATCH) at a time, unless the batch size has been 
+                // set by the user
+                if ((FF_PIPE_INBATCH>1) && fusible(nodes_list[i]) && 
+                    !nodes_list[i]->inbatch_size &&
+                    nodes_list[i]->set_input_batch(FF_PIPE_INBATCH)<0) {
+                    error("PIPE, setting the input batch for node %d\n", i);
+                    return -1;
+                }
             }
         }
         
@@ -107,7 +134,14 @@ protected:
                 return -1;
             }
             nodes_list[i+1]->set_input_blocking(m,c,counter);
-            if (nodes_list[i]->isMultiOutput()) {
+            if (nodes_list[i+1]->get_in_channel()) {
+                // farm without emitter: the node pushes into the channel of the farm
+                if (nodes_list[i]->isMultiOutput() ||
+                    nodes_list[i]->set_output_channel(nodes_list[i+1]->get_in_channel())<0) {
+                    error("PIPE, setting output channel to node %d\n", i);
+                    return -1;
+                }
+            } else if (nodes_list[i]->isMultiOutput()) {
                 nodes_list[i]->set_output(nodes_list[i+1]);
             } else {
                 if (nodes_list[i]->set_output_buffer(nodes_list[i+1]->get_in_buffer())<0) {
@@ -181,6 +215,7 @@ protected:
 
 
     int freeze_and_run(bool skip_init=false) {
+        if (fuse()<0) return -1;
         int nstages=static_cast<int>(nodes_list.size());
         if (!skip_init) {            
             // set the initial value for the barrier 
@@ -234,6 +269,8 @@ public:
      */
     virtual ~ff_pipeline() {
         if (barrier) delete barrier;
+        for(size_t i=0;i<combs.size();++i) delete combs[i];
+        if (combs.size()) nodes_list = stages;
         if (node_cleanup) {
             while(nodes_list.size()>0) {
                 ff_node *n = nodes_list.back();
@@ -260,6 +297,16 @@ public:
     void setXNodeInputQueueLength(int sz)  { in_buffer_entries = sz; }
     void setXNodeOutputQueueLength(int sz) { out_buffer_entries = sz;}
 
+    /**
+     * \brief Sets the waiting policy of all the stages added so far
+     *
+     * Farm stages propagate it to their emitter, collector and workers
+     * (see waitpolicy.hpp).
+     */
+    void set_wait_policy(ff_wait_t p) {
+        for(size_t i=0;i<nodes_list.size();++i) nodes_list[i]->set_wait_policy(p);
+    }
+
 
     /**
      *  \brief It adds a stage to the pipeline
@@ -297,6 +344,7 @@ public:
             error("PIPE, too few pipeline nodes\n");
             return -1;
         }
+        if (fuse()<0) return -1;
         const int last = static_cast<int>(nodes_list.size())-1;
 
         pthread_mutex_t   *mi        = NULL;
@@ -368,6 +416,68 @@ public:
      */
     const svector<ff_node*>& getStages() const { return nodes_list; }
 
+    /**
+     * \brief Enables the fusion of the sequential stages
+     *
+     * Adjacent sequential stages are executed by one thread (see \ref ff_comb)
+     * when the thread would be busy at most \p maxload of the pipeline
+     * execution time, so that the pipeline has fewer threads without
+     * lowering its throughput.
+     * The service times of the stages are the ones measured in a previous
+     * execution and stored in the \p profile file: if the file does not
+     * exist (or it has been written by a different pipeline) the stages are
+     * not fused. The file is (re)written by \p wait with the times measured
+     * in the current execution.
+     * The stages are fused when the pipeline is started (or explicitly by
+     * calling \p fuse), thus this method must be called before.
+     * Stages that are farms, pipelines or multi-input/multi-output nodes are
+     * never fused, the stages of a pipeline with a feedback channel are
+     * fused only if this method is called before \p wrap_around.
+     *
+     * \param profile the profile file (NULL disables the fusion)
+     * \param maxload max fraction of the execution time a fused thread is busy
+     */
+    void set_fusion(const char *profile, double maxload=FF_FUSION_MAXLOAD) {
+        fusion_profile = profile;
+        fusion_maxload = maxload;
+    }
+
+    /**
+     * \brief Fuses the sequential stages (see \p set_fusion)
+     *
+     * It is called when the pipeline is started, it can be called before to
+     * know how many threads are saved (e.g. to give them to a farm).
+     *
+     * \return the number of threads saved, -1 on error
+     */
+    int fuse() {
+        if (fused || !fusion_profile) return 0;
+        fused = true;
+        std::vector<double> load;
+        if (read_profile(load)<0) return 0;
+
+        svector<ff_node*> list;
+        const size_t nstages = nodes_list.size();
+        for(size_t i=0;i<nstages;) {
+            ff_node *node = nodes_list[i];
+            double sum = load[i];
+            size_t j = i+1;
+            if (sum>=0)
+                for(; j<nstages && load[j]>=0 && (sum+load[j])<=fusion_maxload; ++j) {
+                    node = new ff_comb(node, nodes_list[j]);
+                    if (!node) return -1;
+                    combs.push_back(node);
+                    sum += load[j];
+                }
+            list.push_back(node);
+            i = j;
+        }
+        if (combs.size()==0) return 0;
+        stages = nodes_list;
+        nodes_list = list;
+        return static_cast<int>(combs.size());
+    }
+
     /**
      * \brief Run the pipeline skeleton asynchronously
      * 
@@ -375,6 +485,7 @@ public:
      * \ref ff_pipeline::wait()
      */
     int run(bool skip_init=false) {
+        if (fuse()<0) return -1;
         int nstages=static_cast<int>(nodes_list.size());
 
         if (!skip_init) {            
@@ -466,7 +577,7 @@ public:
                 error("PIPE, waiting stage thread, id = %d\n",nodes_list[i]->get_my_id());
                 ret = -1;
             } 
-        
+        if (ret==0 && fusion_profile) ret = write_profile();
         return ret;
     }
     
@@ -538,7 +649,10 @@ public:
              goto _retry;
          }
          for(unsigned long i=0;i<retry;++i) {
-            if (inbuffer->push(task)) return true;
+            if (inbuffer->push(task)) { 
+                ff_wakeup_consumer(inbuffer); 
+                return true; 
+            }
             losetime_out(ticks);
         }     
         return false;
@@ -593,6 +707,7 @@ public:
         }
         for(unsigned long i=0;i<retry;++i) {
             if (outbuffer->pop(task)) {
+                ff_wakeup_producer(outbuffer);
                 if ((*task != (void *)FF_EOS)) return true;
                 else return false;
             }
@@ -613,7 +728,7 @@ public:
     inline bool load_result_nb(void ** task) {
         FFBUFFER * outbuffer = get_out_buffer();
         if (outbuffer) {
-            if (outbuffer->pop(task)) return true;
+            if (outbuffer->pop(task)) { ff_wakeup_producer(outbuffer); return true; }
             else return false;
         }
         
@@ -626,6 +741,8 @@ public:
     
 
     int cardinality(BARRIER_T * const barrier)  { 
+        // first method called when the pipeline (or the enclosing skeleton) is started
+        if (fuse()<0) return -1;
         int card=0;
         for(unsigned int i=0;i<nodes_list.size();++i) 
             card += nodes_list[i]->cardinality(barrier);
@@ -768,6 +885,22 @@ protected:
         return 0;
     }
 
+    int set_input_channel(ff_mpmc_channel * const c) {
+        if (nodes_list.size()==0) return -1;
+        return nodes_list[0]->set_input_channel(c);
+    }
+
+    int set_output_channel(ff_mpmc_channel * const c) {
+        int last = static_cast<int>(nodes_list.size())-1;
+        if (last<0) return -1;
+        return nodes_list[last]->set_output_channel(c);
+    }
+
+    ff_mpmc_channel * get_in_channel() const {
+        if (nodes_list.size()==0) return NULL;
+        return nodes_list[0]->get_in_channel();
+    }
+
     inline bool isMultiInput() const { 
         if (nodes_list.size()==0) return false;
         return nodes_list[0]->isMultiInput();
@@ -789,6 +922,55 @@ protected:
     }
 
 private:
+    // stages that can be fused (see ff_pipeline::set_fusion)
+    static inline bool fusible(const ff_node *n) {
+        return (n->getFFType()==WORKER) && !n->isMultiInput() && !n->isMultiOutput();
+    }
+
+    /* The profile has one line per stage (before the fusion):
+     *   <stage> <fusible> <load> <avg svc time (ns)> <n. of tasks>
+     * where load is the fraction of the pipeline execution time spent in svc,
+     * not counting the waits in ff_send_out (-1 for the stages that cannot 
+     * be fused).
+     */
+    int read_profile(std::vector<double> &load) {
+        FILE *f = fopen(fusion_profile, "r");
+        if (!f) return -1;
+        const size_t nstages = nodes_list.size();
+        load.assign(nstages, -1.0);
+        size_t n = 0;
+        int ret = (fscanf(f, "ff_pipeline %zu\n", &n)==1 && n==nstages) ? 0 : -1;
+        for(size_t i=0; ret==0 && i<nstages; ++i) {
+            size_t stage, cnt;
+            int isfusible;
+            double l, avg;
+            if (fscanf(f, "%zu %d %lf %lf %zu\n", &stage, &isfusible, &l, &avg, &cnt)!=5 ||
+                stage!=i || isfusible!=(int)fusible(nodes_list[i])) ret = -1;
+            else if (isfusible) load[i] = l;
+        }
+        fclose(f);
+        return ret;
+    }
+
+    int write_profile() {
+        const svector<ff_node*> &l = combs.size() ? stages : nodes_list;
+        const double t = ffwTime();
+        FILE *f = fopen(fusion_profile, "w");
+        if (!f) {
+            error("PIPE, cannot write the profile %s\n", fusion_profile);
+            return -1;
+        }
+        fprintf(f, "ff_pipeline %zu\n", l.size());
+        for(size_t i=0;i<l.size();++i) {
+            const bool isfusible = fusible(l[i]);
+            const double load = (isfusible && t>0) ? l[i]->getsvctime()/t : -1.0;
+            fprintf(f, "%zu %d %g %g %zu\n", i, (int)isfusible, load,
+                    l[i]->getsvcavg(), l[i]->getsvccnt());
+        }
+        fclose(f);
+        return 0;
+    }
+
     bool has_input_channel; // for accelerator
     bool prepared;
     bool node_cleanup;
@@ -797,6 +979,11 @@ private:
     int out_buffer_entries;
     svector<ff_node *> nodes_list;
     svector<ff_node*>  internalSupportNodes;
+    const char        *fusion_profile = NULL;
+    double             fusion_maxload = FF_FUSION_MAXLOAD;
+    bool               fused = false;
+    svector<ff_node*>  stages;   // stages added, if some of them have been fused
+    svector<ff_node*>  combs;    // ff_comb created by the fusion
 };
 
 
@@ -804,8 +991,6 @@ private:
     // ------------------------ high-level (simpler) pipeline ------------------
 #if ((__cplusplus >= 201103L) || (defined __GXX_EXPERIMENTAL_CXX0X__)) || (defined(HAS_CXX11_VARIADIC_TEMPLATES))
 
-#include <ff/make_unique.hpp>
-
     /*! 
      * \class ff_Pipe
      * \ingroup high_level_patterns
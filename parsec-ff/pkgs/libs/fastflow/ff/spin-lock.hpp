@@ -8,7 +8,7 @@
  *  \brief This file contains several alternative spin lock(s)
  *  implementations that can be used as FastFlow spin-lock
  *
- * CLH spin-lock, ticket lock, XCHG-based spin-lock,
+ * CLH spin-lock, MCS queue lock, ticket lock, XCHG-based spin-lock,
  * AtomicFlagWrapper-based spin-lock, and counting ...
  */
 
@@ -35,6 +35,7 @@
  * 
  *    - April 2013 added CLHSpinLock 
  *    - February 2014 added AtomicFlagWrapper-based spin-lock
+ *    - MCS queue lock (see mcs-lock.h)
  *
  */
  
@@ -167,6 +168,23 @@ static inline void spin_lock(clh_lock_t l, const int pid) { l->spin_lock(pid); }
 static inline void spin_unlock(clh_lock_t l, const int pid) { l->spin_unlock(pid); }
 
 #endif 
+
+/*
+ * MCS queue lock: FIFO, each waiting thread spins on its own (thread-local)
+ * queue node. Differently from the CLH lock the thread id is not needed and 
+ * the lock is just two pointers, thus it can be used for arrays of fine-grain 
+ * locks. See mcs-lock.h (the implementation is shared with the C code).
+ */
+#include <ff/mcs-lock.h>
+namespace ff {
+typedef ff_mcs_lock_t mcs_lock_t[1];
+
+static inline void init_unlocked(mcs_lock_t l) { ff_mcs_init(l); }
+static inline void init_locked(mcs_lock_t l)   { abort(); }
+static inline void spin_lock(mcs_lock_t l)     { ff_mcs_lock(l); }
+static inline bool spin_trylock(mcs_lock_t l)  { return ff_mcs_trylock(l) == 0; }
+static inline void spin_unlock(mcs_lock_t l)   { ff_mcs_unlock(l); }
+}
 /*
 #if !defined(__GNUC__) && defined(_MSC_VER)
 // An acquire-barrier exchange, despite the name
@@ -0,0 +1,196 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/*!
+ *  \file taskpool.hpp
+ *  \ingroup aux_classes
+ *
+ *  \brief Typed pool of recycled task objects
+ *
+ *  Streaming applications typically allocate a task in the first stage of a
+ *  pipeline (or in the Emitter of a farm) and free it in the last stage
+ *  (or in the Collector). With \p ff_taskpool the last stage gives the
+ *  spent task back to the first one through a dedicated SWSR return channel,
+ *  so that, once the pool is warm, no heap allocation is performed.
+ *
+ *  The pool is capped: at most \p capacity objects are created. When all of
+ *  them are in flight \p get waits (spin then sleep, see waitpolicy.hpp) until
+ *  one comes back, thus acting as a backpressure mechanism on the first stage.
+ *
+ *  \code
+ *  ff_taskpool<task_t> pool(256);
+ *
+ *  // first stage (the only thread calling get)
+ *  task_t *t = pool.get();  ... ff_send_out(t);
+ *
+ *  // last stage (or Collector)
+ *  ... pool.put(t); return GO_ON;
+ *  \endcode
+ *
+ *  Several threads can give tasks back (e.g. the workers of a farm without
+ *  the Collector): each one must use its own return channel, see the
+ *  \p nret parameter of the constructor and \p put(T*, size_t).
+ *  Tasks that are not given back (e.g. filtered by a stage) are never
+ *  reused, thus if it happens \p capacity times \p get waits forever;
+ *  in this case use \p try_get.
+ */
+
+/* ***************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License version 3 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ *  License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ ****************************************************************************
+ */
+
+#ifndef FF_TASKPOOL_HPP
+#define FF_TASKPOOL_HPP
+
+#include <stdlib.h>
+#include <assert.h>
+#include <ff/config.hpp>
+#include <ff/utils.hpp>
+#include <ff/buffer.hpp>
+#include <ff/svector.hpp>
+#include <ff/waitpolicy.hpp>
+
+namespace ff {
+
+/*!
+ * \class ff_taskpool
+ * \ingroup aux_classes
+ *
+ * \brief Capped pool of objects of type \p T recycled through SWSR
+ * return channels.
+ *
+ * \p get and \p try_get must be called by a single thread (the first stage),
+ * \p put(t, ch) by a single thread for each return channel \p ch.
+ * The objects are created with \p new T (or \p new T(proto) if a prototype
+ * is given) and deleted by the destructor of the pool, which must be
+ * called when no object is in flight any more. An object is given back as
+ * it is: re-initialising it is up to the first stage.
+ *
+ * This class is defined in \ref taskpool.hpp
+ */
+template<typename T>
+class ff_taskpool {
+public:
+    /**
+     * \param capacity max number of objects created by the pool
+     * \param nret number of return channels (i.e. of threads calling put)
+     */
+    ff_taskpool(size_t capacity, size_t nret=1):
+        capacity(capacity>0?capacity:1), created(0), nextch(0), nwaits(0),
+        proto(NULL), objs(capacity>0?capacity:1), ret(nret>0?nret:1) {
+        if (nret==0) nret=1;
+        for(size_t i=0;i<nret;++i) {
+            SWSR_Ptr_Buffer *b = new SWSR_Ptr_Buffer(this->capacity);
+            if (!b || !b->init()) {
+                error("FF_TASKPOOL, unable to create the return channel\n");
+                abort();
+            }
+            b->set_cons_event(waiter.event());
+            ret.push_back(b);
+        }
+    }
+
+    /// as above, the new objects are copies of \p proto
+    ff_taskpool(size_t capacity, const T &proto, size_t nret=1):
+        ff_taskpool(capacity, nret) {
+        this->proto = new T(proto);
+    }
+
+    ~ff_taskpool() {
+        for(size_t i=0;i<objs.size();++i) delete objs[i];
+        for(size_t i=0;i<ret.size();++i)  delete ret[i];
+        if (proto) delete proto;
+    }
+
+    /**
+     * Returns a recycled object, or a new one if none has been given back
+     * yet and less than \p capacity objects have been created.
+     *
+     * \return NULL if all the objects are in flight
+     */
+    inline T *try_get() {
+        void *t = NULL;
+        const size_t n = ret.size();
+        for(size_t i=0;i<n;++i) {
+            SWSR_Ptr_Buffer *const b = ret[nextch];
+            if (++nextch == n) nextch = 0;
+            if (b->pop(&t)) return (T*)t;
+        }
+        if (created < capacity) {
+            T *obj = proto ? new T(*proto) : new T;
+            objs.push_back(obj);
+            ++created;
+            return obj;
+        }
+        return NULL;
+    }
+
+    /**
+     * As \p try_get but, if all the objects are in flight, it waits until
+     * one of them is given back.
+     */
+    inline T *get() {
+        T *t;
+        while((t = try_get()) == NULL) {
+            ++nwaits;
+            waiter.wait();
+        }
+        waiter.done();
+        return t;
+    }
+
+    /**
+     * Gives back the object \p t through the return channel \p ch.
+     * Each channel can hold all the objects, thus it fails only if the
+     * contract is broken (\p ch used by more than one thread or \p t 
+     * given back twice).
+     *
+     * \return false if the object cannot be given back
+     */
+    inline bool put(T *t, size_t ch=0) {
+        assert(ch < ret.size());
+        SWSR_Ptr_Buffer *const b = ret[ch];
+        const bool r = b->push((void*)t);
+        assert(r);
+        if (r) ff_wakeup_consumer(b);
+        return r;
+    }
+
+    /// max number of objects
+    inline size_t getcapacity() const { return capacity; }
+    /// number of objects created so far
+    inline size_t getcreated()  const { return created; }
+    /// number of times \p get has found the pool dry (backpressure)
+    inline size_t getnwaits()   const { return nwaits; }
+
+private:
+    ff_taskpool(const ff_taskpool&);
+    ff_taskpool &operator=(const ff_taskpool&);
+
+private:
+    const size_t               capacity;
+    size_t                     created;
+    size_t                     nextch;
+    size_t                     nwaits;
+    T                        * proto;
+    svector<T*>                objs;     // all the objects created
+    svector<SWSR_Ptr_Buffer*>  ret;      // return channels
+    ff_waiter                  waiter;
+};
+
+} // namespace ff
+
+#endif /* FF_TASKPOOL_HPP */
@@ -0,0 +1,319 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/*!
+ *  \file topology.hpp
+ *  \ingroup aux_classes
+ *
+ *  \brief Model of the machine topology (CPUs, physical cores, sockets and
+ *  NUMA nodes)
+ *
+ *  On Linux the model is built once, the first time it is needed, by reading
+ *  \p /sys/devices/system/cpu and \p /sys/devices/system/node. On other
+ *  platforms (or if sysfs is not available) each CPU is considered as a
+ *  physical core of a single socket and NUMA node.
+ *  It is used by the functions in \ref mapping_utils.hpp and by the
+ *  mapping policies of the \p threadMapper.
+ *
+ *  The file also contains the helpers used to place memory on a given NUMA
+ *  node (see \p FF_NUMA_LOCAL in config.hpp).
+ */
+
+/* ***************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License version 3 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ *  License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ ****************************************************************************
+ */
+
+#ifndef FF_TOPOLOGY_HPP
+#define FF_TOPOLOGY_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+#include <algorithm>
+#if defined(_WIN32)
+#include <ff/platforms/platform.h>
+#else
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#endif
+
+// root of the sysfs device tree (it can be redefined for testing purposes)
+#if !defined(FF_SYSFS_ROOT)
+#define FF_SYSFS_ROOT "/sys/devices/system"
+#endif
+
+namespace ff {
+
+/*!
+ * \brief A logical CPU (hardware context) of the machine
+ */
+struct ff_cpu_t {
+    int id;      /// CPU id as used by the OS (e.g. sched_setaffinity)
+    int core;    /// physical core (dense index in [0, numCores()) )
+    int socket;  /// socket (dense index in [0, numSockets()) )
+    int node;    /// NUMA node (as numbered by the OS)
+    int smt;     /// index of the CPU among the hardware contexts of its core
+};
+
+/*!
+ * \class ff_topology
+ * \ingroup aux_classes
+ *
+ * \brief The topology of the machine (only the online CPUs are considered).
+ *
+ * This class is defined in \ref topology.hpp
+ */
+class ff_topology {
+public:
+    static inline const ff_topology &instance() {
+        static ff_topology topo;
+        return topo;
+    }
+
+    /// number of logical CPUs (hardware contexts)
+    inline size_t numCpus()    const { return cpus.size(); }
+    /// number of physical cores
+    inline size_t numCores()   const { return ncores; }
+    /// number of sockets (physical packages)
+    inline size_t numSockets() const { return nsockets; }
+    /// number of NUMA nodes having at least one CPU
+    inline size_t numNodes()   const { return nnodes; }
+    /// max number of hardware contexts per physical core
+    inline size_t numSMT()     const { return nsmt; }
+    /// the CPUs ordered by id
+    inline const std::vector<ff_cpu_t> &getCpus() const { return cpus; }
+
+    /// returns the CPU having the OS id \p id, or NULL if it is not online
+    inline const ff_cpu_t *getCpu(int id) const {
+        for(size_t i=0;i<cpus.size();++i)
+            if (cpus[i].id == id) return &cpus[i];
+        return NULL;
+    }
+    /// NUMA node of the CPU \p id (-1 if unknown)
+    inline int nodeOf(int id) const {
+        const ff_cpu_t *c = getCpu(id);
+        return (c ? c->node : -1);
+    }
+    /// socket of the CPU \p id (-1 if unknown)
+    inline int socketOf(int id) const {
+        const ff_cpu_t *c = getCpu(id);
+        return (c ? c->socket : -1);
+    }
+
+protected:
+    ff_topology():ncores(0),nsockets(0),nnodes(0),nsmt(0) {
+#if defined(__linux__)
+        if (read_sysfs()) return;
+        cpus.clear();
+#endif
+        flat(num_online());
+    }
+
+    /// the fallback model: n cores, one socket, one NUMA node
+    void flat(long n) {
+        if (n<=0) n=1;
+        for(long i=0;i<n;++i) {
+            ff_cpu_t c = { (int)i, (int)i, 0, 0, 0 };
+            cpus.push_back(c);
+        }
+        ncores = n, nsockets = 1, nnodes = 1, nsmt = 1;
+    }
+
+    static long num_online() {
+#if defined(_WIN32)
+        SYSTEM_INFO sysinfo;
+        GetSystemInfo( &sysinfo );
+        return sysinfo.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+        return sysconf(_SC_NPROCESSORS_ONLN);
+#else
+        return 1;
+#endif
+    }
+
+#if defined(__linux__)
+public:
+    /// reads one integer from the file \p path
+    static bool read_int(const char *path, int &v) {
+        FILE *f = fopen(path, "r");
+        if (!f) return false;
+        const bool ok = (fscanf(f, "%d", &v) == 1);
+        fclose(f);
+        return ok;
+    }
+
+    /// reads a list in the sysfs format (e.g. "0-3,8,10-11") from \p path
+    static bool read_list(const char *path, std::vector<int> &l) {
+        FILE *f = fopen(path, "r");
+        if (!f) return false;
+        char buf[4096];
+        const bool ok = (fgets(buf, sizeof(buf), f) != NULL);
+        fclose(f);
+        if (!ok) return false;
+        char *s = buf, *e;
+        while(*s && *s != '\n') {
+            const long a = strtol(s, &e, 10);
+            if (e == s) return false;
+            long b = a;
+            s = e;
+            if (*s == '-') {
+                b = strtol(s+1, &e, 10);
+                if (e == s+1) return false;
+                s = e;
+            }
+            for(long i=a;i<=b;++i) l.push_back((int)i);
+            if (*s == ',') ++s;
+        }
+        return true;
+    }
+
+protected:
+    bool read_sysfs() {
+        char path[256];
+        std::vector<int> online;
+        if (!read_list(FF_SYSFS_ROOT "/cpu/online", online) || online.empty())
+            return false;
+
+        // socket and core ids as given by the OS (they may be sparse)
+        std::vector<int> pkg(online.size()), cid(online.size());
+        for(size_t i=0;i<online.size();++i) {
+            ff_cpu_t c = { online[i], 0, 0, 0, 0 };
+            snprintf(path, sizeof(path), FF_SYSFS_ROOT "/cpu/cpu%d/topology/physical_package_id", c.id);
+            if (!read_int(path, pkg[i])) pkg[i] = 0;
+            snprintf(path, sizeof(path), FF_SYSFS_ROOT "/cpu/cpu%d/topology/core_id", c.id);
+            if (!read_int(path, cid[i])) cid[i] = c.id;
+            cpus.push_back(c);
+        }
+
+        // dense socket and core numbering, SMT index within the core
+        std::vector<int> sockets;
+        std::vector<std::pair<int,int> > cores;
+        for(size_t i=0;i<cpus.size();++i) {
+            size_t s = std::find(sockets.begin(), sockets.end(), pkg[i]) - sockets.begin();
+            if (s == sockets.size()) sockets.push_back(pkg[i]);
+            const std::pair<int,int> key(pkg[i], cid[i]);
+            size_t k = std::find(cores.begin(), cores.end(), key) - cores.begin();
+            if (k == cores.size()) cores.push_back(key);
+            cpus[i].socket = (int)s;
+            cpus[i].core   = (int)k;
+            int smt = 0;
+            for(size_t j=0;j<i;++j) if (cpus[j].core == cpus[i].core) ++smt;
+            cpus[i].smt = smt;
+            if ((size_t)smt+1 > nsmt) nsmt = smt+1;
+        }
+        nsockets = sockets.size();
+        ncores   = cores.size();
+
+        // NUMA nodes (the directory is missing if the kernel has no NUMA support)
+        std::vector<int> nodes;
+        if (read_list(FF_SYSFS_ROOT "/node/online", nodes)) {
+            for(size_t n=0;n<nodes.size();++n) {
+                std::vector<int> l;
+                snprintf(path, sizeof(path), FF_SYSFS_ROOT "/node/node%d/cpulist", nodes[n]);
+                if (!read_list(path, l) || l.empty()) continue;
+                ++nnodes;
+                for(size_t i=0;i<cpus.size();++i)
+                    if (std::find(l.begin(), l.end(), cpus[i].id) != l.end())
+                        cpus[i].node = nodes[n];
+            }
+        }
+        if (nnodes == 0) nnodes = 1;
+        return true;
+    }
+#endif
+
+protected:
+    std::vector<ff_cpu_t> cpus;
+    size_t ncores;
+    size_t nsockets;
+    size_t nnodes;
+    size_t nsmt;
+};
+
+/*
+ * NUMA memory placement. The system calls are used directly so that no
+ * dependency on libnuma is introduced. All the functions fail gracefully
+ * (returning -1) on non-NUMA kernels and on other platforms.
+ */
+
+/// NUMA node of the CPU the calling thread is running on (-1 if unknown)
+static inline int ff_numa_my_node() {
+#if defined(__linux__)
+    // CPU id -> node table, built once from the topology
+    static const std::vector<int> cpunode = [] {
+        const std::vector<ff_cpu_t> &c = ff_topology::instance().getCpus();
+        std::vector<int> t;
+        for(size_t i=0;i<c.size();++i) {
+            if ((size_t)c[i].id >= t.size()) t.resize(c[i].id+1, -1);
+            t[c[i].id] = c[i].node;
+        }
+        return t;
+    }();
+    static const bool numa = ff_topology::instance().numNodes() > 1;
+    if (!numa) return cpunode.empty() ? -1 : cpunode[0];
+    const int cpu = sched_getcpu();
+    return (cpu<0 || (size_t)cpu>=cpunode.size()) ? -1 : cpunode[cpu];
+#else
+    return -1;
+#endif
+}
+
+/**
+ * Moves the pages fully contained in [addr, addr+len) on the NUMA node
+ * \p node, pages not yet touched will be allocated there. The first and
+ * last page are skipped if only partially covered, so that unrelated data
+ * sharing them is not migrated.
+ *
+ * \return 0 on success, -1 otherwise (also when no whole page is in the range)
+ */
+static inline int ff_numa_move(const void *addr, size_t len, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+    const unsigned long bits = 8*sizeof(unsigned long);
+    unsigned long mask[1024/(8*sizeof(unsigned long))] = { 0 };
+    if (!addr || !len || node<0 || (unsigned long)node >= 1024) return -1;
+    const unsigned long page  = sysconf(_SC_PAGESIZE);
+    const unsigned long start = ((unsigned long)addr + page-1) & ~(page-1);
+    const unsigned long end   = ((unsigned long)addr + len) & ~(page-1);
+    if (end <= start) return -1;
+    mask[node/bits] = 1UL << (node%bits);
+    // MPOL_PREFERRED=1, MPOL_MF_MOVE=2 (see numaif.h)
+    if (syscall(SYS_mbind, start, end-start, 1, mask, 1024+1, 2) != 0) return -1;
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/// NUMA node where the page containing \p addr is (-1 if unknown or not yet allocated)
+static inline int ff_numa_node_of(const void *addr) {
+#if defined(__linux__) && defined(SYS_move_pages)
+    if (!addr) return -1;
+    const unsigned long page = sysconf(_SC_PAGESIZE);
+    void *p = (void*)((unsigned long)addr & ~(page-1));
+    int status = -1;
+    if (syscall(SYS_move_pages, 0, 1UL, &p, NULL, &status, 0) != 0) return -1;
+    return (status<0) ? -1 : status;
+#else
+    return -1;
+#endif
+}
+
+} // namespace ff
+
+#endif /* FF_TOPOLOGY_HPP */
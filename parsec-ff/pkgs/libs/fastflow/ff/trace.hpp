@@ -0,0 +1,259 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/*!
+ *  \file trace.hpp
+ *  \ingroup aux_classes
+ *
+ *  \brief Timeline tracing of the FastFlow threads (\p TRACE_FASTFLOW_EVENTS)
+ *
+ *  When \p TRACE_FASTFLOW_EVENTS is defined each thread of the run-time
+ *  (node, Emitter, Collector) records in its own ring the intervals spent
+ *  receiving a task (i.e. waiting on the input channel), computing it
+ *  (\p svc) and sending it out (i.e. waiting on the output channel).
+ *  Every \p FF_TRACE_QSAMPLE tasks the length of the input channel is
+ *  sampled as well.
+ *
+ *  Rings have a single writer and are not protected by any lock; when they
+ *  are full the oldest events are overwritten (per-thread totals and
+ *  histograms are kept anyway). They are read only by \p ff_tracer::dump
+ *  and \p ff_tracer::summary, that must be called when the threads are not
+ *  running (e.g. after \p wait()). If this is not done explicitly the trace
+ *  is written at exit in the file named by the \p FF_TRACE_FILE environment
+ *  variable (default \p fftrace.json) and the summary is printed on
+ *  \p std::cerr.
+ *
+ *  The file can be loaded in chrome://tracing or in Perfetto.
+ */
+
+/* ***************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License version 3 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ *  License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ ****************************************************************************
+ */
+
+#ifndef FF_TRACE_HPP
+#define FF_TRACE_HPP
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <iostream>
+#include <ff/config.hpp>
+#include <ff/spin-lock.hpp>
+#include <ff/svector.hpp>
+#include <ff/utils.hpp>
+
+namespace ff {
+
+// number of events kept by each thread (power of 2)
+#if !defined(FF_TRACE_RING)
+#define FF_TRACE_RING (1<<16)
+#endif
+// the input channel is sampled every FF_TRACE_QSAMPLE tasks
+#if !defined(FF_TRACE_QSAMPLE)
+#define FF_TRACE_QSAMPLE 64
+#endif
+
+enum ff_trace_kind { FF_TRACE_RECV=0, FF_TRACE_SVC=1, FF_TRACE_SEND=2, FF_TRACE_QLEN=3 };
+
+/// nanoseconds from an arbitrary point in the past (same clock of the nodes)
+static inline unsigned long long ff_trace_now() { return ff_gettime(); }
+
+/*!
+ * \class ff_trace_ring
+ * \ingroup aux_classes
+ *
+ * \brief Events recorded by one thread.
+ *
+ * \p record closes the interval started at \p t0 and returns the current
+ * time, so that consecutive intervals need one clock read each.
+ */
+class ff_trace_ring {
+    friend class ff_tracer;
+public:
+    enum { NBUCKETS=40 };
+
+    struct event {
+        unsigned long long t0;
+        unsigned long long t1;    // for FF_TRACE_QLEN: the queue length
+        unsigned           kind;
+    };
+
+    ff_trace_ring(const std::string &name, int id):
+        name(name), id(id), pos(0), ntasks(0), svctime(0),
+        intime(0), outtime(0), nsamples(0), qsum(0), qmax(0) {
+        ev = new event[FF_TRACE_RING];
+        for(int i=0;i<NBUCKETS;++i) hist[i]=0;
+    }
+    ~ff_trace_ring() { delete [] ev; }
+
+    inline unsigned long long record(ff_trace_kind kind, unsigned long long t0) {
+        const unsigned long long t1 = ff_trace_now();
+        const unsigned long long d  = t1-t0;
+        event &e = ev[pos++ & (FF_TRACE_RING-1)];
+        e.t0 = t0, e.t1 = t1, e.kind = kind;
+        switch(kind) {
+        case FF_TRACE_SVC: {
+            ++ntasks; svctime += d;
+            int b=0;
+            for(unsigned long long v=d; v>1 && b<NBUCKETS-1; v>>=1) ++b;
+            ++hist[b];
+        } break;
+        case FF_TRACE_RECV: intime  += d; break;
+        case FF_TRACE_SEND: outtime += d; break;
+        default: break;
+        }
+        return t1;
+    }
+
+    /// true if the input channel has to be sampled now
+    inline bool qsample_due() const { return (ntasks % FF_TRACE_QSAMPLE) == 0; }
+
+    inline void qsample(size_t len) {
+        event &e = ev[pos++ & (FF_TRACE_RING-1)];
+        e.t0 = ff_trace_now(), e.t1 = len, e.kind = FF_TRACE_QLEN;
+        ++nsamples; qsum += len;
+        if (len > qmax) qmax = len;
+    }
+
+    inline size_t getntasks() const { return ntasks; }
+
+protected:
+    const std::string  name;
+    const int          id;
+    event            * ev;
+    size_t             pos;
+    size_t             ntasks;
+    unsigned long long svctime, intime, outtime;
+    size_t             nsamples, qsum, qmax;
+    size_t             hist[NBUCKETS];   // hist[b]: svc time in [2^b, 2^(b+1)) ns
+};
+
+/*!
+ * \class ff_tracer
+ * \ingroup aux_classes
+ *
+ * \brief Owner of the rings of all the threads (singleton).
+ *
+ * This class is defined in \ref trace.hpp
+ */
+class ff_tracer {
+public:
+    static inline ff_tracer *instance() {
+        static ff_tracer tracer;
+        return &tracer;
+    }
+
+    /// creates the ring of the calling thread
+    ff_trace_ring *newring(const char *kind, int id) {
+        ff_trace_ring *r = new ff_trace_ring(kind, id);
+        spin_lock(lock);
+        rings.push_back(r);
+        spin_unlock(lock);
+        return r;
+    }
+
+    /**
+     * Writes the events in the Chrome trace-event format. Each ring is a
+     * thread of a single process; service, receive and send are complete
+     * events ("X"), queue samples are counters ("C").
+     *
+     * \return 0 on success, -1 otherwise
+     */
+    int dump(const char *path) {
+        FILE *f = fopen(path, "w");
+        if (!f) {
+            error("TRACE, unable to open %s\n", path);
+            return -1;
+        }
+        static const char *names[] = { "recv", "svc", "send" };
+        bool first = true;
+        fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+        spin_lock(lock);
+        for(size_t i=0;i<rings.size();++i) {
+            const ff_trace_ring *r = rings[i];
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,"
+                    "\"args\":{\"name\":\"%s %d\"}}", first?"":",\n", i, r->name.c_str(), r->id);
+            first = false;
+            const size_t n = (r->pos < FF_TRACE_RING) ? r->pos : FF_TRACE_RING;
+            for(size_t k=r->pos-n; k<r->pos; ++k) {
+                const ff_trace_ring::event &e = r->ev[k & (FF_TRACE_RING-1)];
+                if (e.kind == FF_TRACE_QLEN)
+                    fprintf(f, ",\n{\"name\":\"queue %s %d\",\"ph\":\"C\",\"pid\":1,\"tid\":%zu,"
+                            "\"ts\":%.3f,\"args\":{\"length\":%llu}}",
+                            r->name.c_str(), r->id, i, us(e.t0), e.t1);
+                else
+                    fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"ff\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,"
+                            "\"ts\":%.3f,\"dur\":%.3f}",
+                            names[e.kind], i, us(e.t0), (e.t1-e.t0)/1000.0);
+            }
+        }
+        spin_unlock(lock);
+        fprintf(f, "\n]}\n");
+        const bool ok = !ferror(f);
+        fclose(f);
+        dumped = true;
+        return ok ? 0 : -1;
+    }
+
+    /// per-thread summary: service time histogram, queue occupancy, blocking time
+    void summary(std::ostream &out) {
+        spin_lock(lock);
+        for(size_t i=0;i<rings.size();++i) {
+            const ff_trace_ring *r = rings[i];
+            out << r->name << " " << r->id << " (thread " << i << " in the trace)\n"
+                << "  n. tasks         : " << r->ntasks << "\n"
+                << "  svc time (ms)    : " << r->svctime/1e6;
+            if (r->ntasks) out << " (avg us= " << (r->svctime/1e3)/r->ntasks << ")";
+            out << "\n"
+                << "  blocked in (ms)  : " << r->intime/1e6  << "\n"
+                << "  blocked out (ms) : " << r->outtime/1e6 << "\n";
+            if (r->nsamples)
+                out << "  input queue      : avg= " << (double)r->qsum/r->nsamples
+                    << " max= " << r->qmax << " (" << r->nsamples << " samples)\n";
+            for(int b=0;b<ff_trace_ring::NBUCKETS;++b)
+                if (r->hist[b])
+                    out << "  svc < " << (1ULL<<(b+1)) << " ns : " << r->hist[b] << "\n";
+        }
+        spin_unlock(lock);
+    }
+
+protected:
+    ff_tracer():t0(ff_trace_now()),dumped(false) { init_unlocked(lock); }
+
+    ~ff_tracer() {
+        if (!dumped && rings.size()) {
+            const char *path = getenv("FF_TRACE_FILE");
+            dump(path ? path : "fftrace.json");
+            summary(std::cerr);
+        }
+        for(size_t i=0;i<rings.size();++i) delete rings[i];
+    }
+
+    // microseconds since the tracer has been created
+    inline double us(unsigned long long t) const {
+        return (t<t0) ? 0.0 : (t-t0)/1000.0;
+    }
+
+private:
+    const unsigned long long t0;
+    bool                     dumped;
+    lock_t                   lock;
+    svector<ff_trace_ring*>  rings;
+};
+
+} // namespace ff
+
+#endif /* FF_TRACE_HPP */
@@ -86,7 +86,7 @@ namespace ff {
 class BufferPool {
 public:
     BufferPool(int cachesize, const bool fillcache=false, unsigned long size=-1)
-        :inuse(cachesize),bufcache(cachesize) {
+        :numa(-1),inuse(cachesize),bufcache(cachesize) {
         bufcache.init(); // initialise the internal buffer and allocates memory
 
         if (fillcache) {
@@ -136,6 +136,7 @@ public:
 #else
             if (!p.buf->init()) return NULL;
 #endif
+            if (numa>=0) p.buf->numa_place(numa);
         }
 #if defined(UBUFFER_STATS)
         else  ++hit;
@@ -175,6 +176,9 @@ public:
     }
 #endif
 
+    // NUMA node where the buffers allocated from now on are moved (-1 none)
+    inline void set_numa_node(int node) { numa = node; }
+
     // just empties the inuse bucket putting data in the cache
     void reset() {
         union { INTERNAL_BUFFER_T * b1; void * b2;} p;
@@ -187,6 +191,7 @@ private:
     long padding1[longxCacheLine-2];    
 #endif
 
+    int                numa;
     dynqueue           inuse;    // of type dynqueue, that is a Dynamic (list-based) 
                                  // SWSR unbounded queue.
                                  // No lock is needed around pop and push methods.
@@ -245,7 +250,8 @@ public:
      *
      */
     uSWSR_Ptr_Buffer(unsigned long n, const bool fixedsize=false, const bool fillcache=false):
-        buf_r(0),buf_w(0),in_use_buffers(1),size(n),fixedsize(fixedsize),
+        buf_r(0),buf_w(0),cons_ev(0),prod_ev(0),
+        in_use_buffers(1),size(n),fixedsize(fixedsize),
         pool(CACHE_SIZE,fillcache,size) {
         init_unlocked(P_lock); init_unlocked(C_lock);
 #if defined(UBUFFER_STATS)
@@ -344,6 +350,32 @@ public:
         return true;
     }
 
+    /**
+     *  \brief Pushes a batch of elements
+     *
+     *  It pushes up to \p len elements of \p data, in order, by using 
+     *  the batched push of the internal buffers.
+     *
+     *  \return the number of elements pushed. It is less than \p len only
+     *  if \p fixedsize has been set and the buffer is full.
+     */
+    inline unsigned long push_batch(void * const data[], unsigned long len) {
+        unsigned long n = buf_w->push_batch(data, len);
+        while(n<len) {
+            if (fixedsize) return n;
+            // the current buffer is full, get a new one (as in push)
+            INTERNAL_BUFFER_T * t = pool.next_w(size);
+            assert(t);
+            buf_w = t;
+            in_use_buffers++;
+#if defined(UBUFFER_STATS)
+            ++numBuffers;
+#endif
+            n += buf_w->push_batch(data+n, len-n);
+        }
+        return n;
+    }
+
     inline bool mp_push(void *const data) {
         spin_lock(P_lock);
         bool r=push(data);  // should it be mpush(data)?
@@ -410,6 +442,23 @@ public:
         return buf_r->pop(data);
     }    
 
+    /**
+     *  \brief Pops a batch of elements
+     *
+     *  It pops up to \p len elements storing them in \p data. 
+     *  At most one switch to the next internal buffer is performed per call.
+     *
+     *  \return the number of elements popped
+     */
+    inline unsigned long pop_batch(void ** data, unsigned long len) {
+        unsigned long n = buf_r->pop_batch(data, len);
+        if (n == len) return n;
+        // the current buffer has been drained, pop moves to the next one
+        if (!pop(&data[n])) return n;
+        ++n;
+        return n + buf_r->pop_batch(data+n, len-n);
+    }
+
 
 #if defined(UBUFFER_STATS)
     inline unsigned long queue_status() {
@@ -455,12 +504,49 @@ public:
     inline unsigned long length() const {
         unsigned long len = buf_r->length();
         if (buf_r == buf_w) return len;
-        assert(in_use_buffers>2);
+        assert(in_use_buffers>=2);
         return len+(in_use_buffers-2)*size+buf_w->length();
     }
 
+    /**
+     * \brief number of elements in the queue, as seen by the producer
+     *
+     * Same rough estimation as \p length, but it does not touch the buffer
+     * being read, which may be released by the consumer at any time, so it
+     * can be safely called by the producer (e.g. by the farm's Emitter).
+     */
+    inline unsigned long length_producer() const {
+        const unsigned long n = in_use_buffers;
+        return buf_w->length() + ((n>1) ? (n-1)*size : 0);
+    }
+
     inline bool isFixedSize() const { return fixedsize; }
 
+    /**
+     * \brief moves the queue storage on the NUMA node \p node
+     *
+     * It must be called by the consumer (see \p FF_NUMA_LOCAL): the buffer
+     * being read is moved now, the ones allocated later by the producer are
+     * moved as soon as they are allocated (recycled buffers are already there).
+     *
+     * \return 0 on success, -1 otherwise
+     */
+    inline int numa_place(int node) {
+        pool.set_numa_node(node);
+        return buf_r->numa_place(node);
+    }
+
+    /// NUMA node where the buffer being read is (-1 if unknown)
+    inline int numa_where() const { return buf_r->numa_where(); }
+
+    /**
+     * \brief events used by the adaptive waiting policy (see waitpolicy.hpp)
+     */
+    inline void set_cons_event(ff_event *e) { cons_ev = e; }
+    inline void set_prod_event(ff_event *e) { prod_ev = e; }
+    inline ff_event *get_cons_event() const { return cons_ev; }
+    inline ff_event *get_prod_event() const { return prod_ev; }
+
     inline void reset() {
         if (buf_r) buf_r->reset();
         if (buf_w) buf_w->reset();
@@ -479,6 +565,9 @@ private:
     INTERNAL_BUFFER_T * buf_w;
     ALIGN_TO_POST(CACHE_LINE_SIZE)
 
+    ff_event          * cons_ev;   // adaptive waiting (see waitpolicy.hpp)
+    ff_event          * prod_ev;
+
     /* ----- two-lock used only in the mp_push and mc_pop methods ------- */
 	ALIGN_TO_PRE(CACHE_LINE_SIZE) 
     lock_t P_lock;
@@ -33,6 +33,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstdarg>
+#include <ctime>
 //#include <unistd.h> // Not availbe on windows - to be managed
 #include <iosfwd>
 //#if (defined(_MSC_VER) || defined(__INTEL_COMPILER)) && defined(_WIN32)
@@ -198,6 +199,37 @@ static inline void time_setzero(struct timeval & a) {
     a.tv_usec=0;
 }
 
+/*
+ * Time (in nanoseconds) used by the run-time to time the nodes.
+ * CLOCK_MONOTONIC_RAW is not adjusted by NTP, so intervals measured on
+ * different threads can be safely compared.
+ */
+typedef unsigned long long ff_time_t;
+
+static inline ff_time_t ff_gettime() {
+#if defined(CLOCK_MONOTONIC_RAW) || defined(CLOCK_MONOTONIC)
+    struct timespec ts;
+#if defined(CLOCK_MONOTONIC_RAW)
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+#else
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#endif
+    return (ff_time_t)ts.tv_sec*1000000000ULL + (ff_time_t)ts.tv_nsec;
+#else
+    struct timeval tv;
+    gettimeofday(&tv,NULL);
+    return (ff_time_t)tv.tv_sec*1000000000ULL + (ff_time_t)tv.tv_usec*1000ULL;
+#endif
+}
+
+static inline double diffmsec(const ff_time_t a, const ff_time_t b) {
+    return ((double)(long long)(a-b))/1000000.0;
+}
+
+static inline bool time_iszero(const ff_time_t a) { return (a==0); }
+
+static inline void time_setzero(ff_time_t & a) { a=0; }
+
 static inline bool isPowerOf2(unsigned x) {
 	return (x != 0 && (x & (x-1)) == 0);
 }
@@ -217,9 +249,9 @@ static inline unsigned int nextMultipleOfIf(unsigned int x, unsigned int m) {
 
 
 static inline double ffTime(int tag, bool lock=false) {
-    static struct timeval tv_start = {0,0};
-    static struct timeval tv_stop  = {0,0};
-    // needed to protect gettimeofday
+    static ff_time_t tv_start = 0;
+    static ff_time_t tv_stop  = 0;
+    // needed to protect the time values
     // if multiple threads call ffTime
 #if (__cplusplus >= 201103L) || (defined __GXX_EXPERIMENTAL_CXX0X__) || (defined(HAS_CXX11_VARIADIC_TEMPLATES))
     static lock_t L;
@@ -231,12 +263,12 @@ static inline double ffTime(int tag, bool lock=false) {
     switch(tag) {
     case START_TIME:{
         spin_lock(L);
-        gettimeofday(&tv_start,NULL);
+        tv_start = ff_gettime();
         spin_unlock(L);
     } break;
     case STOP_TIME:{
         spin_lock(L);
-        gettimeofday(&tv_stop,NULL);
+        tv_stop = ff_gettime();
         spin_unlock(L);
         res = diffmsec(tv_stop,tv_start);
     } break;
@@ -0,0 +1,198 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/*!
+ *  \file waitpolicy.hpp
+ *  \ingroup building_blocks
+ *
+ *  \brief Adaptive (spin-then-sleep) waiting policy for FastFlow channels
+ *
+ *  In the default nonblocking run-time, a thread that finds its input
+ *  queue empty (or its output queue full) spins for a fixed number of
+ *  ticks and retries, thus burning one core per idle node. The
+ *  \p BLOCKING_MODE run-time instead pays a mutex/condition-variable
+ *  round trip for every task.
+ *
+ *  The adaptive policy is in between: the waiting thread first performs an
+ *  exponential backoff, then it goes to sleep on a futex (\p ff_event)
+ *  registered on the queue (see \p ff_waiter). The thread on the other side of the queue
+ *  wakes it up only if somebody is actually sleeping, so the fast path
+ *  costs just a pointer check (plus a fence when the event is registered).
+ *
+ *  The policy can be selected at run-time per node (\p ff_node), per
+ *  emitter/collector and per farm/pipeline by using \p set_wait_policy.
+ */
+
+/* ***************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License version 3 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ *  License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ ****************************************************************************
+ */
+
+#ifndef FF_WAITPOLICY_HPP
+#define FF_WAITPOLICY_HPP
+
+#include <atomic>
+#include <climits>
+#include <ff/sysdep.h>
+#include <ff/config.hpp>
+#include <ff/platforms/platform.h>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+namespace ff {
+
+/*
+ * FF_WAIT_SPIN:     the classic FastFlow behaviour (spin on the queue)
+ * FF_WAIT_ADAPTIVE: exponential backoff, then sleep on the queue event
+ */
+enum ff_wait_t { FF_WAIT_SPIN=0, FF_WAIT_ADAPTIVE=1 };
+
+/*!
+ * \class ff_event
+ * \ingroup building_blocks
+ *
+ * \brief Sleep/wake-up event used by the adaptive waiting policy.
+ *
+ * The event is owned by the waiting thread and registered on the queue(s)
+ * it waits on. The protocol is the classic one for futex-based events:
+ * the waiter reads the sequence number, announces itself and re-checks the
+ * queue before sleeping; the notifier publishes the data, then bumps the
+ * sequence and wakes up only if there are waiters.
+ */
+class ff_event {
+public:
+    ff_event() { seq.store(0); waiters.store(0); }
+
+    /// waiter side: it must be followed by either cancel_wait or commit_wait
+    inline unsigned prepare_wait() {
+        const unsigned s = seq.load(std::memory_order_acquire);
+        waiters.fetch_add(1);   // full barrier
+        return s;
+    }
+    inline void cancel_wait() { waiters.fetch_sub(1); }
+
+    /// waiter side: sleeps at most \p us microseconds if nobody notified since \p s
+    inline void commit_wait(unsigned s, unsigned long us) {
+#if defined(__linux__)
+        struct timespec ts = { (time_t)(us/1000000), (long)((us%1000000)*1000) };
+        syscall(SYS_futex, reinterpret_cast<int*>(&seq), FUTEX_WAIT_PRIVATE,
+                (int)s, &ts, NULL, 0);
+#else
+        if (seq.load(std::memory_order_acquire) == s) {
+            struct timespec ts = { 0, (long)(((us<50)?us:50)*1000) };
+            nanosleep(&ts, NULL);
+        }
+#endif
+        waiters.fetch_sub(1);
+    }
+
+    /// notifier side: the caller has already published the data
+    inline void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiters.load(std::memory_order_relaxed) == 0) return;
+        seq.fetch_add(1);
+#if defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<int*>(&seq), FUTEX_WAKE_PRIVATE,
+                INT_MAX, NULL, NULL, 0);
+#endif
+    }
+
+private:
+    std::atomic<unsigned> seq;
+    std::atomic<int>      waiters;
+};
+
+/*!
+ * \class ff_backoff
+ * \ingroup building_blocks
+ *
+ * \brief Exponential backoff: the n-th round spins 2^n times.
+ */
+struct ff_backoff {
+    ff_backoff():round(0) {}
+    inline void reset() { round = 0; }
+
+    /// returns false when the spinning budget is over and the caller should sleep
+    inline bool spin() {
+        if (round >= FF_ADAPTIVE_SPIN_ROUNDS) return false;
+        for(unsigned i=0;i<(1u<<round);++i) PAUSE();
+        ++round;
+        return true;
+    }
+    unsigned round;
+};
+
+/*!
+ * \class ff_waiter
+ * \ingroup building_blocks
+ *
+ * \brief Per-thread state of the adaptive waiting policy.
+ *
+ * \p wait is called after each failed poll of the channel(s), \p done
+ * after each successful one. Once the backoff budget is over, the first
+ * call to \p wait arms the event and returns so that the caller polls
+ * its channels once more; the next call sleeps. Any push/pop performed
+ * by a peer after the event has been armed makes the sleep return
+ * immediately, so no ad-hoc re-check of the waiting condition is needed
+ * (this works also for threads polling many queues, e.g. the collector).
+ */
+class ff_waiter {
+public:
+    ff_waiter():armed(false),key(0) {}
+
+    inline ff_event *event() { return &ev; }
+
+    inline void wait() {
+        if (bo.spin()) return;
+        if (!armed) {
+            key = ev.prepare_wait();
+            armed = true;
+            return;
+        }
+        ev.commit_wait(key, FF_ADAPTIVE_SLEEP_US);
+        armed = false;
+    }
+
+    inline void done() {
+        bo.reset();
+        if (armed) { ev.cancel_wait(); armed = false; }
+    }
+
+private:
+    ff_event   ev;
+    ff_backoff bo;
+    bool       armed;
+    unsigned   key;
+};
+
+/* wakes up the consumer (resp. the producer) of the queue q, if any is sleeping */
+template<typename Q>
+static inline void ff_wakeup_consumer(Q *const q) {
+    ff_event *const ev = q->get_cons_event();
+    if (ev) ev->notify();
+}
+template<typename Q>
+static inline void ff_wakeup_producer(Q *const q) {
+    ff_event *const ev = q->get_prod_event();
+    if (ev) ev->notify();
+}
+
+} // namespace ff
+
+#endif /* FF_WAITPOLICY_HPP */
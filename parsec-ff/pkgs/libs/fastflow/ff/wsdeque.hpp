@@ -0,0 +1,258 @@
+/* -*- Mode: C++; tab-width: 4; c-basic-offset: 4; indent-tabs-mode: nil -*- */
+
+/*!
+ *  \file wsdeque.hpp
+ *  \ingroup building_blocks
+ *
+ *  \brief Task deques used by the work-stealing farm
+ *
+ *  In work-stealing mode (see \p ff_farm::set_scheduling_workstealing) the
+ *  Emitter keeps pushing tasks into the SWSR input channel of each worker.
+ *  Each worker moves the tasks from its channel into its own deque and
+ *  takes them from the head; a worker with nothing to do steals from the
+ *  tail of the deque of a busy peer. Control messages (EOS, GO_OUT, ...)
+ *  are never moved into the deques, so they cannot be stolen.
+ */
+
+/* ***************************************************************************
+ *
+ *  This program is free software; you can redistribute it and/or modify it
+ *  under the terms of the GNU Lesser General Public License version 3 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful, but WITHOUT
+ *  ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ *  FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ *  License for more details.
+ *
+ *  You should have received a copy of the GNU Lesser General Public License
+ *  along with this program; if not, write to the Free Software Foundation,
+ *  Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ *
+ ****************************************************************************
+ */
+
+#ifndef FF_WSDEQUE_HPP
+#define FF_WSDEQUE_HPP
+
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+#include <pthread.h>
+#include <ff/config.hpp>
+#include <ff/sysdep.h>
+#include <ff/spin-lock.hpp>
+#include <ff/svector.hpp>
+#include <ff/ubuffer.hpp>
+
+namespace ff {
+
+// number of tasks moved from the input channel to the deque at a time
+#if !defined(FF_WS_BATCH)
+#define FF_WS_BATCH 64
+#endif
+
+/*!
+ * \class ff_wsdeque
+ * \ingroup building_blocks
+ *
+ * \brief Growable circular deque protected by a spin-lock.
+ *
+ * The owner appends at the tail and takes from the head, thieves take from
+ * the tail. The owner appends batches of tasks so the lock is acquired
+ * once per batch. The number of elements can be read without the lock, so
+ * thieves skip empty deques without touching the lock.
+ * The deque also counts the tasks pushed in the input channel of its owner
+ * and not yet moved into the deque (the channel is read by the owner only).
+ */
+class ff_wsdeque {
+public:
+    ff_wsdeque(size_t n=1024):buf(NULL),mask(0),head(0) {
+        init_unlocked(lock);
+        cnt.store(0);
+        inchannel.store(0);
+        size_t cap=1;
+        while(cap<n) cap<<=1;
+        buf  = (void**)::malloc(cap*sizeof(void*));
+        mask = cap-1;
+    }
+    ~ff_wsdeque() { if (buf) ::free(buf); }
+
+    /// owner: appends \p n tasks at the tail
+    inline bool push(void ** t, size_t n) {
+        spin_lock(lock);
+        const size_t c = cnt.load(std::memory_order_relaxed);
+        if (c+n > mask+1 && !grow(c+n)) { spin_unlock(lock); return false; }
+        for(size_t i=0;i<n;++i) buf[(head+c+i) & mask] = t[i];
+        cnt.store(c+n, std::memory_order_relaxed);
+        spin_unlock(lock);
+        return true;
+    }
+
+    /// owner: takes the task at the head
+    inline bool pop(void ** t) {
+        if (cnt.load(std::memory_order_relaxed)==0) return false;
+        spin_lock(lock);
+        const size_t c = cnt.load(std::memory_order_relaxed);
+        if (c==0) { spin_unlock(lock); return false; }
+        *t   = buf[head];
+        head = (head+1) & mask;
+        cnt.store(c-1, std::memory_order_relaxed);
+        spin_unlock(lock);
+        return true;
+    }
+
+    /// thief: takes the task at the tail
+    inline bool steal(void ** t) {
+        if (cnt.load(std::memory_order_relaxed)==0) return false;
+        spin_lock(lock);
+        const size_t c = cnt.load(std::memory_order_relaxed);
+        if (c==0) { spin_unlock(lock); return false; }
+        *t = buf[(head+c-1) & mask];
+        cnt.store(c-1, std::memory_order_relaxed);
+        spin_unlock(lock);
+        return true;
+    }
+
+    /// approximate number of tasks (read without taking the lock)
+    inline size_t size() const { return cnt.load(std::memory_order_relaxed); }
+
+    /// producer of the owner channel: \p n tasks are being pushed (or, if 
+    /// negative, they could not be pushed); owner: \p -n tasks have been moved
+    /// from the channel into the deque
+    inline void queued(long n) { inchannel.fetch_add((size_t)n); }
+    /// approximate number of tasks in the owner input channel
+    inline size_t inchannel_size() const { return inchannel.load(std::memory_order_relaxed); }
+
+private:
+    // called with the lock held
+    inline bool grow(size_t n) {
+        size_t cap = mask+1;
+        while(cap<n) cap<<=1;
+        void ** nbuf = (void**)::malloc(cap*sizeof(void*));
+        if (!nbuf) return false;
+        const size_t c = cnt.load(std::memory_order_relaxed);
+        for(size_t i=0;i<c;++i) nbuf[i] = buf[(head+i) & mask];
+        ::free(buf);
+        buf  = nbuf;
+        mask = cap-1;
+        head = 0;
+        return true;
+    }
+
+private:
+    lock_t              lock;
+    void             ** buf;
+    size_t              mask;
+    size_t              head;
+    std::atomic<size_t> cnt;
+    std::atomic<size_t> inchannel;
+};
+
+/*!
+ * \class ff_wsgroup
+ * \ingroup building_blocks
+ *
+ * \brief The deques of all the workers of a work-stealing farm.
+ */
+class ff_wsgroup {
+public:
+    ff_wsgroup(size_t nw):deques(nw>0?nw:1),sleepers(nw>0?nw:1) {
+        nsleeping.store(0);
+        for(size_t i=0;i<nw;++i) {
+            ff_wsdeque *d = (ff_wsdeque*)getAlignedMemory(64, sizeof(ff_wsdeque));
+            if (!d) abort();
+            deques.push_back(new (d) ff_wsdeque);
+            sleeper_t s = { NULL, NULL, false };
+            sleepers.push_back(s);
+        }
+    }
+    ~ff_wsgroup() {
+        for(size_t i=0;i<deques.size();++i) {
+            deques[i]->~ff_wsdeque();
+            freeAlignedMemory(deques[i]);
+        }
+    }
+
+    inline size_t size() const { return deques.size(); }
+    inline ff_wsdeque *get(size_t id) const { return deques[id]; }
+
+    /**
+     * Returns true if some peer of \p id still has tasks in its deque or in
+     * its input channel, i.e. if there may be something to steal soon.
+     */
+    inline bool busy(size_t id) {
+        for(size_t v=0;v<deques.size();++v) {
+            if (v == id) continue;
+            if (deques[v]->size() || deques[v]->inchannel_size()) return true;
+        }
+        return false;
+    }
+
+    /// returns true if some peer of \p id has tasks in its deque
+    inline bool stealable(size_t id) {
+        for(size_t v=0;v<deques.size();++v)
+            if (v != id && deques[v]->size()) return true;
+        return false;
+    }
+
+    /*
+     * Blocking mode: the worker \p id sleeps on the condition variable \p c
+     * (protected by \p m) when it has nothing to pop and nothing to steal.
+     * The peers wake it up when they move new tasks into their deque.
+     */
+    inline void set_sleeper(size_t id, pthread_mutex_t *m, pthread_cond_t *c) {
+        sleepers[id].m = m; sleepers[id].c = c;
+    }
+    /// called by the worker \p id holding its mutex, before and after sleeping
+    inline void sleeping(size_t id, bool s) {
+        if (sleepers[id].sleeping == s) return;
+        sleepers[id].sleeping = s;
+        if (s) nsleeping.fetch_add(1); else nsleeping.fetch_sub(1);
+        // pairs with the fence in wakeup: either the sleeper sees the new 
+        // tasks (stealable) or the peer sees the sleeper
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+    /// called by the worker \p id after having moved new tasks into its deque
+    inline void wakeup(size_t id) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (nsleeping.load(std::memory_order_relaxed) == 0) return;
+        for(size_t v=0;v<sleepers.size();++v) {
+            if (v == id || !sleepers[v].m) continue;
+            pthread_mutex_lock(sleepers[v].m);
+            if (sleepers[v].sleeping) pthread_cond_signal(sleepers[v].c);
+            pthread_mutex_unlock(sleepers[v].m);
+        }
+    }
+
+    /**
+     * Steals one task for the worker \p id. The peers are visited starting
+     * from a random one (\p seed is the thief private state); empty deques
+     * are skipped without taking their lock.
+     */
+    inline bool steal(size_t id, void ** t, unsigned &seed) {
+        const size_t n = deques.size();
+        seed = seed*1103515245u + 12345u;
+        const size_t start = (seed>>16) % n;
+        for(size_t i=0;i<n;++i) {
+            const size_t v = (start+i) % n;
+            if (v == id) continue;
+            if (deques[v]->size() && deques[v]->steal(t)) return true;
+        }
+        return false;
+    }
+
+private:
+    struct sleeper_t {
+        pthread_mutex_t *m;
+        pthread_cond_t  *c;
+        bool             sleeping;  // protected by m
+    };
+    svector<ff_wsdeque*> deques;
+    svector<sleeper_t>   sleepers;
+    std::atomic<size_t>  nsleeping;
+};
+
+} // namespace ff
+
+#endif /* FF_WSDEQUE_HPP */